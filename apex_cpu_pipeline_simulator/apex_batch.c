@@ -0,0 +1,776 @@
+/*
+ * apex_batch.c
+ * Contains the batch runner which simulates many programs concurrently
+ *
+ * Every job owns its APEX_CPU and its trace sink, so jobs share no state.
+ * Jobs are dealt round-robin onto per-worker deques; a worker pops from the
+ * back of its own deque and, once that is empty, steals from the front of
+ * the others. No job is added after start, so a worker that finds every
+ * deque empty is done.
+ *
+ * Jobs come from a list file (APEX_batch_load) or from the cross product of
+ * a sweep file (APEX_sweep_load).
+ */
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_batch.h"
+
+typedef struct Job_Deque
+{
+    pthread_mutex_t lock;
+    int *jobs;    /* Job indices */
+    int head;     /* Next index to steal */
+    int tail;     /* One past the next index to pop */
+} Job_Deque;
+
+typedef struct Batch_Pool
+{
+    APEX_Job *jobs;
+    Job_Deque *deques;
+    int num_workers;
+} Batch_Pool;
+
+typedef struct Worker_Arg
+{
+    Batch_Pool *pool;
+    int id;
+} Worker_Arg;
+
+static void
+free_job(APEX_Job *job)
+{
+    free(job->filename);
+    free(job->args);
+    free(job->arg_buffer);
+}
+
+/*
+ * Parses one list file line "<program> [options...]" into 'job'.
+ *
+ * Returns 1 for a job, 0 for a blank or comment line and -1 on error.
+ */
+static int
+parse_job_line(APEX_Job *job, char *line, const APEX_Options *defaults)
+{
+    char *saveptr;
+    char *token;
+
+    memset(job, 0, sizeof(APEX_Job));
+    job->options = *defaults;
+
+    token = strtok_r(line, " \t\r\n", &saveptr);
+    if (!token || token[0] == '#')
+    {
+        return 0;
+    }
+    job->filename = strdup(token);
+    job->args = strdup(saveptr ? saveptr : "");
+    job->args[strcspn(job->args, "\r\n")] = '\0';
+
+    /* Options point into job->arg_buffer, it lives as long as the job */
+    job->arg_buffer = strdup(job->args);
+    for (token = strtok_r(job->arg_buffer, " \t", &saveptr); token;
+         token = strtok_r(NULL, " \t", &saveptr))
+    {
+        if (options_parse(&job->options, token) != 1)
+        {
+            fprintf(stderr, "APEX_Error: %s: invalid option %s\n",
+                    job->filename, token);
+            free_job(job);
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Gives a job its own trace and checkpoint file when it needs one, jobs must
+ * never write to the shared stdout or overwrite each other's checkpoints.
+ * 'index' is the position of the job in the list.
+ */
+static void
+name_job_outputs(APEX_Job *job, int index)
+{
+    if (job->options.verbosity > APEX_VERBOSITY_QUIET && !job->options.trace_file)
+    {
+        snprintf(job->trace_file, sizeof(job->trace_file), "%s.%d.trace",
+                 job->filename, index);
+        job->options.trace_file = job->trace_file;
+    }
+
+    if (job->options.checkpoint_at >= 0 && !job->options.checkpoint_file)
+    {
+        snprintf(job->checkpoint_file, sizeof(job->checkpoint_file),
+                 "%s.%d.ckpt", job->filename, index);
+        job->options.checkpoint_file = job->checkpoint_file;
+    }
+}
+
+/*
+ * Reads the list file, one job per line. Options on a line override
+ * 'defaults', so the same program may appear several times with different
+ * options.
+ *
+ * Returns the number of jobs stored in '*jobs', or -1 on error.
+ */
+int
+APEX_batch_load(const char *list_file, const APEX_Options *defaults,
+                APEX_Job **jobs)
+{
+    FILE *fp;
+    char *line = NULL;
+    size_t len = 0;
+    int num_jobs = 0;
+    int capacity = 0;
+
+    *jobs = NULL;
+    fp = fopen(list_file, "r");
+    if (!fp)
+    {
+        return -1;
+    }
+
+    while (getline(&line, &len, fp) != -1)
+    {
+        APEX_Job job;
+        int ret = parse_job_line(&job, line, defaults);
+
+        if (ret < 0)
+        {
+            free(line);
+            fclose(fp);
+            APEX_batch_free(*jobs, num_jobs);
+            *jobs = NULL;
+            return -1;
+        }
+        if (ret == 0)
+        {
+            continue;
+        }
+
+        if (num_jobs == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            *jobs = realloc(*jobs, capacity * sizeof(APEX_Job));
+        }
+
+        name_job_outputs(&job, num_jobs);
+        (*jobs)[num_jobs++] = job;
+    }
+
+    /* The file names may point into the job itself, fix them after the moves */
+    for (int i = 0; i < num_jobs; i++)
+    {
+        if ((*jobs)[i].trace_file[0])
+        {
+            (*jobs)[i].options.trace_file = (*jobs)[i].trace_file;
+        }
+        if ((*jobs)[i].checkpoint_file[0])
+        {
+            (*jobs)[i].options.checkpoint_file = (*jobs)[i].checkpoint_file;
+        }
+    }
+    free(line);
+    fclose(fp);
+    return num_jobs;
+}
+
+#define SWEEP_MAX_PARAMS 16
+
+/* One swept setting and the values it takes */
+typedef struct Sweep_Param
+{
+    char name[64];
+    char **values;        /* As written after "--<name>=" */
+    int num_values;
+} Sweep_Param;
+
+/* Appends one value to 'param' */
+static void
+add_sweep_value(Sweep_Param *param, int *capacity, const char *value)
+{
+    if (param->num_values == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        param->values = realloc(param->values, *capacity * sizeof(char *));
+    }
+    param->values[param->num_values++] = strdup(value);
+}
+
+/*
+ * Parses the values of a sweep line, each either a number, an inclusive
+ * range "first:last[:step]" or the name of a value such as "gshare", into
+ * 'param'. Names are checked when the jobs are created. A value starting
+ * with a digit or a sign must be a number or a range in full, "16x" is
+ * refused, and a range must hold at least one value with a step above 0.
+ *
+ * Returns 0 on success, -1 on a malformed value, which is left in '*bad',
+ * or when there are no values, with '*bad' NULL.
+ */
+static int
+parse_sweep_values(Sweep_Param *param, char *values, const char **bad)
+{
+    char *saveptr;
+    char *token;
+    int capacity = 0;
+
+    *bad = NULL;
+    for (token = strtok_r(values, " \t\r\n", &saveptr); token;
+         token = strtok_r(NULL, " \t\r\n", &saveptr))
+    {
+        char text[64];
+        char *fields[3] = { text, NULL, NULL };
+        long range[3] = { 0, 0, 1 };
+        int num_fields = 1;
+
+        if (!isdigit((unsigned char)token[0]) && token[0] != '-' && token[0] != '+')
+        {
+            add_sweep_value(param, &capacity, token);
+            continue;
+        }
+
+        /* Split a copy at the colons, 'token' is kept for the error */
+        *bad = token;
+        if (strlen(token) >= sizeof(text))
+        {
+            return -1;
+        }
+        strcpy(text, token);
+        for (char *c = text; *c; c++)
+        {
+            if (*c == ':' && num_fields < 3)
+            {
+                *c = '\0';
+                fields[num_fields++] = c + 1;
+            }
+        }
+        for (int f = 0; f < num_fields; f++)
+        {
+            if (config_parse_number(fields[f], INT_MIN, INT_MAX, &range[f]) != 0)
+            {
+                return -1;
+            }
+        }
+        if (num_fields == 1)
+        {
+            range[1] = range[0];
+        }
+        if (range[1] < range[0] || range[2] <= 0)
+        {
+            return -1;
+        }
+        *bad = NULL;
+
+        for (long v = range[0]; v <= range[1]; v += range[2])
+        {
+            char number[16];
+
+            snprintf(number, sizeof(number), "%ld", v);
+            add_sweep_value(param, &capacity, number);
+        }
+    }
+    return param->num_values > 0 ? 0 : -1;
+}
+
+/*
+ * Reads a sweep file and creates one job per program and point of the cross
+ * product of all swept settings:
+ *
+ *   program <file> [options...]     once per program, options as in a list
+ *   <setting> <values...>           e.g. "iq-size 8 16 32", "rob-size 16:128:16"
+ *                                   or "bpred bimodal gshare"
+ *
+ * A setting is anything config_parse() accepts. Each job's args lists the
+ * program options followed by its point, e.g. "--iq-size=8 --rob-size=16".
+ * Jobs are ordered by program, then by point.
+ *
+ * Returns the number of jobs stored in '*jobs', or -1 on error.
+ */
+int
+APEX_sweep_load(const char *sweep_file, const APEX_Options *defaults,
+                APEX_Job **jobs)
+{
+    Sweep_Param params[SWEEP_MAX_PARAMS];
+    char **programs = NULL;
+    int num_programs = 0;
+    int num_params = 0;
+    int num_jobs = -1;
+    long num_points = 1;
+    int line_no = 0;
+    char *line = NULL;
+    size_t len = 0;
+    FILE *fp;
+
+    *jobs = NULL;
+    memset(params, 0, sizeof(params));
+    fp = fopen(sweep_file, "r");
+    if (!fp)
+    {
+        return -1;
+    }
+
+    while (getline(&line, &len, fp) != -1)
+    {
+        char *start = line + strspn(line, " \t");
+        char *rest = start + strcspn(start, " \t\r\n");
+
+        line_no++;
+        if (*start == '\0' || *start == '#' || *start == '\n' || *start == '\r')
+        {
+            continue;
+        }
+        if (*rest)
+        {
+            *rest++ = '\0';
+        }
+        rest[strcspn(rest, "\r\n")] = '\0';
+
+        if (strcmp(start, "program") == 0)
+        {
+            programs = realloc(programs, (num_programs + 1) * sizeof(char *));
+            programs[num_programs++] = strdup(rest);
+        }
+        else
+        {
+            Sweep_Param *param = &params[num_params];
+            APEX_Config probe;
+            char setting[96];
+            const char *bad;
+
+            /* Check the name with a dummy value before taking the line */
+            config_init(&probe);
+            snprintf(setting, sizeof(setting), "%s=1", start);
+            if (num_params == SWEEP_MAX_PARAMS || strlen(start) >= sizeof(param->name)
+                || config_parse(&probe, setting) == 0)
+            {
+                fprintf(stderr, "APEX_Error: %s:%d: cannot sweep %s\n", sweep_file,
+                        line_no, start);
+                goto out;
+            }
+            strcpy(param->name, start);
+            num_params++;
+            if (parse_sweep_values(param, rest, &bad) != 0)
+            {
+                if (bad)
+                {
+                    fprintf(stderr, "APEX_Error: %s:%d: bad value %s for %s\n", sweep_file,
+                            line_no, bad, start);
+                }
+                else
+                {
+                    fprintf(stderr, "APEX_Error: %s:%d: no values for %s\n", sweep_file,
+                            line_no, start);
+                }
+                goto out;
+            }
+            num_points *= param->num_values;
+        }
+    }
+
+    *jobs = calloc(num_programs * num_points + 1, sizeof(APEX_Job));
+    num_jobs = 0;
+    for (int p = 0; p < num_programs; p++)
+    {
+        for (long point = 0; point < num_points; point++)
+        {
+            char job_line[1024];
+            size_t used;
+            long stride = num_points;
+
+            /*
+             * Append the point as options, the first setting varies slowest.
+             * options_parse() hands them to config_parse().
+             */
+            used = snprintf(job_line, sizeof(job_line), "%s", programs[p]);
+            for (int k = 0; k < num_params && used < sizeof(job_line); k++)
+            {
+                stride /= params[k].num_values;
+                used += snprintf(job_line + used, sizeof(job_line) - used, " --%s=%s",
+                                 params[k].name,
+                                 params[k].values[(point / stride) % params[k].num_values]);
+            }
+
+            if (used >= sizeof(job_line)
+                || parse_job_line(&(*jobs)[num_jobs], job_line, defaults) != 1)
+            {
+                fprintf(stderr, "APEX_Error: %s: bad program line %s\n",
+                        sweep_file, programs[p]);
+                APEX_batch_free(*jobs, num_jobs);
+                *jobs = NULL;
+                num_jobs = -1;
+                goto out;
+            }
+            name_job_outputs(&(*jobs)[num_jobs], num_jobs);
+            num_jobs++;
+        }
+    }
+
+out:
+    for (int p = 0; p < num_programs; p++)
+    {
+        free(programs[p]);
+    }
+    for (int k = 0; k < num_params; k++)
+    {
+        for (int v = 0; v < params[k].num_values; v++)
+        {
+            free(params[k].values[v]);
+        }
+        free(params[k].values);
+    }
+    free(programs);
+    free(line);
+    fclose(fp);
+    return num_jobs;
+}
+
+static void
+run_job(APEX_Job *job)
+{
+    APEX_CPU *cpu;
+    double start;
+
+    job->status = APEX_JOB_ERROR;
+    job->check = APEX_CHECK_NONE;
+    cpu = APEX_cpu_init(job->filename, &job->options.config);
+    if (!cpu)
+    {
+        return;
+    }
+
+    if (APEX_cpu_apply_options(cpu, &job->options) == 0)
+    {
+        /* Never block on the single-step prompt inside a worker */
+        cpu->single_step = FALSE;
+        start = host_seconds();
+        job->status = APEX_cpu_run(cpu);
+        job->host_seconds = host_seconds() - start;
+        job->cycles = cpu->clock;
+        job->instructions = cpu->insn_completed;
+        memcpy(job->stalls, cpu->stalls, sizeof(job->stalls));
+        memcpy(job->cpi_slots, cpu->cpi_slots, sizeof(job->cpi_slots));
+        job->branches = cpu->bpred.branches;
+        job->branches_correct = cpu->bpred.correct;
+        job->branch_flushes = cpu->branch_flushes;
+        job->jumps = 0;
+        job->jumps_correct = 0;
+        for (int t = 0; t < NUM_TARGETS; t++)
+        {
+            job->jumps += cpu->bpred.targets[t];
+            job->jumps_correct += cpu->bpred.targets_correct[t];
+        }
+        job->btb_hits = cpu->btb.hits;
+        job->btb_misses = cpu->btb.misses;
+        job->btb_conflicts = cpu->btb.conflicts;
+        job->icache_hits = cpu->icache.hits;
+        job->icache_misses = cpu->icache.misses;
+        job->fetch_line_breaks = cpu->fetch_line_breaks;
+        job->dcache_hits = cpu->dcache.hits;
+        job->dcache_misses = cpu->dcache.misses;
+        job->dcache_evictions = cpu->dcache.evictions;
+        job->dcache_writebacks = cpu->dcache.writebacks;
+        if (job->options.check && job->status == APEX_RUN_HALTED)
+        {
+            job->check = APEX_emu_check(cpu, job->filename);
+        }
+    }
+    APEX_cpu_stop(cpu);
+}
+
+static int
+deque_pop(Job_Deque *dq, int *job)
+{
+    int found = FALSE;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail > dq->head)
+    {
+        *job = dq->jobs[--dq->tail];
+        found = TRUE;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static int
+deque_steal(Job_Deque *dq, int *job)
+{
+    int found = FALSE;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail > dq->head)
+    {
+        *job = dq->jobs[dq->head++];
+        found = TRUE;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static void *
+worker_main(void *arg)
+{
+    Worker_Arg *worker = arg;
+    Batch_Pool *pool = worker->pool;
+    int job;
+
+    while (TRUE)
+    {
+        int found = deque_pop(&pool->deques[worker->id], &job);
+
+        for (int i = 1; !found && i < pool->num_workers; i++)
+        {
+            int victim = (worker->id + i) % pool->num_workers;
+            found = deque_steal(&pool->deques[victim], &job);
+        }
+
+        if (!found)
+        {
+            break;
+        }
+        run_job(&pool->jobs[job]);
+    }
+    return NULL;
+}
+
+/*
+ * Runs all jobs on 'num_threads' worker threads and stores the results in
+ * the jobs. Returns once every job has finished.
+ */
+void
+APEX_batch_run(APEX_Job *jobs, int num_jobs, int num_threads)
+{
+    Batch_Pool pool;
+    pthread_t *threads;
+    Worker_Arg *args;
+    int i;
+
+    if (num_threads < 1)
+    {
+        num_threads = 1;
+    }
+    if (num_threads > num_jobs)
+    {
+        num_threads = num_jobs > 0 ? num_jobs : 1;
+    }
+
+    pool.jobs = jobs;
+    pool.num_workers = num_threads;
+    pool.deques = calloc(num_threads, sizeof(Job_Deque));
+    threads = calloc(num_threads, sizeof(pthread_t));
+    args = calloc(num_threads, sizeof(Worker_Arg));
+
+    for (i = 0; i < num_threads; i++)
+    {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].jobs = calloc(num_jobs / num_threads + 1, sizeof(int));
+    }
+
+    /* Deal jobs round-robin, list order is roughly the order they start in */
+    for (i = num_jobs - 1; i >= 0; i--)
+    {
+        Job_Deque *dq = &pool.deques[i % num_threads];
+        dq->jobs[dq->tail++] = i;
+    }
+
+    for (i = 0; i < num_threads; i++)
+    {
+        args[i].pool = &pool;
+        args[i].id = i;
+        pthread_create(&threads[i], NULL, worker_main, &args[i]);
+    }
+
+    for (i = 0; i < num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].jobs);
+    }
+
+    free(args);
+    free(threads);
+    free(pool.deques);
+}
+
+static const char *
+job_status_name(int status)
+{
+    switch (status)
+    {
+        case APEX_RUN_HALTED:
+            return "halted";
+        case APEX_RUN_STOPPED:
+            return "stopped";
+        case APEX_RUN_DEADLOCK:
+            return "deadlock";
+        default:
+            return "error";
+    }
+}
+
+static const char *
+job_check_name(int check)
+{
+    switch (check)
+    {
+        case APEX_CHECK_MATCH:
+            return "match";
+        case APEX_CHECK_MISMATCH:
+            return "MISMATCH";
+        case APEX_CHECK_SKIPPED:
+            return "skipped";
+        default:
+            return "-";
+    }
+}
+
+/* Host speed of a job in simulated cycles and thousand instructions per
+ * second */
+static void
+job_speed(const APEX_Job *job, double *cycles_per_s, double *kips)
+{
+    double seconds = job->host_seconds;
+
+    *cycles_per_s = seconds > 0 ? job->cycles / seconds : 0.0;
+    *kips = seconds > 0 ? job->instructions / seconds / 1e3 : 0.0;
+}
+
+/* Prints one summary row per job, in list order */
+void
+APEX_batch_report(FILE *fp, const APEX_Job *jobs, int num_jobs)
+{
+    fprintf(fp, "%-32s %-24s %-8s %12s %12s %8s %10s %12s %10s %-8s\n",
+            "program", "options", "status", "cycles", "instructions", "IPC",
+            "host_s", "cycles/s", "KIPS", "check");
+
+    for (int i = 0; i < num_jobs; i++)
+    {
+        const APEX_Job *job = &jobs[i];
+        double ipc = job->cycles > 0 ? (double)job->instructions / job->cycles : 0.0;
+        double cycles_per_s, kips;
+
+        job_speed(job, &cycles_per_s, &kips);
+        fprintf(fp, "%-32s %-24s %-8s %12d %12d %8.3f %10.4f %12.0f %10.1f %-8s\n",
+                job->filename, job->args[0] ? job->args : "-",
+                job_status_name(job->status), job->cycles, job->instructions,
+                ipc, job->host_seconds, cycles_per_s, kips,
+                job_check_name(job->check));
+    }
+}
+
+/* Share of the commit slots of a job in CPI_* category 'category' */
+static double
+cpi_share(const APEX_Job *job, int category)
+{
+    long slots = 0;
+
+    for (int c = 0; c < NUM_CPI; c++)
+    {
+        slots += job->cpi_slots[c];
+    }
+    return slots > 0 ? (double)job->cpi_slots[category] / slots : 0.0;
+}
+
+/* Prints 'text' as a quoted CSV field, doubling any quotes inside it */
+static void
+csv_field(FILE *fp, const char *text)
+{
+    fputc('"', fp);
+    for (const char *c = text; *c; c++)
+    {
+        if (*c == '"')
+        {
+            fputc('"', fp);
+        }
+        fputc(*c, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * Prints the jobs as CSV, one row per job in list order, with the complete
+ * machine configuration of each so rows of a sweep can be compared directly,
+ * followed by the branch predictor accuracy, the BTB and cache counters, the
+ * stall counters and the CPI stack as shares of the slots.
+ */
+void
+APEX_batch_csv(FILE *fp, const APEX_Job *jobs, int num_jobs)
+{
+    fprintf(fp, "program,options,iq_size,bq_size,rob_size,lsq_size,prf_size,"
+                "branch_checkpoints,btb_size,btb_ways,width,mul_latency,bpred,bpred_size,"
+                "bpred_history,ras_size,indirect_size,icache_size,icache_ways,icache_line,icache_miss_latency,"
+                "dcache_size,dcache_ways,dcache_line,dcache_hit_latency,"
+                "dcache_miss_latency,dcache_policy,status,cycles,instructions,ipc,host_s,"
+                "cycles_per_s,kips,check,branches,bpred_accuracy,jumps,jump_accuracy,"
+                "branch_flushes,btb_hits,btb_misses,btb_conflicts,icache_hits,"
+                "icache_misses,fetch_line_breaks,dcache_hits,dcache_misses,"
+                "dcache_evictions,dcache_writebacks");
+    for (int s = 0; s < NUM_STALLS; s++)
+    {
+        fprintf(fp, ",%s", APEX_stall_name(s));
+    }
+    for (int c = 0; c < NUM_CPI; c++)
+    {
+        fprintf(fp, ",cpi_%s", APEX_cpi_name(c));
+    }
+    fprintf(fp, "\n");
+
+    for (int i = 0; i < num_jobs; i++)
+    {
+        const APEX_Job *job = &jobs[i];
+        const APEX_Config *config = &job->options.config;
+        double ipc = job->cycles > 0 ? (double)job->instructions / job->cycles : 0.0;
+        double cycles_per_s, kips;
+
+        job_speed(job, &cycles_per_s, &kips);
+        csv_field(fp, job->filename);
+        fputc(',', fp);
+        csv_field(fp, job->args);
+        fprintf(fp, ",%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,"
+                "%d,%d,%d,%d,%s,%s,%d,%d,%.4f,%.6f,%.0f,%.1f,%s,%ld,%.4f,%ld,%.4f,%ld,"
+                "%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld",
+                config->iq_size, config->bq_size,
+                config->rob_size, config->lsq_size, config->rename_regs,
+                config->branch_checkpoints,
+                config->btb_size, config->btb_ways, config->width, config->mul_latency,
+                bpred_name(config->bpred), config->bpred_size, config->bpred_history,
+                config->ras_size, config->indirect_size, config->icache_size,
+                config->icache_ways, config->icache_line, config->icache_miss_latency,
+                config->dcache_size,
+                config->dcache_ways, config->dcache_line, config->dcache_hit_latency,
+                config->dcache_miss_latency, cache_policy_name(config->dcache_policy),
+                job_status_name(job->status), job->cycles,
+                job->instructions, ipc, job->host_seconds, cycles_per_s, kips,
+                job_check_name(job->check), job->branches,
+                job->branches > 0 ? (double)job->branches_correct / job->branches : 0.0,
+                job->jumps, job->jumps > 0 ? (double)job->jumps_correct / job->jumps : 0.0,
+                job->branch_flushes, job->btb_hits, job->btb_misses, job->btb_conflicts,
+                job->icache_hits, job->icache_misses, job->fetch_line_breaks,
+                job->dcache_hits, job->dcache_misses, job->dcache_evictions,
+                job->dcache_writebacks);
+        for (int s = 0; s < NUM_STALLS; s++)
+        {
+            fprintf(fp, ",%ld", job->stalls[s]);
+        }
+        for (int c = 0; c < NUM_CPI; c++)
+        {
+            fprintf(fp, ",%.4f", cpi_share(job, c));
+        }
+        fprintf(fp, "\n");
+    }
+}
+
+void
+APEX_batch_free(APEX_Job *jobs, int num_jobs)
+{
+    for (int i = 0; i < num_jobs; i++)
+    {
+        free_job(&jobs[i]);
+    }
+    free(jobs);
+}
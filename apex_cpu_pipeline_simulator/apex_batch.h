@@ -0,0 +1,56 @@
+/*
+ * apex_batch.h
+ * Contains the batch runner which simulates many programs concurrently
+ */
+#ifndef _APEX_BATCH_H_
+#define _APEX_BATCH_H_
+
+#include "apex_emu.h"
+#include "apex_options.h"
+
+/* Status of a batch job besides the APEX_RUN_* outcomes */
+#define APEX_JOB_ERROR -1 /* Program could not be loaded or set up */
+
+/* One program/option combination and its results */
+typedef struct APEX_Job
+{
+    char *filename;
+    char *args;           /* Per-job options as written in the list file */
+    char *arg_buffer;     /* Tokenized copy of args the options point into */
+    APEX_Options options;
+    char trace_file[512];
+    char checkpoint_file[512];
+
+    int status;           /* APEX_RUN_* or APEX_JOB_ERROR */
+    int cycles;
+    int instructions;
+    long stalls[NUM_STALLS]; /* See APEX_CPU.stalls */
+    long cpi_slots[NUM_CPI];
+    long branches;        /* See APEX_BPred */
+    long branches_correct;
+    long branch_flushes;
+    long jumps;           /* JUMP/JALR committed */
+    long jumps_correct;   /* ... that went to the predicted target */
+    long btb_hits;        /* See APEX_BTB */
+    long btb_misses;
+    long btb_conflicts;
+    long icache_hits;     /* See APEX_Cache */
+    long icache_misses;
+    long fetch_line_breaks;
+    long dcache_hits;
+    long dcache_misses;
+    long dcache_evictions;
+    long dcache_writebacks;
+    double host_seconds;
+    int check;            /* APEX_CHECK_* */
+} APEX_Job;
+
+int APEX_batch_load(const char *list_file, const APEX_Options *defaults,
+                    APEX_Job **jobs);
+int APEX_sweep_load(const char *sweep_file, const APEX_Options *defaults,
+                    APEX_Job **jobs);
+void APEX_batch_run(APEX_Job *jobs, int num_jobs, int num_threads);
+void APEX_batch_report(FILE *fp, const APEX_Job *jobs, int num_jobs);
+void APEX_batch_csv(FILE *fp, const APEX_Job *jobs, int num_jobs);
+void APEX_batch_free(APEX_Job *jobs, int num_jobs);
+#endif
@@ -0,0 +1,287 @@
+/*
+ * apex_bpred.c
+ * Contains the branch direction predictors
+ */
+#include <string.h>
+
+#include "apex_bpred.h"
+#include "apex_macros.h"
+
+/* One kind of direction predictor */
+typedef struct BPred_Kind
+{
+    const char *name;
+    int (*predict)(const APEX_BPred *bp, int pc, BPred_Info *info);
+    void (*update)(APEX_BPred *bp, int pc, const BPred_Info *info, int taken);
+} BPred_Kind;
+
+/* Counter values 0-1 predict not taken, 2-3 taken */
+static void
+counter_update(uint8_t *counter, int taken)
+{
+    if (taken && *counter < 3)
+    {
+        (*counter)++;
+    }
+    else if (!taken && *counter > 0)
+    {
+        (*counter)--;
+    }
+}
+
+static uint32_t
+bimodal_index(const APEX_BPred *bp, int pc)
+{
+    return (uint32_t)(pc / 4) % bp->size;
+}
+
+static uint32_t
+gshare_index(const APEX_BPred *bp, int pc, uint32_t history)
+{
+    return ((uint32_t)(pc / 4) ^ history) % bp->size;
+}
+
+static int
+bimodal_predict(const APEX_BPred *bp, int pc, BPred_Info *info)
+{
+    info->bimodal = bp->bimodal[bimodal_index(bp, pc)] >= 2;
+    return info->bimodal;
+}
+
+static void
+bimodal_update(APEX_BPred *bp, int pc, const BPred_Info *info, int taken)
+{
+    (void)info; /* Bimodal counters do not depend on the history */
+    counter_update(&bp->bimodal[bimodal_index(bp, pc)], taken);
+}
+
+static int
+gshare_predict(const APEX_BPred *bp, int pc, BPred_Info *info)
+{
+    info->gshare = bp->gshare[gshare_index(bp, pc, info->history)] >= 2;
+    return info->gshare;
+}
+
+static void
+gshare_update(APEX_BPred *bp, int pc, const BPred_Info *info, int taken)
+{
+    counter_update(&bp->gshare[gshare_index(bp, pc, info->history)], taken);
+}
+
+/* Both components predict, a per-pc chooser picks whose answer to use */
+static int
+tournament_predict(const APEX_BPred *bp, int pc, BPred_Info *info)
+{
+    bimodal_predict(bp, pc, info);
+    gshare_predict(bp, pc, info);
+    return bp->chooser[bimodal_index(bp, pc)] >= 2 ? info->gshare : info->bimodal;
+}
+
+/* The chooser only learns from branches the components disagree on */
+static void
+tournament_update(APEX_BPred *bp, int pc, const BPred_Info *info, int taken)
+{
+    if (info->bimodal != info->gshare)
+    {
+        counter_update(&bp->chooser[bimodal_index(bp, pc)], info->gshare == taken);
+    }
+    bimodal_update(bp, pc, info, taken);
+    gshare_update(bp, pc, info, taken);
+}
+
+static const BPred_Kind bpred_kinds[NUM_BPRED] = {
+    [BPRED_BIMODAL] = {"bimodal", bimodal_predict, bimodal_update},
+    [BPRED_GSHARE] = {"gshare", gshare_predict, gshare_update},
+    [BPRED_TOURNAMENT] = {"tournament", tournament_predict, tournament_update},
+};
+
+static const char *const target_names[NUM_TARGETS] = {
+    [TARGET_NONE] = "none",
+    [TARGET_BTB] = "btb",
+    [TARGET_RAS] = "ras",
+    [TARGET_INDIRECT] = "indirect",
+};
+
+const char *
+bpred_name(int kind)
+{
+    return (kind >= 0 && kind < NUM_BPRED) ? bpred_kinds[kind].name : "unknown";
+}
+
+/* Name of a TARGET_*, as used in reports */
+const char *
+bpred_target_name(int source)
+{
+    return target_names[source];
+}
+
+/*
+ * Resets a predictor of BPRED_* 'kind' with 'size' entry tables and
+ * 'history_bits' of global history. The tables must already point into the
+ * CPU arena. Counters start weakly not taken, the chooser weakly on
+ * bimodal.
+ */
+void
+bpred_init(APEX_BPred *bp, int kind, int size, int history_bits)
+{
+    bp->kind = kind;
+    bp->size = size;
+    bp->history_mask = history_bits >= 32 ? ~0u : (1u << history_bits) - 1;
+    bp->history = 0;
+    memset(bp->bimodal, 1, size);
+    memset(bp->gshare, 1, size);
+    memset(bp->chooser, 1, size);
+    bp->branches = 0;
+    bp->correct = 0;
+    bp->bimodal_correct = 0;
+    bp->gshare_correct = 0;
+    memset(bp->targets, 0, sizeof(bp->targets));
+    memset(bp->targets_correct, 0, sizeof(bp->targets_correct));
+}
+
+/*
+ * Predicts the direction of the conditional branch at 'pc' and records in
+ * 'info' what the prediction was based on.
+ *
+ * Returns TRUE for taken.
+ */
+int
+bpred_predict(APEX_BPred *bp, int pc, BPred_Info *info)
+{
+    info->history = bp->history;
+    info->bimodal = FALSE;
+    info->gshare = FALSE;
+    info->taken = bpred_kinds[bp->kind].predict(bp, pc, info);
+    return info->taken;
+}
+
+/* Shifts the direction fetch actually followed into the global history,
+ * which can differ from the prediction when the BTB has no target */
+void
+bpred_follow(APEX_BPred *bp, int taken)
+{
+    bp->history = ((bp->history << 1) | (taken != 0)) & bp->history_mask;
+}
+
+/* Trains the predictor with the outcome of a committed branch */
+void
+bpred_update(APEX_BPred *bp, int pc, const BPred_Info *info, int taken)
+{
+    bp->branches++;
+    bp->correct += info->taken == taken;
+    bp->bimodal_correct += info->bimodal == taken;
+    bp->gshare_correct += info->gshare == taken;
+    bpred_kinds[bp->kind].update(bp, pc, info, taken);
+}
+
+/* Global history right after a conditional branch that went 'taken', fetch
+ * restarts with it when the branch mispredicted */
+uint32_t
+bpred_history_after(const APEX_BPred *bp, const BPred_Info *info, int taken)
+{
+    return ((info->history << 1) | (taken != 0)) & bp->history_mask;
+}
+
+/* Counts a committed JUMP or JALR by where fetch got its target from */
+void
+bpred_count_target(APEX_BPred *bp, const BPred_Info *info, int correct)
+{
+    bp->targets[info->source]++;
+    bp->targets_correct[info->source] += correct != 0;
+}
+
+/* Empties the stack, which must already point into the CPU arena */
+void
+ras_init(APEX_RAS *ras)
+{
+    ras->top = 0;
+    memset(ras->stack, 0, ras->size * sizeof(int));
+    memset(ras->link, RAS_NO_LINK, ras->size);
+}
+
+/* Pushes the return address of a JALR that links into register 'link', the
+ * oldest entry is overwritten once the stack is full */
+void
+ras_push(APEX_RAS *ras, int return_pc, int link)
+{
+    ras->top = (ras->top + 1) % ras->size;
+    ras->stack[ras->top] = return_pc;
+    ras->link[ras->top] = link;
+}
+
+/*
+ * Pops the return address of a JUMP through register 'link' into '*target'.
+ * A JUMP through any other register is not a return and leaves the stack
+ * alone.
+ *
+ * Returns TRUE if the JUMP is a return.
+ */
+int
+ras_pop(APEX_RAS *ras, int link, int *target)
+{
+    if (ras->link[ras->top] != link)
+    {
+        return FALSE;
+    }
+    *target = ras->stack[ras->top];
+    ras->link[ras->top] = RAS_NO_LINK;
+    ras->top = (ras->top + ras->size - 1) % ras->size;
+    return TRUE;
+}
+
+/* Records the top of the stack in 'info', enough to undo the pushes and
+ * pops of the wrong path after the instruction in most cases */
+void
+ras_save(const APEX_RAS *ras, BPred_Info *info)
+{
+    info->ras_top = ras->top;
+    info->ras_value = ras->stack[ras->top];
+    info->ras_link = ras->link[ras->top];
+}
+
+/* Repairs the stack to what it was after the instruction of 'info' */
+void
+ras_restore(APEX_RAS *ras, const BPred_Info *info)
+{
+    ras->top = info->ras_top;
+    ras->stack[ras->top] = info->ras_value;
+    ras->link[ras->top] = info->ras_link;
+}
+
+void
+indirect_init(APEX_Indirect *ind)
+{
+    memset(ind->entries, 0, ind->size * sizeof(Indirect_Entry));
+}
+
+static Indirect_Entry *
+indirect_entry(const APEX_Indirect *ind, int pc, uint32_t history)
+{
+    return &ind->entries[((uint32_t)(pc / 4) ^ history) % ind->size];
+}
+
+/* Looks up the target of the JUMP at 'pc' under 'history', returns TRUE
+ * and stores it in '*target' on a hit */
+int
+indirect_lookup(const APEX_Indirect *ind, int pc, uint32_t history, int *target)
+{
+    const Indirect_Entry *entry = indirect_entry(ind, pc, history);
+
+    if (!entry->valid || entry->tag != pc / 4)
+    {
+        return FALSE;
+    }
+    *target = entry->target;
+    return TRUE;
+}
+
+/* Records the target a committed JUMP went to */
+void
+indirect_update(APEX_Indirect *ind, int pc, uint32_t history, int target)
+{
+    Indirect_Entry *entry = indirect_entry(ind, pc, history);
+
+    entry->valid = TRUE;
+    entry->tag = pc / 4;
+    entry->target = target;
+}
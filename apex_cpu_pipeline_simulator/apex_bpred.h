@@ -0,0 +1,95 @@
+/*
+ * apex_bpred.h
+ * Contains the branch direction predictors
+ *
+ * Fetch asks the predictor for the direction of every conditional branch,
+ * the BTB supplies the target. The predictor is trained when the branch
+ * commits, so wrong-path branches never disturb it. Every kind of
+ * predictor (BPRED_* in apex_macros.h) provides a predict and an update
+ * function in bpred_kinds[], see apex_bpred.c.
+ *
+ * Targets of JUMP and JALR come from the return address stack for a JUMP
+ * through the link register of the latest JALR, from the indirect target
+ * predictor for other JUMPs and from the BTB for JALR.
+ */
+#ifndef _APEX_BPRED_H_
+#define _APEX_BPRED_H_
+
+#include <stdint.h>
+
+#include "apex_macros.h"
+
+/* What fetch knew when it predicted a branch, carried to its commit */
+typedef struct BPred_Info
+{
+    uint32_t history;   /* Global history before the branch */
+    uint8_t taken;      /* Predicted direction */
+    uint8_t bimodal;    /* Component predictions, for the tournament chooser */
+    uint8_t gshare;
+    uint8_t source;     /* TARGET_* fetch followed for a JUMP or JALR */
+    uint8_t ras_link;   /* Top RAS entry after the instruction, restored */
+    int16_t ras_top;    /* when it mispredicts */
+    int ras_value;
+} BPred_Info;
+
+typedef struct APEX_BPred
+{
+    int kind;           /* BPRED_* */
+    int size;           /* Entries of each table */
+    uint32_t history_mask;
+    uint32_t history;   /* Speculative global history, youngest outcome in bit 0 */
+    uint8_t *bimodal;   /* [size] 2-bit counters indexed by pc */
+    uint8_t *gshare;    /* [size] 2-bit counters indexed by pc ^ history */
+    uint8_t *chooser;   /* [size] 2-bit counters, 2 and up pick gshare */
+
+    long branches;      /* Conditional branches committed */
+    long correct;       /* ... with the direction predicted right */
+    long bimodal_correct;
+    long gshare_correct;
+    long targets[NUM_TARGETS];      /* JUMP/JALR committed per TARGET_* */
+    long targets_correct[NUM_TARGETS];
+} APEX_BPred;
+
+/* Circular stack of the return addresses of the JALRs in flight */
+typedef struct APEX_RAS
+{
+    int size;
+    int top;            /* Index of the top entry */
+    int *stack;         /* [size] return addresses, in the CPU arena */
+    uint8_t *link;      /* [size] register each JALR linked into, RAS_NO_LINK if none */
+} APEX_RAS;
+
+typedef struct Indirect_Entry
+{
+    int valid;
+    int tag;            /* Word address of the JUMP */
+    int target;
+} Indirect_Entry;
+
+/* Targets of JUMPs indexed by their pc and the global history */
+typedef struct APEX_Indirect
+{
+    int size;
+    Indirect_Entry *entries; /* [size], in the CPU arena */
+} APEX_Indirect;
+
+void bpred_init(APEX_BPred *bp, int kind, int size, int history_bits);
+int bpred_predict(APEX_BPred *bp, int pc, BPred_Info *info);
+void bpred_follow(APEX_BPred *bp, int taken);
+void bpred_update(APEX_BPred *bp, int pc, const BPred_Info *info, int taken);
+uint32_t bpred_history_after(const APEX_BPred *bp, const BPred_Info *info,
+                             int taken);
+void bpred_count_target(APEX_BPred *bp, const BPred_Info *info, int correct);
+const char *bpred_name(int kind);
+const char *bpred_target_name(int source);
+
+void ras_init(APEX_RAS *ras);
+void ras_push(APEX_RAS *ras, int return_pc, int link);
+int ras_pop(APEX_RAS *ras, int link, int *target);
+void ras_save(const APEX_RAS *ras, BPred_Info *info);
+void ras_restore(APEX_RAS *ras, const BPred_Info *info);
+
+void indirect_init(APEX_Indirect *ind);
+int indirect_lookup(const APEX_Indirect *ind, int pc, uint32_t history, int *target);
+void indirect_update(APEX_Indirect *ind, int pc, uint32_t history, int target);
+#endif
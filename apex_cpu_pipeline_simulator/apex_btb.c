@@ -0,0 +1,89 @@
+/*
+ * apex_btb.c
+ * Contains the branch target buffer
+ */
+#include <string.h>
+
+#include "apex_btb.h"
+#include "apex_macros.h"
+
+/* First entry of the set of 'pc', and the tag of 'pc' within it */
+static BTB_Entry *
+btb_set(APEX_BTB *btb, int pc, int *tag)
+{
+    unsigned int word = (unsigned int)pc / 4;
+
+    *tag = word / btb->sets;
+    return &btb->entries[(word % btb->sets) * btb->ways];
+}
+
+/* Clears every entry and counter, the entries must already point into the
+ * CPU arena */
+void
+btb_init(APEX_BTB *btb)
+{
+    memset(btb->entries, 0, (size_t)btb->sets * btb->ways * sizeof(BTB_Entry));
+    btb->stamp = 0;
+    btb->hits = 0;
+    btb->misses = 0;
+    btb->conflicts = 0;
+}
+
+/*
+ * Looks up the branch at 'pc' and on a hit stores its target in '*target'
+ * and marks the entry most recently used.
+ *
+ * Returns TRUE on a hit.
+ */
+int
+btb_lookup(APEX_BTB *btb, int pc, int *target)
+{
+    int tag;
+    BTB_Entry *set = btb_set(btb, pc, &tag);
+
+    for (int way = 0; way < btb->ways; way++)
+    {
+        if (set[way].valid && set[way].tag == tag)
+        {
+            set[way].lru = ++btb->stamp;
+            *target = set[way].target;
+            btb->hits++;
+            return TRUE;
+        }
+    }
+    btb->misses++;
+    return FALSE;
+}
+
+/* Records 'target' for the branch at 'pc', replacing the least recently
+ * used entry of its set if the branch is not in the BTB yet */
+void
+btb_update(APEX_BTB *btb, int pc, int target)
+{
+    int tag;
+    BTB_Entry *set = btb_set(btb, pc, &tag);
+    BTB_Entry *victim = &set[0];
+
+    for (int way = 0; way < btb->ways; way++)
+    {
+        if (set[way].valid && set[way].tag == tag)
+        {
+            victim = &set[way];
+            break;
+        }
+        if (!set[way].valid
+            || (victim->valid && set[way].lru < victim->lru))
+        {
+            victim = &set[way];
+        }
+    }
+
+    if (victim->valid && victim->tag != tag)
+    {
+        btb->conflicts++;
+    }
+    victim->valid = TRUE;
+    victim->tag = tag;
+    victim->target = target;
+    victim->lru = ++btb->stamp;
+}
@@ -0,0 +1,36 @@
+/*
+ * apex_btb.h
+ * Contains the branch target buffer
+ *
+ * A set-associative cache of branch targets, indexed and tagged with the
+ * word address of the branch and replaced LRU within a set. Fetch looks up
+ * every branch it predicts, the BFU inserts the target of every taken
+ * branch.
+ */
+#ifndef _APEX_BTB_H_
+#define _APEX_BTB_H_
+
+typedef struct BTB_Entry
+{
+    int valid;
+    int tag;            /* Word address of the branch divided by the sets */
+    int target;
+    unsigned lru;       /* APEX_BTB.stamp when last used, lowest is evicted */
+} BTB_Entry;
+
+typedef struct APEX_BTB
+{
+    int sets;
+    int ways;
+    BTB_Entry *entries; /* [sets][ways], in the CPU arena */
+    unsigned stamp;
+
+    long hits;
+    long misses;
+    long conflicts;     /* Inserts that evicted another branch */
+} APEX_BTB;
+
+void btb_init(APEX_BTB *btb);
+int btb_lookup(APEX_BTB *btb, int pc, int *target);
+void btb_update(APEX_BTB *btb, int pc, int target);
+#endif
@@ -0,0 +1,318 @@
+/*
+ * apex_btrace.c
+ * Contains the compact binary pipeline event trace, its streaming writer
+ * and its reader
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_btrace.h"
+#include "apex_macros.h"
+
+static const char *const event_names[NUM_EVENTS] = {
+    "fetch", "rename", "dispatch", "issue", "address", "memory",
+    "writeback", "retire", "flush",
+};
+
+const char *
+btrace_event_name(int kind)
+{
+    return (kind >= 0 && kind < NUM_EVENTS) ? event_names[kind] : "unknown";
+}
+
+static uint8_t *
+put_varint(uint8_t *p, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *p++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+/* Zigzag maps small negative deltas to small unsigned values */
+static uint64_t
+zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t
+unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/*
+ * Writes the buffers handed over by btrace_swap until btrace_close sets
+ * 'done' with nothing pending.
+ */
+static void *
+btrace_writer(void *arg)
+{
+    APEX_BTrace *bt = arg;
+
+    pthread_mutex_lock(&bt->lock);
+    for (;;)
+    {
+        uint8_t *buffer;
+        size_t size;
+
+        while (!bt->pending && !bt->done)
+        {
+            pthread_cond_wait(&bt->cond, &bt->lock);
+        }
+        if (!bt->pending)
+        {
+            break;
+        }
+
+        buffer = bt->buffer[!bt->current];
+        size = bt->pending;
+        pthread_mutex_unlock(&bt->lock);
+
+        size_t written = fwrite(buffer, 1, size, bt->fp);
+
+        pthread_mutex_lock(&bt->lock);
+        if (written != size)
+        {
+            bt->error = TRUE;
+        }
+        bt->pending = 0;
+        pthread_cond_broadcast(&bt->cond);
+    }
+    pthread_mutex_unlock(&bt->lock);
+    return NULL;
+}
+
+/* Hands the filled buffer to the writer thread and continues in the other
+ * one, waiting only if the writer is still busy with it */
+static void
+btrace_swap(APEX_BTrace *bt)
+{
+    pthread_mutex_lock(&bt->lock);
+    while (bt->pending)
+    {
+        pthread_cond_wait(&bt->cond, &bt->lock);
+    }
+    bt->pending = bt->fill;
+    bt->current = !bt->current;
+    bt->fill = 0;
+    pthread_cond_broadcast(&bt->cond);
+    pthread_mutex_unlock(&bt->lock);
+}
+
+/*
+ * Creates a binary trace in 'filename' and starts its writer thread.
+ *
+ * Returns NULL if the file, the buffers or the thread cannot be created.
+ */
+APEX_BTrace *
+btrace_open(const char *filename)
+{
+    APEX_BTrace *bt = calloc(1, sizeof(APEX_BTrace));
+    uint8_t version = BTRACE_VERSION;
+
+    if (!bt)
+    {
+        return NULL;
+    }
+
+    bt->fp = fopen(filename, "wb");
+    bt->buffer[0] = malloc(BTRACE_BUFFER_SIZE);
+    bt->buffer[1] = malloc(BTRACE_BUFFER_SIZE);
+    if (!bt->fp || !bt->buffer[0] || !bt->buffer[1])
+    {
+        goto fail;
+    }
+
+    fwrite(BTRACE_MAGIC, 1, strlen(BTRACE_MAGIC), bt->fp);
+    fwrite(&version, 1, 1, bt->fp);
+    bt->last.unit = -1;
+
+    pthread_mutex_init(&bt->lock, NULL);
+    pthread_cond_init(&bt->cond, NULL);
+    if (pthread_create(&bt->thread, NULL, btrace_writer, bt) != 0)
+    {
+        pthread_cond_destroy(&bt->cond);
+        pthread_mutex_destroy(&bt->lock);
+        goto fail;
+    }
+    return bt;
+
+fail:
+    if (bt->fp)
+    {
+        fclose(bt->fp);
+    }
+    free(bt->buffer[0]);
+    free(bt->buffer[1]);
+    free(bt);
+    return NULL;
+}
+
+/* Appends one record, records must come in cycle order */
+void
+btrace_write(APEX_BTrace *bt, const APEX_BTrace_Record *rec)
+{
+    uint8_t *start;
+    uint8_t *p;
+
+    if (bt->fill + BTRACE_MAX_RECORD > BTRACE_BUFFER_SIZE)
+    {
+        btrace_swap(bt);
+    }
+
+    start = p = bt->buffer[bt->current] + bt->fill;
+    *p++ = (uint8_t)(rec->kind | (rec->unit + 1) << 4);
+    p = put_varint(p, (uint64_t)(rec->cycle - bt->last.cycle));
+    p = put_varint(p, zigzag((int64_t)rec->seq - bt->last.seq));
+    p = put_varint(p, zigzag((int64_t)rec->pc - bt->last.pc));
+    p = put_varint(p, (uint32_t)(rec->pd + 1));
+    p = put_varint(p, (uint32_t)(rec->ps1 + 1));
+    p = put_varint(p, (uint32_t)(rec->ps2 + 1));
+    bt->fill += p - start;
+    bt->last = *rec;
+}
+
+/*
+ * Writes out what is buffered, stops the writer thread and releases the
+ * trace.
+ *
+ * Returns 0 on success, -1 if any part of the trace could not be written.
+ */
+int
+btrace_close(APEX_BTrace *bt)
+{
+    int error;
+
+    if (bt->fill > 0)
+    {
+        btrace_swap(bt);
+    }
+
+    pthread_mutex_lock(&bt->lock);
+    bt->done = TRUE;
+    pthread_cond_broadcast(&bt->cond);
+    pthread_mutex_unlock(&bt->lock);
+    pthread_join(bt->thread, NULL);
+
+    error = bt->error;
+    if (fclose(bt->fp) != 0)
+    {
+        error = TRUE;
+    }
+    pthread_cond_destroy(&bt->cond);
+    pthread_mutex_destroy(&bt->lock);
+    free(bt->buffer[0]);
+    free(bt->buffer[1]);
+    free(bt);
+    return error ? -1 : 0;
+}
+
+/*
+ * Opens a binary trace for reading.
+ *
+ * Returns NULL if the file cannot be opened or is not a binary trace of
+ * this version.
+ */
+APEX_BTrace_Reader *
+btrace_reader_open(const char *filename)
+{
+    APEX_BTrace_Reader *reader;
+    char header[sizeof(BTRACE_MAGIC)];
+    FILE *fp = fopen(filename, "rb");
+
+    if (!fp)
+    {
+        return NULL;
+    }
+
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header)
+        || memcmp(header, BTRACE_MAGIC, strlen(BTRACE_MAGIC)) != 0
+        || (uint8_t)header[strlen(BTRACE_MAGIC)] != BTRACE_VERSION)
+    {
+        fclose(fp);
+        return NULL;
+    }
+
+    reader = calloc(1, sizeof(APEX_BTrace_Reader));
+    if (!reader)
+    {
+        fclose(fp);
+        return NULL;
+    }
+    reader->fp = fp;
+    reader->last.unit = -1;
+    return reader;
+}
+
+static int
+get_varint(FILE *fp, uint64_t *value)
+{
+    int shift = 0;
+    int c;
+
+    *value = 0;
+    do
+    {
+        c = getc(fp);
+        if (c == EOF || shift > 63)
+        {
+            return -1;
+        }
+        *value |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return 0;
+}
+
+/*
+ * Reads the next record into 'rec'.
+ *
+ * Returns 1 for a record, 0 at the end of the trace and -1 if the trace is
+ * truncated or corrupt.
+ */
+int
+btrace_read(APEX_BTrace_Reader *reader, APEX_BTrace_Record *rec)
+{
+    uint64_t v[6];
+    int c = getc(reader->fp);
+
+    if (c == EOF)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < 6; i++)
+    {
+        if (get_varint(reader->fp, &v[i]) != 0)
+        {
+            return -1;
+        }
+    }
+
+    rec->kind = c & 0xf;
+    rec->unit = (c >> 4) - 1;
+    rec->cycle = reader->last.cycle + (long)v[0];
+    rec->seq = (int)(reader->last.seq + unzigzag(v[1]));
+    rec->pc = (int)(reader->last.pc + unzigzag(v[2]));
+    rec->pd = (int)v[3] - 1;
+    rec->ps1 = (int)v[4] - 1;
+    rec->ps2 = (int)v[5] - 1;
+    if (rec->kind >= NUM_EVENTS)
+    {
+        return -1;
+    }
+    reader->last = *rec;
+    return 1;
+}
+
+void
+btrace_reader_close(APEX_BTrace_Reader *reader)
+{
+    fclose(reader->fp);
+    free(reader);
+}
@@ -0,0 +1,71 @@
+/*
+ * apex_btrace.h
+ * Contains the compact binary pipeline event trace, its streaming writer
+ * and its reader
+ *
+ * A binary trace holds one record per pipeline event (EVENT_* in
+ * apex_macros.h) of every instruction. Records are a kind byte followed by
+ * varints relative to the previous record, so a typical event takes 5-8
+ * bytes. The simulator fills one buffer while a writer thread writes the
+ * other out, and never formats text.
+ */
+#ifndef _APEX_BTRACE_H_
+#define _APEX_BTRACE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* File header, the magic followed by BTRACE_VERSION as one byte */
+#define BTRACE_MAGIC "APEXBTR"
+#define BTRACE_VERSION 1
+
+/* Size of each of the two writer buffers */
+#define BTRACE_BUFFER_SIZE (1 << 20)
+
+/* Longest encoded record: the kind byte, a 10-byte cycle varint and five
+ * 5-byte varints */
+#define BTRACE_MAX_RECORD 36
+
+typedef struct APEX_BTrace_Record
+{
+    int kind;       /* EVENT_* */
+    int unit;       /* FU_* of an EVENT_ISSUE, -1 otherwise */
+    long cycle;
+    int seq;        /* Fetch order of the instruction */
+    int pc;
+    int pd;         /* Physical tags, -1 for none */
+    int ps1;
+    int ps2;
+} APEX_BTrace_Record;
+
+typedef struct APEX_BTrace
+{
+    FILE *fp;
+    uint8_t *buffer[2];
+    size_t fill;            /* Bytes used in buffer[current] */
+    int current;            /* Buffer the simulator writes to */
+    size_t pending;         /* Bytes of buffer[!current] left to write, 0 when idle */
+    int done;               /* Tells the writer thread to exit */
+    int error;              /* A write failed, the trace is incomplete */
+    APEX_BTrace_Record last; /* Base of the deltas of the next record */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} APEX_BTrace;
+
+typedef struct APEX_BTrace_Reader
+{
+    FILE *fp;
+    APEX_BTrace_Record last;
+} APEX_BTrace_Reader;
+
+APEX_BTrace *btrace_open(const char *filename);
+void btrace_write(APEX_BTrace *bt, const APEX_BTrace_Record *rec);
+int btrace_close(APEX_BTrace *bt);
+
+APEX_BTrace_Reader *btrace_reader_open(const char *filename);
+int btrace_read(APEX_BTrace_Reader *reader, APEX_BTrace_Record *rec);
+void btrace_reader_close(APEX_BTrace_Reader *reader);
+const char *btrace_event_name(int kind);
+#endif
@@ -0,0 +1,114 @@
+/*
+ * apex_cache.c
+ * Contains the cache model
+ */
+#include <string.h>
+
+#include "apex_cache.h"
+#include "apex_macros.h"
+
+static const char *const policy_names[NUM_CACHE_POLICIES] = {
+    "writeback", "writethrough",
+};
+
+/* First line of the set of 'address', and the tag of 'address' within it */
+static Cache_Line *
+cache_set(APEX_Cache *cache, unsigned int address, unsigned *tag)
+{
+    unsigned int line = address / cache->line_size;
+
+    *tag = line / cache->sets;
+    return &cache->lines[(line % cache->sets) * cache->ways];
+}
+
+/* Sets the geometry of a cache of 'size' bytes. The size is rounded down to
+ * whole sets, less than a line leaves the cache off */
+void
+cache_configure(APEX_Cache *cache, int size, int ways, int line_size, int policy)
+{
+    int lines = size / line_size;
+
+    cache->line_size = line_size;
+    cache->ways = ways < lines ? ways : lines;
+    cache->sets = cache->ways > 0 ? lines / cache->ways : 0;
+    cache->policy = policy;
+}
+
+/* Clears every line and counter, the lines must already point into the CPU
+ * arena */
+void
+cache_init(APEX_Cache *cache)
+{
+    memset(cache->lines, 0, (size_t)cache->sets * cache->ways * sizeof(Cache_Line));
+    cache->stamp = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
+    cache->writebacks = 0;
+}
+
+/*
+ * Looks up the line of 'address' and on a hit marks it most recently used.
+ * A write dirties the line in a write-back cache. A miss changes nothing,
+ * the caller fills the line with cache_fill() once it has arrived.
+ *
+ * Returns TRUE on a hit.
+ */
+int
+cache_lookup(APEX_Cache *cache, unsigned int address, int write)
+{
+    unsigned tag;
+    Cache_Line *set = cache_set(cache, address, &tag);
+
+    for (int way = 0; way < cache->ways; way++)
+    {
+        if (set[way].valid && set[way].tag == tag)
+        {
+            set[way].lru = ++cache->stamp;
+            set[way].dirty |= write && cache->policy == CACHE_WRITE_BACK;
+            cache->hits++;
+            return TRUE;
+        }
+    }
+    cache->misses++;
+    return FALSE;
+}
+
+/* Puts the line of 'address' in the least recently used way of its set,
+ * 'dirty' when a write-back cache allocates it for a write */
+void
+cache_fill(APEX_Cache *cache, unsigned int address, int dirty)
+{
+    unsigned tag;
+    Cache_Line *set = cache_set(cache, address, &tag);
+    Cache_Line *victim = &set[0];
+
+    for (int way = 0; way < cache->ways; way++)
+    {
+        if (!set[way].valid
+            || (victim->valid && set[way].lru < victim->lru))
+        {
+            victim = &set[way];
+        }
+    }
+
+    if (victim->valid)
+    {
+        cache->evictions++;
+        if (victim->dirty)
+        {
+            cache->writebacks++;
+        }
+    }
+    victim->valid = TRUE;
+    victim->dirty = dirty;
+    victim->tag = tag;
+    victim->lru = ++cache->stamp;
+}
+
+/* Name of write policy CACHE_WRITE_*, as given to --dcache-policy */
+const char *
+cache_policy_name(int policy)
+{
+    return policy_names[policy];
+}
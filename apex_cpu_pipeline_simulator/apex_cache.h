@@ -0,0 +1,43 @@
+/*
+ * apex_cache.h
+ * Contains the cache model
+ *
+ * A set-associative cache of line tags, indexed and tagged with the line
+ * address and replaced LRU within a set. Only hits and misses are modelled,
+ * the data itself stays in code and data memory. The CPU turns the outcome
+ * of every access into a latency, see icache_ready() and mau_latency() in
+ * apex_cpu.c.
+ */
+#ifndef _APEX_CACHE_H_
+#define _APEX_CACHE_H_
+
+typedef struct Cache_Line
+{
+    int valid;
+    int dirty;          /* Written since the fill, write-back only */
+    unsigned tag;       /* Line address divided by the sets */
+    unsigned lru;       /* APEX_Cache.stamp when last used, lowest is evicted */
+} Cache_Line;
+
+typedef struct APEX_Cache
+{
+    int sets;           /* 0 when the cache is off */
+    int ways;
+    int line_size;      /* Bytes */
+    int policy;         /* CACHE_WRITE_* */
+    Cache_Line *lines;  /* [sets][ways], in the CPU arena */
+    unsigned stamp;
+
+    long hits;
+    long misses;
+    long evictions;     /* Fills that replaced a valid line */
+    long writebacks;    /* ... a dirty one */
+} APEX_Cache;
+
+void cache_configure(APEX_Cache *cache, int size, int ways, int line_size,
+                     int policy);
+void cache_init(APEX_Cache *cache);
+int cache_lookup(APEX_Cache *cache, unsigned int address, int write);
+void cache_fill(APEX_Cache *cache, unsigned int address, int dirty);
+const char *cache_policy_name(int policy);
+#endif
@@ -0,0 +1,267 @@
+/*
+ * apex_checkpoint.c
+ * Contains the binary checkpoint (save/restore) of the APEX CPU state
+ *
+ * Image layout, every section starts at a CHECKPOINT_ALIGN aligned offset:
+ *
+ *   Checkpoint_Header
+ *   APEX_CPU             pointers and output settings cleared
+ *   arena                cpu->arena, the configuration-sized structures
+ *   APEX_Instruction[]   cpu->code_memory
+ *
+ * The APEX_CPU section is a raw copy of the structure, so an image is only
+ * valid for the build that wrote it. The header records the format version
+ * and the structure sizes and restore rejects images that do not match.
+ * The machine configuration is part of the APEX_CPU section, the restored
+ * CPU keeps the configuration it was saved with.
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "apex_checkpoint.h"
+
+#define CHECKPOINT_MAGIC "APEXCKPT"
+#define CHECKPOINT_ALIGN 64
+
+typedef struct Checkpoint_Header
+{
+    char magic[8];          /* CHECKPOINT_MAGIC, not NUL terminated */
+    uint32_t version;       /* CHECKPOINT_VERSION */
+    uint32_t cpu_size;      /* sizeof(APEX_CPU) of the writer */
+    uint32_t code_memory_size;
+    uint32_t insn_size;
+    uint64_t arena_size;    /* cpu->arena_size of the writer */
+    uint64_t cpu_offset;
+    uint64_t arena_offset;
+    uint64_t code_offset;
+    uint64_t image_size;
+} Checkpoint_Header;
+
+static uint64_t
+align_up(uint64_t offset)
+{
+    return (offset + CHECKPOINT_ALIGN - 1) & ~(uint64_t)(CHECKPOINT_ALIGN - 1);
+}
+
+static void
+fill_header(Checkpoint_Header *header, int code_memory_size, uint64_t arena_size)
+{
+    memset(header, 0, sizeof(Checkpoint_Header));
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+    header->version = CHECKPOINT_VERSION;
+    header->cpu_size = sizeof(APEX_CPU);
+    header->code_memory_size = code_memory_size;
+    header->insn_size = sizeof(APEX_Instruction);
+    header->arena_size = arena_size;
+
+    header->cpu_offset = align_up(sizeof(Checkpoint_Header));
+    header->arena_offset = align_up(header->cpu_offset + sizeof(APEX_CPU));
+    header->code_offset = align_up(header->arena_offset + arena_size);
+    header->image_size = header->code_offset
+                         + (uint64_t)code_memory_size * sizeof(APEX_Instruction);
+}
+
+static int
+write_section(FILE *fp, uint64_t offset, const void *data, size_t size)
+{
+    return fseek(fp, (long)offset, SEEK_SET) == 0
+           && fwrite(data, 1, size, fp) == size;
+}
+
+/*
+ * Writes the complete state of 'cpu' to 'filename'. The image is written to
+ * a temporary file first and renamed into place, so an interrupted save
+ * never leaves a truncated checkpoint behind.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+APEX_checkpoint_save(const APEX_CPU *cpu, const char *filename)
+{
+    Checkpoint_Header header;
+    APEX_CPU *image;
+    char tmp_name[1024];
+    FILE *fp;
+    int ok;
+
+    if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", filename) >= (int)sizeof(tmp_name))
+    {
+        return -1;
+    }
+
+    /* Host pointers and output settings are meaningless in another process */
+    image = malloc(sizeof(APEX_CPU));
+    if (!image)
+    {
+        return -1;
+    }
+    memcpy(image, cpu, sizeof(APEX_CPU));
+    memset(&image->trace, 0, sizeof(APEX_Trace));
+    memset(&image->kanata, 0, sizeof(APEX_Kanata));
+    image->btrace = NULL;
+    image->code_memory = NULL;
+    image->code_map = NULL;
+    image->code_map_size = 0;
+    image->arena = NULL;
+    APEX_cpu_layout(image, NULL);
+    image->checkpoint_file = NULL;
+
+    fp = fopen(tmp_name, "wb");
+    if (!fp)
+    {
+        free(image);
+        return -1;
+    }
+
+    fill_header(&header, cpu->code_memory_size, cpu->arena_size);
+    ok = write_section(fp, 0, &header, sizeof(header))
+         && write_section(fp, header.cpu_offset, image, sizeof(APEX_CPU))
+         && write_section(fp, header.arena_offset, cpu->arena, cpu->arena_size)
+         && write_section(fp, header.code_offset, cpu->code_memory,
+                          cpu->code_memory_size * sizeof(APEX_Instruction));
+    ok = (fclose(fp) == 0) && ok;
+    free(image);
+
+    if (!ok || rename(tmp_name, filename) != 0)
+    {
+        remove(tmp_name);
+        return -1;
+    }
+    return 0;
+}
+
+/* Returns TRUE if 'filename' starts with the checkpoint magic */
+int
+APEX_checkpoint_probe(const char *filename)
+{
+    char magic[8];
+    FILE *fp;
+    int found;
+
+    fp = fopen(filename, "rb");
+    if (!fp)
+    {
+        return FALSE;
+    }
+    found = fread(magic, 1, sizeof(magic), fp) == sizeof(magic)
+            && memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0;
+    fclose(fp);
+    return found;
+}
+
+/* Checks that a mapped image was written by this build and is complete */
+static int
+validate_header(const Checkpoint_Header *header, uint64_t file_size)
+{
+    Checkpoint_Header expected;
+
+    if (file_size < sizeof(Checkpoint_Header)
+        || memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0)
+    {
+        return FALSE;
+    }
+
+    fill_header(&expected, header->code_memory_size, header->arena_size);
+    return memcmp(header, &expected, sizeof(Checkpoint_Header)) == 0
+           && header->image_size <= file_size;
+}
+
+/*
+ * Creates a CPU from the checkpoint image 'filename'. The image is mapped
+ * read-only and copied section by section into freshly allocated state.
+ *
+ * The restored CPU starts with the same defaults as APEX_cpu_init: output to
+ * stdout at APEX_VERBOSITY_STAGE, single step enabled, no cycle limit and no
+ * pending checkpoint. Its cycle and instruction counts continue from the
+ * saved ones.
+ *
+ * Returns NULL if the image cannot be read or does not match this build.
+ */
+APEX_CPU *
+APEX_checkpoint_restore(const char *filename)
+{
+    const Checkpoint_Header *header;
+    const char *base;
+    APEX_CPU *cpu = NULL;
+    struct stat st;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Checkpoint_Header))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    header = (const Checkpoint_Header *)base;
+    if (!validate_header(header, st.st_size))
+    {
+        fprintf(stderr, "APEX_Error: %s: checkpoint is corrupt or was written "
+                        "by a different simulator build\n", filename);
+        goto out;
+    }
+
+    cpu = malloc(sizeof(APEX_CPU));
+    if (!cpu)
+    {
+        goto out;
+    }
+    memcpy(cpu, base + header->cpu_offset, sizeof(APEX_CPU));
+
+    /* The arena must be the one the saved configuration lays out */
+    APEX_cpu_layout(cpu, NULL);
+    if (cpu->arena_size != header->arena_size)
+    {
+        fprintf(stderr, "APEX_Error: %s: checkpoint is corrupt\n", filename);
+        free(cpu);
+        cpu = NULL;
+        goto out;
+    }
+
+    cpu->arena = aligned_alloc(64, cpu->arena_size);
+    cpu->code_memory = malloc(header->code_memory_size * sizeof(APEX_Instruction));
+    if (!cpu->arena || !cpu->code_memory)
+    {
+        free(cpu->arena);
+        free(cpu->code_memory);
+        free(cpu);
+        cpu = NULL;
+        goto out;
+    }
+    memcpy(cpu->arena, base + header->arena_offset, cpu->arena_size);
+    APEX_cpu_layout(cpu, cpu->arena);
+    memcpy(cpu->code_memory, base + header->code_offset,
+           header->code_memory_size * sizeof(APEX_Instruction));
+
+    cpu->trace.fp = stdout;
+    memset(&cpu->kanata, 0, sizeof(APEX_Kanata));
+    cpu->btrace = NULL;
+    cpu->trace.level = APEX_VERBOSITY_STAGE;
+    cpu->single_step = ENABLE_SINGLE_STEP;
+    cpu->event_driven = FALSE;
+    cpu->simulator_flag = 0;
+    cpu->simulate_counter = 0;
+    cpu->counter = 0;
+    cpu->checkpoint_cycle = -1;
+
+out:
+    munmap((void *)base, st.st_size);
+    return cpu;
+}
@@ -0,0 +1,18 @@
+/*
+ * apex_checkpoint.h
+ * Contains the binary checkpoint (save/restore) declarations
+ *
+ * A checkpoint image holds the complete APEX_CPU state: pipeline latches,
+ * IQ, BQ, ROB, rename table, physical registers, BTB and data memory, plus
+ * the LSQ entries and code memory it points to. Restoring an image gives a
+ * CPU that continues exactly where the saved one stopped.
+ */
+#ifndef _APEX_CHECKPOINT_H_
+#define _APEX_CHECKPOINT_H_
+
+#include "apex_cpu.h"
+
+int APEX_checkpoint_save(const APEX_CPU *cpu, const char *filename);
+int APEX_checkpoint_probe(const char *filename);
+APEX_CPU *APEX_checkpoint_restore(const char *filename);
+#endif
@@ -0,0 +1,215 @@
+/*
+ * apex_config.c
+ * Contains the machine configuration parser
+ */
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_config.h"
+#include "apex_macros.h"
+
+typedef struct Config_Key
+{
+    const char *name;
+    size_t offset;    /* Field of APEX_Config */
+    int min;
+    int max;
+    const char *const *names; /* Names of the values min to max, NULL if numeric */
+} Config_Key;
+
+static const char *const bpred_names[] = {"bimodal", "gshare", "tournament"};
+static const char *const cache_policy_names[] = {"writeback", "writethrough"};
+
+/* Rename needs two free registers for LOADP, anything less deadlocks */
+static const Config_Key config_keys[] = {
+    {"iq-size", offsetof(APEX_Config, iq_size), 1, MAX_QUEUE_SIZE, NULL},
+    {"bq-size", offsetof(APEX_Config, bq_size), 1, MAX_QUEUE_SIZE, NULL},
+    {"rob-size", offsetof(APEX_Config, rob_size), 1, MAX_QUEUE_SIZE, NULL},
+    {"lsq-size", offsetof(APEX_Config, lsq_size), 1, MAX_QUEUE_SIZE, NULL},
+    {"prf-size", offsetof(APEX_Config, rename_regs), 2, MAX_QUEUE_SIZE, NULL},
+    {"btb-size", offsetof(APEX_Config, btb_size), 1, MAX_QUEUE_SIZE, NULL},
+    {"btb-ways", offsetof(APEX_Config, btb_ways), 1, MAX_QUEUE_SIZE, NULL},
+    {"width", offsetof(APEX_Config, width), 1, MAX_WIDTH, NULL},
+    {"mul-latency", offsetof(APEX_Config, mul_latency), 1, MAX_LATENCY, NULL},
+    {"bpred", offsetof(APEX_Config, bpred), 0, NUM_BPRED - 1, bpred_names},
+    {"bpred-size", offsetof(APEX_Config, bpred_size), 1, 1 << 20, NULL},
+    {"bpred-history", offsetof(APEX_Config, bpred_history), 0, MAX_BPRED_HISTORY,
+     NULL},
+    {"ras-size", offsetof(APEX_Config, ras_size), 1, MAX_QUEUE_SIZE, NULL},
+    {"indirect-size", offsetof(APEX_Config, indirect_size), 1, MAX_QUEUE_SIZE, NULL},
+    {"branch-checkpoints", offsetof(APEX_Config, branch_checkpoints), 1, MAX_QUEUE_SIZE,
+     NULL},
+    {"icache-size", offsetof(APEX_Config, icache_size), 0, 1 << 20, NULL},
+    {"icache-ways", offsetof(APEX_Config, icache_ways), 1, MAX_QUEUE_SIZE, NULL},
+    {"icache-line", offsetof(APEX_Config, icache_line), 4, MAX_QUEUE_SIZE, NULL},
+    {"icache-miss-latency", offsetof(APEX_Config, icache_miss_latency), 0,
+     MAX_MEMORY_LATENCY, NULL},
+    {"dcache-size", offsetof(APEX_Config, dcache_size), 0, 1 << 20, NULL},
+    {"dcache-ways", offsetof(APEX_Config, dcache_ways), 1, MAX_QUEUE_SIZE, NULL},
+    {"dcache-line", offsetof(APEX_Config, dcache_line), 4, MAX_QUEUE_SIZE, NULL},
+    {"dcache-hit-latency", offsetof(APEX_Config, dcache_hit_latency), 1, MAX_LATENCY,
+     NULL},
+    {"dcache-miss-latency", offsetof(APEX_Config, dcache_miss_latency), 0,
+     MAX_MEMORY_LATENCY, NULL},
+    {"dcache-policy", offsetof(APEX_Config, dcache_policy), 0, NUM_CACHE_POLICIES - 1,
+     cache_policy_names},
+};
+
+void
+config_init(APEX_Config *config)
+{
+    config->iq_size = DEFAULT_IQ_SIZE;
+    config->bq_size = DEFAULT_BQ_SIZE;
+    config->rob_size = DEFAULT_ROB_SIZE;
+    config->lsq_size = DEFAULT_LSQ_SIZE;
+    config->rename_regs = DEFAULT_RENAME_REGS;
+    config->btb_size = DEFAULT_BTB_SIZE;
+    config->btb_ways = DEFAULT_BTB_WAYS;
+    config->width = DEFAULT_WIDTH;
+    config->mul_latency = DEFAULT_MUL_LATENCY;
+    config->bpred = DEFAULT_BPRED;
+    config->bpred_size = DEFAULT_BPRED_SIZE;
+    config->bpred_history = DEFAULT_BPRED_HISTORY;
+    config->ras_size = DEFAULT_RAS_SIZE;
+    config->indirect_size = DEFAULT_INDIRECT_SIZE;
+    config->branch_checkpoints = DEFAULT_BRANCH_CHECKPOINTS;
+    config->icache_size = DEFAULT_ICACHE_SIZE;
+    config->icache_ways = DEFAULT_ICACHE_WAYS;
+    config->icache_line = DEFAULT_ICACHE_LINE;
+    config->icache_miss_latency = DEFAULT_ICACHE_MISS_LATENCY;
+    config->dcache_size = DEFAULT_DCACHE_SIZE;
+    config->dcache_ways = DEFAULT_DCACHE_WAYS;
+    config->dcache_line = DEFAULT_DCACHE_LINE;
+    config->dcache_hit_latency = DEFAULT_DCACHE_HIT_LATENCY;
+    config->dcache_miss_latency = DEFAULT_DCACHE_MISS_LATENCY;
+    config->dcache_policy = DEFAULT_DCACHE_POLICY;
+}
+
+/*
+ * Parses 'text' as a decimal number from 'min' to 'max' into 'value'. The
+ * whole of 'text' must be the number, "16x" and "1e6" are refused.
+ *
+ * Returns 0 on success, -1 if 'text' is not a number or is out of range.
+ */
+int
+config_parse_number(const char *text, long min, long max, long *value)
+{
+    char *end;
+    long number;
+
+    errno = 0;
+    number = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || number < min || number > max)
+    {
+        return -1;
+    }
+    *value = number;
+    return 0;
+}
+
+/*
+ * Parses the value of a setting, by name for the keys that have names and
+ * as a decimal number for the others.
+ *
+ * Returns the value, or key->min - 1 when 'text' is not a valid value.
+ */
+static int
+parse_value(const Config_Key *key, const char *text)
+{
+    long value;
+
+    if (key->names)
+    {
+        for (int value = key->min; value <= key->max; value++)
+        {
+            if (strcmp(text, key->names[value - key->min]) == 0)
+            {
+                return value;
+            }
+        }
+        return key->min - 1;
+    }
+
+    if (config_parse_number(text, key->min, key->max, &value) != 0)
+    {
+        return key->min - 1;
+    }
+    return (int)value;
+}
+
+/*
+ * Parses a single "name=value" setting, e.g. "iq-size=64", into 'config'.
+ *
+ * Returns 1 if the setting was recognized, 0 if it is not a configuration
+ * setting and -1 if its value is not a number or is out of range.
+ */
+int
+config_parse(APEX_Config *config, const char *arg)
+{
+    for (size_t i = 0; i < sizeof(config_keys) / sizeof(config_keys[0]); i++)
+    {
+        const Config_Key *key = &config_keys[i];
+        size_t len = strlen(key->name);
+        int value;
+
+        if (strncmp(arg, key->name, len) != 0 || arg[len] != '=')
+        {
+            continue;
+        }
+
+        value = parse_value(key, arg + len + 1);
+        if (value < key->min || value > key->max)
+        {
+            return -1;
+        }
+        *(int *)((char *)config + key->offset) = value;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Reads one setting per line from 'filename'. Blank lines and lines
+ * starting with '#' are skipped.
+ *
+ * Returns 0 on success, -1 if the file cannot be read or has a bad line.
+ */
+int
+config_load(APEX_Config *config, const char *filename)
+{
+    char line[256];
+    int line_no = 0;
+    FILE *fp;
+
+    fp = fopen(filename, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to read config file %s\n", filename);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *setting = line + strspn(line, " \t");
+
+        line_no++;
+        setting[strcspn(setting, " \t\r\n")] = '\0';
+        if (setting[0] == '\0' || setting[0] == '#')
+        {
+            continue;
+        }
+        if (config_parse(config, setting) != 1)
+        {
+            fprintf(stderr, "APEX_Error: %s:%d: invalid setting %s\n", filename,
+                    line_no, setting);
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * apex_config.h
+ * Contains the machine configuration, the size of every pipeline structure
+ * and the width and latencies of the pipeline
+ *
+ * A configuration is fixed when the CPU is created, see APEX_cpu_init. It is
+ * given on the command line ("--iq-size=64") or in a file of "iq-size=64"
+ * lines loaded with "--config=<file>". Settings that pick one of several
+ * kinds take its name, "bpred=gshare".
+ */
+#ifndef _APEX_CONFIG_H_
+#define _APEX_CONFIG_H_
+
+typedef struct APEX_Config
+{
+    int iq_size;      /* Issue queue entries */
+    int bq_size;      /* Branch queue entries */
+    int rob_size;     /* Reorder buffer entries */
+    int lsq_size;     /* Load/store queue entries */
+    int rename_regs;  /* Physical registers besides the architectural ones */
+    int btb_size;     /* Branch target buffer entries */
+    int btb_ways;     /* ... per set */
+    int width;        /* Instructions fetched, decoded, dispatched and
+                         committed per cycle */
+    int mul_latency;  /* Stages of the pipelined multiplier */
+    int bpred;        /* Branch direction predictor, BPRED_* */
+    int bpred_size;   /* Entries of each predictor table */
+    int bpred_history; /* Bits of global branch history */
+    int ras_size;     /* Return address stack entries */
+    int indirect_size; /* Indirect target predictor entries */
+    int branch_checkpoints; /* Rename checkpoints, one per unresolved branch */
+    int icache_size;  /* Instruction cache bytes, 0 for none */
+    int icache_ways;  /* ... lines per set */
+    int icache_line;  /* ... bytes per line, fetch groups stay within one */
+    int icache_miss_latency; /* Cycles fetch waits for a fill */
+    int dcache_size;  /* L1 data cache bytes, 0 for none */
+    int dcache_ways;  /* ... lines per set */
+    int dcache_line;  /* ... bytes per line */
+    int dcache_hit_latency; /* MAU cycles of an L1D hit */
+    int dcache_miss_latency; /* Cycles a miss adds to fill the line */
+    int dcache_policy; /* CACHE_WRITE_* */
+} APEX_Config;
+
+void config_init(APEX_Config *config);
+int config_parse(APEX_Config *config, const char *arg);
+int config_parse_number(const char *text, long min, long max, long *value);
+int config_load(APEX_Config *config, const char *filename);
+#endif
@@ -9,7 +9,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
+#include "apex_checkpoint.h"
 #include "apex_cpu.h"
 #include "apex_macros.h"
 
@@ -23,10 +25,82 @@ get_code_memory_index_from_pc(const int pc)
     return (pc - 4000) / 4;
 }
 
+/* Operands of a latch that has never held an instruction */
+static const APEX_Instruction empty_insn;
 
+/* Returns the decoded instruction held by a pipeline latch */
+static inline const APEX_Instruction *
+stage_insn(const APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    return stage->insn_index < 0 ? &empty_insn : &cpu->code_memory[stage->insn_index];
+}
+
+/* Copies the issued IQ entry into a latch headed for a function unit */
+static void
+latch_iq_entry(CPU_Stage *stage, const IQ_Entries *entry)
+{
+    stage->op.opcode = entry->opcode;
+    stage->op.literal = entry->literal;
+    stage->op.src1_tag = entry->src1_tag;
+    stage->op.src1_value = entry->src1_value;
+    stage->op.src2_tag = entry->src2_tag;
+    stage->op.src2_value = entry->src2_value;
+    stage->op.dest = entry->dest;
+    stage->op.pc_address = entry->pc_address;
+    stage->op.rob_index = entry->rob_index;
+    stage->op.lsq_index = entry->lsq_index;
+    stage->op.base_dest = entry->base_dest;
+
+    stage->has_insn = TRUE;
+    stage->pc = entry->pc_address;
+    stage->insn_index = get_code_memory_index_from_pc(entry->pc_address);
+    stage->opcode = entry->opcode;
+    stage->pd = entry->dest;
+    stage->ps1 = entry->src1_tag;
+    stage->ps2 = entry->src2_tag;
+}
+
+/* Copies the issued BQ entry into a latch headed for the BFU */
+static void
+latch_bq_entry(CPU_Stage *stage, const BQ_Entry *entry)
+{
+    stage->op.opcode = entry->opcode;
+    stage->op.literal = entry->literal;
+    stage->op.src1_tag = entry->src1_tag;
+    stage->op.src1_value = entry->src1_value;
+    stage->op.src2_tag = entry->src2_tag;
+    stage->op.src2_value = entry->src2_value;
+    stage->op.dest = entry->dest;
+    stage->op.pc_address = entry->pc_address;
+    stage->op.rob_index = entry->rob_index;
+    stage->op.lsq_index = -1;
+    stage->op.base_dest = -1;
+
+    stage->has_insn = TRUE;
+    stage->pc = entry->pc_address;
+    stage->insn_index = get_code_memory_index_from_pc(entry->pc_address);
+    stage->opcode = entry->opcode;
+    stage->pd = entry->dest;
+    stage->ps1 = entry->src1_tag;
+    stage->ps2 = -1;
+    stage->is_btb_hit = entry->branch_prediction;
+    stage->predicted_pc = entry->target_address;
+    stage->checkpoint = entry->checkpoint;
+}
+
+
+/*
+ * Writes the assembly of the instruction in 'stage' to 'buf', an empty
+ * string for opcodes without a format.
+ */
 static void
-print_instruction(const CPU_Stage *stage)
+format_instruction(const APEX_CPU *cpu, const CPU_Stage *stage, char *buf,
+                   size_t size)
 {
+    const APEX_Instruction *ins = stage_insn(cpu, stage);
+    const char *opcode_str = get_opcode_str(stage->opcode);
+
+    buf[0] = '\0';
     switch (stage->opcode)
     {
         case OPCODE_ADD:
@@ -37,36 +111,36 @@ print_instruction(const CPU_Stage *stage)
         case OPCODE_OR:
         case OPCODE_XOR:
         {
-            printf("%s,R%d,R%d,R%d ", stage->opcode_str, stage->rd, stage->rs1,
-                   stage->rs2);
+            snprintf(buf, size, "%s,R%d,R%d,R%d ", opcode_str, ins->rd, ins->rs1,
+                   ins->rs2);
             break;
         }
 
         case OPCODE_MOVC:
         {
-            printf("%s,R%d,#%d ", stage->opcode_str, stage->rd, stage->imm);
+            snprintf(buf, size, "%s,R%d,#%d ", opcode_str, ins->rd, ins->imm);
             break;
         }
 
         case OPCODE_LOAD:
         case OPCODE_LOADP:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rd, stage->rs1,
-                   stage->imm);
+            snprintf(buf, size, "%s,R%d,R%d,#%d ", opcode_str, ins->rd, ins->rs1,
+                   ins->imm);
             break;
         }
 
         case OPCODE_STORE:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rs1, stage->rs2,
-                   stage->imm);
+            snprintf(buf, size, "%s,R%d,R%d,#%d ", opcode_str, ins->rs1, ins->rs2,
+                   ins->imm);
             break;
         }
 
         case OPCODE_STOREP:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rs1, stage->rs2,
-                   stage->imm);
+            snprintf(buf, size, "%s,R%d,R%d,#%d ", opcode_str, ins->rs1, ins->rs2,
+                   ins->imm);
             break;
         }
 
@@ -77,14 +151,14 @@ print_instruction(const CPU_Stage *stage)
         case OPCODE_BN:
         case OPCODE_BNN:
         {
-            printf("%s,#%d ", stage->opcode_str, stage->imm);
+            snprintf(buf, size, "%s,#%d ", opcode_str, ins->imm);
             break;
         }
 
         case OPCODE_HALT:
         case OPCODE_NOP:
         {
-            printf("%s", stage->opcode_str);
+            snprintf(buf, size, "%s", opcode_str);
             break;
         }
 
@@ -92,41 +166,54 @@ print_instruction(const CPU_Stage *stage)
         case OPCODE_SUBL:
         case OPCODE_JALR:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rd, stage->rs1,
-                   stage->imm);
+            snprintf(buf, size, "%s,R%d,R%d,#%d ", opcode_str, ins->rd, ins->rs1,
+                   ins->imm);
             break;
         }
 
         case OPCODE_CMP:
         {
-            printf("%s,R%d,R%d", stage->opcode_str, stage->rs1, stage->rs2);
+            snprintf(buf, size, "%s,R%d,R%d", opcode_str, ins->rs1, ins->rs2);
             break;
         }
 
         case OPCODE_CML:
         case OPCODE_JUMP:
         {
-            printf("%s,R%d,#%d ", stage->opcode_str, stage->rs1, stage->imm);
+            snprintf(buf, size, "%s,R%d,#%d ", opcode_str, ins->rs1, ins->imm);
             break;
         }
     }
 }
 
+static void
+print_instruction(APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    char buf[INSN_TEXT_SIZE];
+
+    format_instruction(cpu, stage, buf, sizeof(buf));
+    trace_printf(&cpu->trace, "%s", buf);
+}
+
 /* Debug function which prints the CPU stage content
  *
  * Note: You can edit this function to print in more detail
  */
 static void
-print_stage_content(const char *name, const CPU_Stage *stage)
+print_stage_content(APEX_CPU *cpu, const char *name, const CPU_Stage *stage)
 {
-    printf("%-15s: pc(%d) ", name, stage->pc);
-    print_instruction(stage);
-    printf("\n");
+    trace_printf(&cpu->trace, "%-15s: pc(%d) ", name, stage->pc);
+    print_instruction(cpu, stage);
+    trace_printf(&cpu->trace, "\n");
 }
 
 static void
-print_renamed_instruction(const CPU_Stage *stage)
+print_renamed_instruction(APEX_CPU *cpu, const CPU_Stage *stage)
 {
+    APEX_Trace *trace = &cpu->trace;
+    const APEX_Instruction *ins = stage_insn(cpu, stage);
+    const char *opcode_str = get_opcode_str(stage->opcode);
+
     switch (stage->opcode)
     {
         case OPCODE_ADD:
@@ -137,36 +224,36 @@ print_renamed_instruction(const CPU_Stage *stage)
         case OPCODE_OR:
         case OPCODE_XOR:
         {
-            printf("%s,P%d,P%d,P%d ", stage->opcode_str, stage->pd, stage->ps1,
+            trace_printf(trace, "%s,P%d,P%d,P%d ", opcode_str, stage->pd, stage->ps1,
                    stage->ps2);
             break;
         }
 
         case OPCODE_MOVC:
         {
-            printf("%s,P%d,#%d ", stage->opcode_str, stage->pd, stage->imm);
+            trace_printf(trace, "%s,P%d,#%d ", opcode_str, stage->pd, ins->imm);
             break;
         }
 
         case OPCODE_LOAD:
         case OPCODE_LOADP:
         {
-            printf("%s,P%d,P%d,#%d ", stage->opcode_str, stage->pd, stage->ps1,
-                   stage->imm);
+            trace_printf(trace, "%s,P%d,P%d,#%d ", opcode_str, stage->pd, stage->ps1,
+                   ins->imm);
             break;
         }
 
         case OPCODE_STORE:
         {
-            printf("%s,P%d,P%d,#%d ", stage->opcode_str, stage->ps1, stage->ps2,
-                   stage->imm);
+            trace_printf(trace, "%s,P%d,P%d,#%d ", opcode_str, stage->ps1, stage->ps2,
+                   ins->imm);
             break;
         }
 
         case OPCODE_STOREP:
         {
-            printf("%s,P%d,P%d,#%d ", stage->opcode_str, stage->ps1, stage->ps2,
-                   stage->imm);
+            trace_printf(trace, "%s,P%d,P%d,#%d ", opcode_str, stage->ps1, stage->ps2,
+                   ins->imm);
             break;
         }
 
@@ -177,14 +264,14 @@ print_renamed_instruction(const CPU_Stage *stage)
         case OPCODE_BN:
         case OPCODE_BNN:
         {
-            printf("%s,#%d ", stage->opcode_str, stage->imm);
+            trace_printf(trace, "%s,#%d ", opcode_str, ins->imm);
             break;
         }
 
         case OPCODE_HALT:
         case OPCODE_NOP:
         {
-            printf("%s", stage->opcode_str);
+            trace_printf(trace, "%s", opcode_str);
             break;
         }
 
@@ -192,90 +279,224 @@ print_renamed_instruction(const CPU_Stage *stage)
         case OPCODE_SUBL:
         case OPCODE_JALR:
         {
-            printf("%s,P%d,P%d,#%d ", stage->opcode_str, stage->pd, stage->ps1,
-                   stage->imm);
+            trace_printf(trace, "%s,P%d,P%d,#%d ", opcode_str, stage->pd, stage->ps1,
+                   ins->imm);
             break;
         }
 
         case OPCODE_CMP:
         {
-            printf("%s,P%d,P%d", stage->opcode_str, stage->ps1, stage->ps2);
+            trace_printf(trace, "%s,P%d,P%d", opcode_str, stage->ps1, stage->ps2);
             break;
         }
 
         case OPCODE_CML:
         case OPCODE_JUMP:
         {
-            printf("%s,P%d,#%d ", stage->opcode_str, stage->ps1, stage->imm);
+            trace_printf(trace, "%s,P%d,#%d ", opcode_str, stage->ps1, ins->imm);
             break;
         }
     }
 }
 
 static void
-display_stage_content(const char *name, const CPU_Stage *stage)
+display_stage_content(APEX_CPU *cpu, const char *name, const CPU_Stage *stage)
 {
-    printf("%-15s: pc(%d) ", name, stage->pc);
-    print_renamed_instruction(stage);
-    printf("\n");
+    trace_printf(&cpu->trace, "%-15s: pc(%d) ", name, stage->pc);
+    print_renamed_instruction(cpu, stage);
+    trace_printf(&cpu->trace, "\n");
 }
 
 /* Debug function which prints the register file
  *
  * Note: You are not supposed to edit this function
  */
-static void
-print_reg_file(const APEX_CPU *cpu)
+void
+print_reg_file(APEX_CPU *cpu)
 {
+    APEX_Trace *trace = &cpu->trace;
     int i;
 
-    printf("----------\n%s\n----------\n", "Registers:");
+    trace_printf(trace, "----------\n%s\n----------\n", "Registers:");
 
     for (int i = 0; i < REG_FILE_SIZE / 2; ++i)
     {
-        printf("R%-3d[%-3d] ", i, cpu->regs[i]);
+        trace_printf(trace, "R%-3d[%-3d] ", i, cpu->regs[i]);
     }
 
-    printf("\n");
+    trace_printf(trace, "\n");
 
     for (i = (REG_FILE_SIZE / 2); i < REG_FILE_SIZE; ++i)
     {
-        printf("R%-3d[%-3d] ", i, cpu->regs[i]);
+        trace_printf(trace, "R%-3d[%-3d] ", i, cpu->regs[i]);
     }
 
-    printf("\n");
+    trace_printf(trace, "\n");
 }
 
-int generate_hash_index(APEX_CPU *cpu) {
-    if((cpu->fetch.opcode == OPCODE_BNZ) || (cpu->fetch.opcode == OPCODE_BP) || 
-    (cpu->fetch.opcode == OPCODE_BZ) || (cpu->fetch.opcode == OPCODE_BNP)) {
-        if(cpu->index == 0) {
-        cpu->index += 1;
-        return 0;
-    } else if(cpu->index < 4) {
-        for(int i = 0; i < 4; i++) {
-            if(cpu->fetch.pc == cpu->branch_target_buffer[i].pc_address) {
-                return cpu->branch_target_buffer[i].index;
-            }
+/* Debug function which prints the parsed code memory */
+static void
+print_code_memory(APEX_CPU *cpu)
+{
+    APEX_Trace *trace = &cpu->trace;
+    int i;
+
+    trace_printf(trace, "APEX_CPU: Initialized APEX CPU, loaded %d instructions\n",
+                 cpu->code_memory_size);
+    trace_printf(trace, "APEX_CPU: PC initialized to %d\n", cpu->pc);
+    trace_printf(trace, "APEX_CPU: IQ %d, BQ %d, ROB %d, LSQ %d, PRF %d (%d rename), "
+                 "BTB %d sets x %d ways, %d wide, MUL latency %d\n", cpu->config.iq_size,
+                 cpu->config.bq_size, cpu->config.rob_size, cpu->config.lsq_size,
+                 cpu->phys_regs, cpu->config.rename_regs, cpu->btb.sets, cpu->btb.ways,
+                 cpu->config.width, cpu->config.mul_latency);
+    trace_printf(trace, "APEX_CPU: %s predictor, %d entries, %d history bits\n",
+                 bpred_name(cpu->config.bpred), cpu->config.bpred_size,
+                 cpu->config.bpred_history);
+    trace_printf(trace, "APEX_CPU: Printing Code Memory\n");
+    trace_printf(trace, "%-9s %-9s %-9s %-9s %-9s\n", "opcode_str", "rd", "rs1",
+                 "rs2", "imm");
+
+    for (i = 0; i < cpu->code_memory_size; ++i)
+    {
+        trace_printf(trace, "%-9s %-9d %-9d %-9d %-9d\n",
+                     get_opcode_str(cpu->code_memory[i].opcode), cpu->code_memory[i].rd,
+                     cpu->code_memory[i].rs1, cpu->code_memory[i].rs2,
+                     cpu->code_memory[i].imm);
+    }
+}
+
+/* Branches whose only operand is the flags word */
+static int
+is_conditional_branch(int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+        case OPCODE_BP:
+        case OPCODE_BNP:
+        case OPCODE_BN:
+        case OPCODE_BNN:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+/* Instructions that go to the BQ, and take a rename checkpoint at decode */
+static int
+is_branch(int opcode)
+{
+    return is_conditional_branch(opcode) || opcode == OPCODE_JUMP || opcode == OPCODE_JALR;
+}
+
+/* Stages of the EVENT_* in the Kanata log, retire and flush end the log of
+ * an instruction */
+static const char *const kanata_stages[NUM_EVENTS] = {
+    "F", "Rn", "Ds", "X", "Lq", "M", "Wb", NULL, NULL,
+};
+
+/* TRUE when any per-instruction event log is open */
+#define EVENTS_ON(cpu) (KANATA_ON(&(cpu)->kanata) || (cpu)->btrace)
+
+/*
+ * Records event 'kind' of instruction 'seq' in the open event logs. The
+ * function unit and the physical tags only go to the binary trace.
+ */
+static void
+log_event(APEX_CPU *cpu, int kind, int seq, int pc, int unit, int pd, int ps1,
+          int ps2)
+{
+    if (KANATA_LOGGED(&cpu->kanata, seq))
+    {
+        if (kind == EVENT_RETIRE || kind == EVENT_FLUSH)
+        {
+            kanata_retire(&cpu->kanata, cpu->clock, seq, kind == EVENT_FLUSH);
         }
-        int index = cpu->index;
-        cpu->index += 1;
-        return index;
-    } else {
-        cpu->index = 1;
-        return 0;
+        else
+        {
+            kanata_stage(&cpu->kanata, cpu->clock, seq, kanata_stages[kind]);
+        }
+    }
+
+    if (cpu->btrace)
+    {
+        APEX_BTrace_Record rec = {kind, unit, cpu->clock, seq, pc, pd, ps1, ps2};
+
+        btrace_write(cpu->btrace, &rec);
     }
+}
+
+/* Logs event 'kind' of the instruction in front-end slot 'stage' */
+static void
+log_stage_event(APEX_CPU *cpu, const CPU_Stage *stage, int kind)
+{
+    if (EVENTS_ON(cpu))
+    {
+        log_event(cpu, kind, stage->seq, stage->pc, -1, stage->pd, stage->ps1,
+                  stage->ps2);
+    }
+}
+
+/* Logs event 'kind' of the instruction in ROB entry 'rob_index' */
+static void
+log_rob_event(APEX_CPU *cpu, int rob_index, int kind)
+{
+    const ROB_Entries *entry = &cpu->ROB_queue.rob_entries[rob_index];
+
+    if (EVENTS_ON(cpu))
+    {
+        log_event(cpu, kind, entry->seq, entry->pc_value, -1,
+                  entry->dest_phsyical_register, -1, -1);
+    }
+}
+
+/* Logs the issue of the entry just latched into 'stage' of unit FU_* 'unit' */
+static void
+log_issue_event(APEX_CPU *cpu, const CPU_Stage *stage, int unit)
+{
+    if (EVENTS_ON(cpu))
+    {
+        log_event(cpu, EVENT_ISSUE,
+                  cpu->ROB_queue.rob_entries[stage->op.rob_index].seq,
+                  stage->pc, unit, stage->pd, stage->ps1, stage->ps2);
     }
-    return 0;
 }
 
-int generate_hash_tag(int pc_address) {
-    return pc_address / 4;
+/*
+ * Looks up the line of the pc at the start of a fetch group in the I-cache.
+ * A miss keeps fetch waiting config.icache_miss_latency cycles for the fill,
+ * the line goes into the I-cache when it arrives. A redirect drops the fill
+ * and the line with it, see recover_branch().
+ *
+ * Returns TRUE when the group can be fetched this cycle.
+ */
+static int
+icache_ready(APEX_CPU *cpu)
+{
+    if (cpu->fetch_wait == 0)
+    {
+        if (cpu->icache.sets == 0 || cache_lookup(&cpu->icache, cpu->pc, FALSE))
+        {
+            return TRUE;
+        }
+        cpu->fetch_wait = cpu->config.icache_miss_latency + 1;
+    }
+    if (--cpu->fetch_wait > 0)
+    {
+        cpu->stalls[STALL_FETCH_ICACHE_MISS]++;
+        return FALSE;
+    }
+    cache_fill(&cpu->icache, cpu->pc, FALSE);
+    return TRUE;
 }
 
 /*
  * Fetch Stage of APEX Pipeline
  *
+ * Fetches a group of up to config.width sequential instructions into an
+ * empty decode group. With an I-cache the group comes from a single line.
+ *
  * Note: You are free to edit this function according to your implementation
  */
 static void
@@ -283,593 +504,675 @@ APEX_fetch(APEX_CPU *cpu)
 {
     APEX_Instruction *current_ins;
 
-    if (cpu->fetch.has_insn && !cpu->decode.has_insn)
+    if (cpu->fetch.has_insn && cpu->decode_count > 0)
+    {
+        cpu->stalls[STALL_FETCH_DECODE_BUSY]++;
+    }
+    else if (cpu->fetch.has_insn)
     {
         /* This fetches new branch target instruction from next cycle */
         if (cpu->fetch_from_next_cycle == TRUE)
         {
             cpu->fetch_from_next_cycle = FALSE;
+            cpu->stalls[STALL_FETCH_REDIRECT]++;
 
             /* Skip this cycle*/
             return;
         }
 
-        /* Store current PC in fetch latch */
-        cpu->fetch.pc = cpu->pc;
-
-        /* Index into code memory using this pc and copy all instruction fields
-         * into fetch latch  */
-        current_ins = &cpu->code_memory[get_code_memory_index_from_pc(cpu->pc)];
-        strcpy(cpu->fetch.opcode_str, current_ins->opcode_str);
-        // printf("fetch %s \n", &cpu->fetch);
-        cpu->fetch.opcode = current_ins->opcode;
-        cpu->fetch.rd = current_ins->rd;
-        cpu->fetch.rs1 = current_ins->rs1;
-        cpu->fetch.rs2 = current_ins->rs2;
-        cpu->fetch.imm = current_ins->imm;
-        cpu->fetch.is_empty_rd = current_ins->is_empty_rd;
-        cpu->fetch.is_empty_rs1 = current_ins->is_empty_rs1;
-        cpu->fetch.is_empty_rs2 = current_ins->is_empty_rs2;
-
-        int index = generate_hash_index(cpu);
-
-        if(generate_hash_tag(cpu->fetch.pc) == generate_hash_tag(cpu->branch_target_buffer[index].pc_address)) {
-            if((cpu->fetch.opcode == OPCODE_BNZ) || (cpu->fetch.opcode == OPCODE_BP)) {
-                cpu->fetch.btb_index = index;
-                if(cpu->branch_target_buffer[index].branch_prediction == 01 || 
-                cpu->branch_target_buffer[index].branch_prediction == 11) {
-                    cpu->pc = cpu->branch_target_buffer[index].target_address;
-                    cpu->branch_target_buffer[index].is_used = 1;
-                    cpu->fetch.is_btb_hit = 1;
-                } else {
-                    cpu->pc += 4;
-                    cpu->fetch.is_btb_hit = 0;
-                }
-            } else if((cpu->fetch.opcode == OPCODE_BZ) || (cpu->fetch.opcode == OPCODE_BNP)) {
-                cpu->fetch.btb_index = index;
-                if(cpu->branch_target_buffer[index].branch_prediction == 11) {
-                    cpu->pc = cpu->branch_target_buffer[index].target_address;
-                    cpu->branch_target_buffer[index].is_used = 1;
-                    cpu->fetch.is_btb_hit = 1;
-                } else {
-                    cpu->pc += 4;
-                    cpu->fetch.is_btb_hit = 0;
-                }
-            } else {
-                 cpu->pc += 4;
-                cpu->fetch.is_btb_hit = 0;
+        while (cpu->fetch.has_insn && cpu->decode_count < cpu->config.width)
+        {
+            /* A wrong-path fetch can run past the program, wait for recovery */
+            if ((unsigned int)get_code_memory_index_from_pc(cpu->pc)
+                >= (unsigned int)cpu->code_memory_size)
+            {
+                cpu->fetch.has_insn = FALSE;
+                break;
             }
-        } else {
-            if((cpu->fetch.opcode == OPCODE_BNZ) || (cpu->fetch.opcode == OPCODE_BP) || 
-            (cpu->fetch.opcode == OPCODE_BZ) || (cpu->fetch.opcode == OPCODE_BNP)) {
-                cpu->fetch.btb_index = index;
+            if (cpu->decode_count == 0 && !icache_ready(cpu))
+            {
+                break;
             }
 
-             /* Update PC for next instruction */
-            cpu->pc += 4;
+            /* Store current PC in fetch latch */
+            cpu->fetch.pc = cpu->pc;
+
+            /* Index into code memory using this pc and copy all instruction fields
+             * into fetch latch  */
+            cpu->fetch.insn_index = get_code_memory_index_from_pc(cpu->pc);
+            current_ins = &cpu->code_memory[cpu->fetch.insn_index];
+            cpu->fetch.opcode = current_ins->opcode;
+            cpu->fetch.is_empty_rs1 = current_ins->is_empty_rs1;
+            cpu->fetch.is_empty_rs2 = current_ins->is_empty_rs2;
+            cpu->fetch.seq = cpu->next_seq++;
+
+            int target = 0;
+
             cpu->fetch.is_btb_hit = 0;
-        }
+            cpu->fetch.bp.history = cpu->bpred.history;
+            cpu->fetch.bp.source = TARGET_NONE;
+            if (is_conditional_branch(cpu->fetch.opcode)) {
+                /* The predictor picks the direction, the BTB knows the target */
+                int btb_hit = btb_lookup(&cpu->btb, cpu->fetch.pc, &target);
 
-        // Check for BQ instructions and set is_bq to 1 or is_iq to 1
-        if (cpu->fetch.has_insn) {
-            if (cpu->fetch.opcode == OPCODE_BZ || cpu->fetch.opcode == OPCODE_BNZ || cpu->fetch.opcode == OPCODE_BN || cpu->fetch.opcode == OPCODE_BNN || cpu->fetch.opcode == OPCODE_BP || cpu->fetch.opcode == OPCODE_BNP || cpu->fetch.opcode == OPCODE_JUMP || cpu->fetch.opcode == OPCODE_JALR) {
-                cpu->fetch.is_bq = 1;
+                if (bpred_predict(&cpu->bpred, cpu->fetch.pc, &cpu->fetch.bp) && btb_hit) {
+                    cpu->fetch.is_btb_hit = 1;
+                }
+                bpred_follow(&cpu->bpred, cpu->fetch.is_btb_hit);
+            } else if (cpu->fetch.opcode == OPCODE_JALR) {
+                /* A call goes where it went last time and pushes its return */
+                cpu->fetch.bp.source = btb_lookup(&cpu->btb, cpu->fetch.pc, &target)
+                                       ? TARGET_BTB : TARGET_NONE;
+                ras_push(&cpu->ras, cpu->fetch.pc + 4, current_ins->rd);
+            } else if (cpu->fetch.opcode == OPCODE_JUMP) {
+                /* A return pops the RAS, any other JUMP is indirect */
+                if (current_ins->imm == 0 && ras_pop(&cpu->ras, current_ins->rs1, &target)) {
+                    cpu->fetch.bp.source = TARGET_RAS;
+                } else if (indirect_lookup(&cpu->indirect, cpu->fetch.pc, cpu->bpred.history,
+                                           &target)) {
+                    cpu->fetch.bp.source = TARGET_INDIRECT;
+                } else {
+                    cpu->fetch.bp.source = TARGET_NONE;
+                }
             }
-            else {
-                cpu->fetch.is_iq = 1;
+            if (cpu->fetch.opcode == OPCODE_JALR || cpu->fetch.opcode == OPCODE_JUMP) {
+                cpu->fetch.is_btb_hit = cpu->fetch.bp.source != TARGET_NONE;
             }
-        }
+            ras_save(&cpu->ras, &cpu->fetch.bp);
 
-        // Check for BQ and IQ instructions and set is_bq to 1 or is_iq to 1
-        if (cpu->fetch.has_insn) {
-            if (cpu->fetch.opcode == OPCODE_BZ || cpu->fetch.opcode == OPCODE_BNZ || cpu->fetch.opcode == OPCODE_BN || cpu->fetch.opcode == OPCODE_BNN || cpu->fetch.opcode == OPCODE_BP || cpu->fetch.opcode == OPCODE_BNP || cpu->fetch.opcode == OPCODE_JUMP || cpu->fetch.opcode == OPCODE_JALR) {
-                cpu->fetch.is_bq = 1;
-            }
-            else {
-                cpu->fetch.is_iq = 1;
+            /* Update PC for next instruction */
+            if (cpu->fetch.is_btb_hit) {
+                cpu->pc = target;
+            } else {
+                cpu->pc += 4;
             }
-        }
-        
-        /* Copy data from fetch latch to decode latch*/
-        cpu->decode = cpu->fetch;
-        printf("fetch %d", cpu->decode.has_insn);
-
-        if (ENABLE_DEBUG_MESSAGES)
-        {
-            print_stage_content("Fetch", &cpu->fetch);
-        }
-
-        /* Stop fetching new instructions if HALT is fetched */
-        if (cpu->fetch.opcode == OPCODE_HALT)
-        {
-            cpu->fetch.has_insn = FALSE;
-        }
-    }
-}
 
-static void update_src1_with_forwarded_data(APEX_CPU *cpu, int i) {
-    // if (!cpu->has_afu_data &&
-    //     cpu->afu_data.physical_address == cpu->dispatch.ps1) {
-    //     cpu->iq_entries[i].src1_valid_bit = 1;
-    //     cpu->iq_entries[i].src1_value = cpu->afu_data.updated_src_data;
-    // }
-    if (!cpu->has_mulfu_data[cpu->dispatch.ps1] &&
-        cpu->mulfu_data[cpu->dispatch.ps1].physical_address == cpu->dispatch.ps1 
-        && cpu->mulfu_data[cpu->dispatch.ps1].is_allocated) {
-        cpu->iq_entries[i].src1_valid_bit = 1;
-        cpu->iq_entries[i].src1_value = cpu->afu_data.dest_data;
-    cpu->forwarded = 1;
-    } else {
-        cpu->forwarded = 0;
-    }
-     if (!cpu->has_intfu_data[cpu->dispatch.ps1] &&
-        cpu->intfu_data[cpu->dispatch.ps1].physical_address == cpu->dispatch.ps1
-        && cpu->intfu_data[cpu->dispatch.ps1].is_allocated) {
-        cpu->iq_entries[i].src1_valid_bit = 1;
-        cpu->iq_entries[i].src1_value = cpu->intfu_data[cpu->dispatch.ps1].dest_data;
-      cpu->forwarded = 1;
-    } else {
-        cpu->forwarded = 0;
-    } 
-       if (cpu->physical_register[cpu->dispatch.ps1].allocated == 1 &&
-                cpu->physical_register[cpu->dispatch.ps1].valid_bit == 1) {
-        cpu->iq_entries[i].src1_valid_bit = 1;
-        cpu->iq_entries[i].src1_value =
-        cpu->physical_register[cpu->dispatch.ps1].data;
-    cpu->forwarded = 1;
-    } else {
-        cpu->forwarded = 0;
-    }
-}
-
-static void update_src2_with_forwarded_data(APEX_CPU *cpu, int i) {
-    // if (!cpu->has_afu_data &&
-    //     cpu->afu_data.physical_address == cpu->dispatch.ps2) {
-    //     cpu->iq_entries[i].src2_valid_bit = 1;
-    //     cpu->iq_entries[i].src2_value = cpu->afu_data.updated_src_data;
-    // }
-    if (!cpu->has_mulfu_data[cpu->dispatch.ps2] &&
-        cpu->mulfu_data[cpu->dispatch.ps2].physical_address == cpu->dispatch.ps2
-        && cpu->mulfu_data[cpu->dispatch.ps2].is_allocated) {
-        cpu->iq_entries[i].src2_valid_bit = 1;
-        cpu->iq_entries[i].src2_value = cpu->afu_data.dest_data;
-        cpu->forwarded = 1;
-    } else {
-        cpu->forwarded = 0;
-    }
-    
-     if (!cpu->has_intfu_data[cpu->dispatch.ps2] &&
-        cpu->intfu_data[cpu->dispatch.ps2].physical_address == cpu->dispatch.ps2
-        && cpu->intfu_data[cpu->dispatch.ps1].is_allocated) {
-        cpu->iq_entries[i].src2_valid_bit = 1;
-        cpu->iq_entries[i].src2_value = cpu->intfu_data[cpu->dispatch.ps1].dest_data;
-    cpu->forwarded = 1;
-    } else {
-        cpu->forwarded = 0;
-    }
-     if(cpu->physical_register[cpu->dispatch.ps2].allocated == 1 && 
-                cpu->physical_register[cpu->dispatch.ps2].valid_bit == 1) {
-                    cpu->iq_entries[i].src2_valid_bit = 1;
-                    cpu->iq_entries[i].src2_value = cpu->physical_register[cpu->dispatch.ps2].data;
-                cpu->forwarded = 1;
-    } else {
-        cpu->forwarded = 0;
-    }
-}
+            cpu->fetch.predicted_pc = cpu->pc;
 
-int check_wakeup_condition_issue(APEX_CPU *cpu, IQ_Entries *iq_entry) {
-    // Check if the source operands are available and valid
-    int src1_ready = 0;
-    int src2_ready = 0;
+            if (KANATA_ON(&cpu->kanata))
+            {
+                char text[INSN_TEXT_SIZE];
 
-    if (iq_entry->src1_valid_bit) {
-        if (iq_entry->src1_value == -1) {
-            // Source operand is a register
-            if (cpu->rename_table[iq_entry->src1_tag] == -1) {
-                src1_ready = 0; // Not available
-            } else {
-                src1_ready = 1; // Available
+                format_instruction(cpu, &cpu->fetch, text, sizeof(text));
+                kanata_insn(&cpu->kanata, cpu->clock, cpu->fetch.seq,
+                            cpu->fetch.pc, text);
             }
-        } else {
-            // Source operand is a literal value
-            src1_ready = 1; // Available
-        }
-        } else {
-            // Source operand is not required
-            // src1_ready = 1; // Available
-        }
-
-        if (iq_entry->src2_valid_bit) {
-            if (iq_entry->src2_value == -1) {
-                // Source operand is a register
-                if (cpu->rename_table[iq_entry->src2_tag] == -1) {
-                    src2_ready = 0; // Not available
-                } else {
-                    src2_ready = 1; // Available
-                }
-            } else {
-                // Source operand is a literal value
-                src2_ready = 1; // Available
+            if (EVENTS_ON(cpu))
+            {
+                /* Rename fields of the latch are stale until decode */
+                log_event(cpu, EVENT_FETCH, cpu->fetch.seq, cpu->fetch.pc, -1,
+                          -1, -1, -1);
             }
-        } else {
-            // Source operand is not required
-            // src2_ready = 1; // Available
-        }
 
-        // Check if both source operands are available
-        if (src1_ready && src2_ready) {
+            /* Copy data from fetch latch to decode latch*/
+            cpu->decode[cpu->decode_count++] = cpu->fetch;
 
-        return 1; // Instruction is ready to execute
-        }
-        // Updated: Check if source operands are available through bus monitoring
-        if (cpu->data_forward[0].flag && (cpu->data_forward[0].physical_address == iq_entry->src1_tag)) {
-            iq_entry->src1_value = cpu->data_forward[0].data;
-            iq_entry->src1_valid_bit = 1;
-        }
-
-        if (cpu->data_forward[1].flag && (cpu->data_forward[1].physical_address == iq_entry->src2_tag)) {
-            iq_entry->src2_value = cpu->data_forward[1].data;
-            iq_entry->src2_valid_bit = 1;
-        }
+            if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_STAGE))
+            {
+                print_stage_content(cpu, "Fetch", &cpu->fetch);
+            }
 
-        return 0; // Instruction is not ready to execute
-}
-int check_wakeup_condition_branch(APEX_CPU *cpu, BQ_Entry *bq_entry) {
-    // Check if the source operands are available and valid
-    int src1_ready = 0;
-    int src2_ready = 0;
+            /* Stop fetching new instructions if HALT is fetched */
+            if (cpu->fetch.opcode == OPCODE_HALT)
+            {
+                cpu->fetch.has_insn = FALSE;
+            }
 
-    if (bq_entry->src1_valid_bit) {
-        if (bq_entry->src1_value == -1) {
-            // Source operand is a register
-            if (cpu->rename_table[bq_entry->src1_tag] == -1) {
-                src1_ready = 0; // Not available
-            } else {
-                src1_ready = 1; // Available
+            /* The group ends at a predicted taken branch, the target is
+             * fetched next cycle */
+            if (cpu->fetch.is_btb_hit)
+            {
+                break;
             }
-        } else {
-            // Source operand is a literal value
-            src1_ready = 1; // Available
-        }
-        } else {
-            // Source operand is not required
-            src1_ready = 1; // Available
-        }
 
-        if (bq_entry->src2_valid_bit) {
-            if (bq_entry->src2_value == -1) {
-                // Source operand is a register
-                if (cpu->rename_table[bq_entry->src2_tag] == -1) {
-                    src2_ready = 0; // Not available
-                } else {
-                    src2_ready = 1; // Available
+            /* ... and at the end of the I-cache line */
+            if (cpu->icache.sets > 0 && cpu->pc % cpu->icache.line_size == 0)
+            {
+                if (cpu->fetch.has_insn && cpu->decode_count < cpu->config.width)
+                {
+                    cpu->fetch_line_breaks++;
                 }
-            } else {
-                // Source operand is a literal value
-                src2_ready = 1; // Available
+                break;
             }
-        } else {
-            // Source operand is not required
-            src2_ready = 1; // Available
         }
+    }
+}
+/* Bitmaps with one bit per IQ/BQ entry, see the waiting and ready masks */
+static inline void
+mask_set(uint64_t *mask, int bit)
+{
+    mask[bit >> 6] |= 1ull << (bit & 63);
+}
 
-        // Check if both source operands are available
-        if (src1_ready && src2_ready) {
+static inline void
+mask_clear(uint64_t *mask, int bit)
+{
+    mask[bit >> 6] &= ~(1ull << (bit & 63));
+}
 
-        return 1; // Instruction is ready to execute
-        }
-        // Updated: Check if source operands are available through bus monitoring
-        if (cpu->data_forward[0].flag && (cpu->data_forward[0].physical_address == bq_entry->src1_tag)) {
-            bq_entry->src1_value = cpu->data_forward[0].data;
-            bq_entry->src1_valid_bit = 1;
+/* Returns the lowest set bit of a mask of 'words' words, or -1 if none is */
+static inline int
+mask_first(const uint64_t *mask, int words)
+{
+    for (int w = 0; w < words; w++)
+    {
+        if (mask[w])
+        {
+            return w * 64 + __builtin_ctzll(mask[w]);
         }
+    }
+    return -1;
+}
 
-        if (cpu->data_forward[1].flag && (cpu->data_forward[1].physical_address == bq_entry->src2_tag)) {
-            bq_entry->src2_value = cpu->data_forward[1].data;
-            bq_entry->src2_valid_bit = 1;
+/* TRUE when bits 0 to bits - 1 are all set, e.g. a free mask of an empty queue */
+static inline int
+mask_all_set(const uint64_t *mask, int bits)
+{
+    for (int w = 0; w < bits / 64; w++)
+    {
+        if (~mask[w])
+        {
+            return FALSE;
         }
-
-        return 0; // Instruction is not ready to execute
+    }
+    return bits % 64 == 0 || (~mask[bits / 64] & ((1ULL << (bits % 64)) - 1)) == 0;
 }
 
-static void reinitialize_iq(APEX_CPU *cpu, int i) {
-    cpu->iq_entries[i].allocated = 0;
-    cpu->iq_entries[i].dest = 0;
-    cpu->iq_entries[i].dispatch_time = 0;
-    cpu->iq_entries[i].elapsed_cycles_at_dispatch = 0;
-    cpu->iq_entries[i].is_used = 0;
-    cpu->iq_entries[i].literal = 0;
-    cpu->iq_entries[i].opcode = 0;
-    cpu->iq_entries[i].pc_address = 0;
-    cpu->iq_entries[i].src1_tag = 0;
-    cpu->iq_entries[i].src1_valid_bit = 0;
-    cpu->iq_entries[i].src1_value = 0;
-    cpu->iq_entries[i].src2_valid_bit = 0;
-    cpu->iq_entries[i].src2_value = 0;
-    cpu->iq_entries[i].src2_tag = 0;
+static int
+flags_of(int result)
+{
+    return (result == 0 ? FLAG_ZERO : 0) | (result > 0 ? FLAG_POSITIVE : 0)
+           | (result < 0 ? FLAG_NEGATIVE : 0);
 }
 
-static void APEX_issue_queue(APEX_CPU *cpu) {
-    if(cpu->iq_stage.has_insn) {
-        // // Initialize IQ
-    // for (int i = 0; i < 24; i++) {
-    //     cpu->iq_entries[i].is_used = 0;
-    // }
-    // if (cpu->iq_size > 0) {
-    //     // Issue instructions from the Instruction Queue
-    //     int issue_ready = check_issue_ready(cpu->dispatch);
-    //     if (issue_ready) {
-    //         if (!(is_branch_instruction(cpu->dispatch.opcode))) {
-    //             // Dispatch to Issue Queue (IQ)
-    //             dispatch_to_IQ(cpu, &cpu->iq_entries[cpu->iq_index]);
-    //             cpu->iq_index = (cpu->iq_index + 1) % 24;
-    //             cpu->iq_size++;
-    //         }
-    //     }
-    // }  
-    // Check if there is forwarded data
-        for (int i = 0; i < 24; i++) {
-            for(int j = 0; j < 16; j++) {
-                // if (cpu->iq_entries[i].allocated) {
-                // if(!cpu->has_mulfu_data[cpu->iq_stage.ps1] && cpu->mulfu_data[cpu->iq_stage.ps1].physical_address == cpu->iq_entries[i].src1_tag
-                // && cpu->mulfu_data[cpu->iq_stage.ps1].is_allocated) {
-                //     cpu->iq_entries[i].src1_valid_bit = 1;
-                //     cpu->iq_entries[i].src1_value = cpu->mulfu_data[cpu->iq_stage.ps1].dest_data;
-                // }
-                // if(!cpu->has_intfu_data[cpu->iq_stage.ps1] && cpu->intfu_data[cpu->iq_stage.ps1].physical_address == cpu->iq_entries[i].src1_tag
-                //  && cpu->intfu_data[cpu->iq_stage.ps1].is_allocated) {
-                //     cpu->iq_entries[i].src1_valid_bit = 1;
-                //     cpu->iq_entries[i].src1_value = cpu->intfu_data[cpu->iq_stage.ps1].dest_data;
-                // }
-
-                if(!cpu->has_mulfu_data[i] && cpu->mulfu_data[i].physical_address == cpu->iq_entries[j].src1_tag
-                && cpu->mulfu_data[i].is_allocated) {
-                    cpu->iq_entries[j].src1_valid_bit = 1;
-                    cpu->iq_entries[j].src1_value = cpu->mulfu_data[i].dest_data;
-                    cpu->VCount[cpu->iq_entries[i].src1_tag]--;
-                }else if(!cpu->has_intfu_data[i] && cpu->intfu_data[i].physical_address == cpu->iq_entries[j].src1_tag
-                 && cpu->intfu_data[i].is_allocated) {
-                    cpu->iq_entries[j].src1_valid_bit = 1;
-                    cpu->iq_entries[j].src1_value = cpu->intfu_data[i].dest_data;
-                    cpu->VCount[cpu->iq_entries[i].src1_tag]--;
-                }
-
-                // if(!cpu->has_afu_data && cpu->afu_data.physical_address == cpu->iq_entries[i].src2_tag) {
-                //     // cpu->physical_register[cpu->iq_stage.ps2].data = cpu->afu_data.updated_src_data;
-                //     // cpu->physical_register[cpu->iq_stage.ps2].valid_bit = 1;
-                //     cpu->iq_entries[i].src2_valid_bit = 1;
-                //     cpu->iq_entries[i].src2_value = cpu->afu_data.dest_data;
-                //     // cpu->physical_register[cpu->decode.ps1].allocated = 1;
-                // }
-                // if(!cpu->has_mulfu_data[cpu->iq_stage.ps2] && cpu->mulfu_data[cpu->iq_stage.ps2].physical_address == cpu->iq_entries[i].src2_tag
-                // && cpu->mulfu_data[cpu->iq_stage.ps2].is_allocated) {
-                //     cpu->iq_entries[i].src2_valid_bit = 1;
-                //     cpu->iq_entries[i].src2_value = cpu->mulfu_data[cpu->iq_stage.ps2].dest_data;
-                // }
-                // if(!cpu->has_intfu_data[cpu->iq_stage.ps2] && cpu->intfu_data[cpu->iq_stage.ps2].physical_address == cpu->iq_entries[i].src2_tag
-                // && cpu->intfu_data[cpu->iq_stage.ps2].is_allocated) {
-                //     cpu->iq_entries[i].src2_valid_bit = 1;
-                //     cpu->iq_entries[i].src2_value = cpu->intfu_data[cpu->iq_stage.ps2].dest_data;
-                // }
-                if(!cpu->has_mulfu_data[i] && cpu->mulfu_data[i].physical_address == cpu->iq_entries[j].src2_tag
-                && cpu->mulfu_data[i].is_allocated) {
-                    cpu->iq_entries[j].src2_valid_bit = 1;
-                    cpu->iq_entries[j].src2_value = cpu->mulfu_data[i].dest_data;
-                    cpu->VCount[cpu->iq_entries[i].src2_tag]--;
-                }else if(!cpu->has_intfu_data[i] && cpu->intfu_data[i].physical_address == cpu->iq_entries[j].src2_tag
-                && cpu->intfu_data[i].is_allocated) {
-                    cpu->iq_entries[j].src2_valid_bit = 1;
-                    cpu->iq_entries[j].src2_value = cpu->intfu_data[i].dest_data;
-                    cpu->VCount[cpu->iq_entries[i].src2_tag]--;
-                }
-            }
-            
-            // }
-    }
-
-
-        if (cpu->dispatch.is_used && cpu->dispatch.is_bq) {
-        }
-
-        cpu->dispatch.simulate_counter = 1;  
-        // Update wakeup logic for IQ entries
-        for (int i = 0; i < 24; i++) {
-            if (cpu->iq_entries[i].allocated) {
-                // Check if the wakeup condition is met
-                if (check_wakeup_condition_issue(cpu, &cpu->iq_entries[i])) {
-                    // Set the instruction as ready to execute
-                    switch(cpu->iq_entries[i].opcode) {
-                        case OPCODE_LOAD:
-                        case OPCODE_LOADP:
-                        {
-                            cpu->iq_stage.iq_afu = cpu->iq_entries[i];
-                            cpu->iq_entries[i].is_issued = 1;
-                            cpu->afu = cpu->iq_stage;
-                            // cpu->VCount[cpu->iq_entries[i].src1_tag]--;
-                            break;
-                        }
-                        case OPCODE_STORE:
-                        case OPCODE_STOREP:
-                        {
-                            cpu->iq_stage.iq_afu = cpu->iq_entries[i];
-                            cpu->afu = cpu->iq_stage;
-                            cpu->iq_entries[i].is_issued = 1;
-                            // if(cpu->iq_entries[i].src1_tag == cpu->iq_entries[i].src2_tag){
-                            //     // cpu->VCount[cpu->iq_entries[i].src2_tag]--;
-                            // }
-                            // else{
-                            //     // cpu->VCount[cpu->iq_entries[i].src2_tag]--;
-                            //     // cpu->VCount[cpu->iq_entries[i].src1_tag]--;
-                            // }
-                            break;
-                        }
-                        case OPCODE_MUL:
-                        {
-                            // cpu->iq_entries[i].allocated = 0;
-                            cpu->iq_stage.iq_mulfu = cpu->iq_entries[i];
-                            cpu->mulfu = cpu->iq_stage;
-                            cpu->iq_entries[i].is_issued = 1;
-                            // if(cpu->iq_entries[i].src1_tag == cpu->iq_entries[i].src2_tag){
-                            //     cpu->VCount[cpu->iq_entries[i].src2_tag]--;
-                            // } else {
-                            //      cpu->VCount[cpu->iq_entries[i].src1_tag]--;
-                            //      cpu->VCount[cpu->iq_entries[i].src2_tag]--;
-                            // }
-                            reinitialize_iq(cpu, i);
-                            break;
-                        }
-                        case OPCODE_BP:
-                        case OPCODE_BNP:
-                        case OPCODE_BZ:
-                        case OPCODE_BNZ:
-                        case OPCODE_JUMP:
-                        case OPCODE_JALR:
-                            break;
-
-                        case OPCODE_ADDL:
-                        case OPCODE_SUBL:
-                        {
-                            cpu->iq_entries[i].allocated = 0;
-                            cpu->iq_entries[i].is_issued = 1;
-                            cpu->iq_stage.iq_intfu = cpu->iq_entries[i];
-                            cpu->intfu = cpu->iq_stage;
-                            // cpu->VCount[cpu->iq_entries[i].src1_tag]--;
-                        }
-                        case OPCODE_CML:
-                        {
-                            cpu->iq_entries[i].allocated = 0;
-                            cpu->iq_entries[i].is_issued = 1;
-                            cpu->iq_stage.iq_intfu = cpu->iq_entries[i];
-                            cpu->intfu = cpu->iq_stage;
-                            // cpu->VCount[cpu->iq_entries[i].src1_tag]--; 
-                        }
-
-                        case OPCODE_MOVC:
-                        {
-                            cpu->iq_entries[i].allocated = 0;
-                            cpu->iq_entries[i].is_issued = 1;
-                            cpu->iq_stage.iq_intfu = cpu->iq_entries[i];
-                            cpu->intfu = cpu->iq_stage;
-                            break;
-                        }
-
-                        default:
-                        {
-                            // reinitialize_iq(cpu, i);
-                            cpu->iq_entries[i].allocated = 0;
-                            cpu->iq_entries[i].is_issued = 1;
-                            cpu->iq_stage.iq_intfu = cpu->iq_entries[i];
-                            cpu->intfu = cpu->iq_stage;
-                            // if(cpu->iq_entries[i].src1_tag == cpu->iq_entries[i].src2_tag){
-                            //     cpu->VCount[cpu->iq_entries[i].src2_tag]--;
-                            // }
-                            // else{
-                            //     cpu->VCount[cpu->iq_entries[i].src2_tag]--;
-                            //     cpu->VCount[cpu->iq_entries[i].src1_tag]--;
-                            // }
-                            reinitialize_iq(cpu, i);
-                            break;
-                        }
-                    }
-                    
-                }
-            }
-        }
-        cpu->iq_stage.has_insn = FALSE;
-
+/* Flags word of the architectural P/Z/N flags */
+static int
+cpu_flags(const APEX_CPU *cpu)
+{
+    return (cpu->zero_flag ? FLAG_ZERO : 0) | (cpu->positive_flag ? FLAG_POSITIVE : 0)
+           | (cpu->negative_flag ? FLAG_NEGATIVE : 0);
+}
 
-        if (ENABLE_DEBUG_MESSAGES)
-        {
-            display_stage_content("Issue_Queue/RF", &cpu->iq_stage);
-        }
+/* Instructions whose result also updates the P/Z/N flags */
+static int
+sets_flags(int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        case OPCODE_CMP:
+        case OPCODE_CML:
+            return TRUE;
+        default:
+            return FALSE;
     }
+}
 
+static void
+complete_rob_entry(APEX_CPU *cpu, int rob_index)
+{
+    cpu->ROB_queue.rob_entries[rob_index].completed = TRUE;
+    log_rob_event(cpu, rob_index, EVENT_WRITEBACK);
 }
 
-void APEX_branch_queue(APEX_CPU *cpu) {
-    // Initialize BQ
-    for (int i = 0; i < 16; i++) {
-        cpu->bq[i].is_used = 0;
-    }
-    if (cpu->bq_size > 0) {
-        // Issue instructions from the Branch Queue
-        int issue_ready = check_issue_ready(cpu->dispatch);
-        if (issue_ready) {
-                if (is_branch_instruction(cpu->dispatch.opcode)) {
-                    // Dispatch to Branch Queue (BQ)
-                    dispatch_to_BQ(cpu, &cpu->bq[cpu->bq_index]);
-                    cpu->bq_index = (cpu->bq_index + 1) % 16;
-                    cpu->bq_size++;
-                }
-        }
-    }
+/* Wakes the IQ entries registered in 'waiting' with a result for 'tag' */
+static void
+wakeup_iq(APEX_CPU *cpu, uint64_t *waiting, int tag, int value)
+{
+    for (int w = 0; w < cpu->iq_words; w++)
+    {
+        uint64_t bits = waiting[w];
+
+        waiting[w] = 0;
+        while (bits)
+        {
+            int i = w * 64 + __builtin_ctzll(bits);
+            IQ_Entries *entry = &cpu->iq_entries[i];
 
-    for (int i = 0; i < 24; i++) {
-        if (cpu->bq[i].allocated) {
-            // Forwarding logic for BQ
-            if (!cpu->has_bfu_data[cpu->bq_stage.ps1] && cpu->bfu_data.physical_address == cpu->bq_stage.ps1) {
-                cpu->physical_register[cpu->bq_stage.ps1].data = cpu->bfu_data.updated_src_data;
-                cpu->physical_register[cpu->bq_stage.ps1].valid_bit = 1;
+            bits &= bits - 1;
+            if (!entry->src1_valid_bit && entry->src1_tag == tag)
+            {
+                entry->src1_valid_bit = 1;
+                entry->src1_value = value;
             }
-            if(!cpu->has_bfu_data[cpu->bq_stage.ps1] && cpu->bfu_data.physical_address == cpu->bq_stage.ps2) {
-                cpu->physical_register[cpu->bq_stage.ps2].data = cpu->bfu_data.updated_src_data;
-                cpu->physical_register[cpu->bq_stage.ps2].valid_bit = 1;
-                // cpu->physical_register[cpu->decode.ps1].allocated = 1;
+            if (!entry->src2_valid_bit && entry->src2_tag == tag)
+            {
+                entry->src2_valid_bit = 1;
+                entry->src2_value = value;
             }
-        }
-    }
-
-    for (int i = 0; i < 24; i++) {
-        if (cpu->bq[i].is_used) {
-            // Check if the wakeup condition is met
-            if (check_wakeup_condition_branch(cpu, &cpu->bq[i])) {
-                // Set the instruction as ready to execute
-                switch(cpu->bq[i].opcode) {
-                    case OPCODE_BP:
-                    case OPCODE_BNP:
-                    case OPCODE_BZ:
-                    case OPCODE_BNZ:
-                    case OPCODE_JUMP:
-                    case OPCODE_JALR:
-                        cpu->bq_stage.bq_bfu = cpu->bq[i];
-                        cpu->bfu = cpu->bq_stage;
-                        break;
-                    default:
-                    {
-                        break;
-                    }
-                }
+            if (entry->src1_valid_bit && entry->src2_valid_bit)
+            {
+                mask_set(cpu->iq_ready, i);
             }
         }
     }
 }
 
+/* Same for the BQ, conditional branches take the flags instead of the data */
+static void
+wakeup_bq(APEX_CPU *cpu, uint64_t *waiting, int tag, int value, int flags)
+{
+    for (int w = 0; w < cpu->bq_words; w++)
+    {
+        uint64_t bits = waiting[w];
+
+        waiting[w] = 0;
+        while (bits)
+        {
+            int i = w * 64 + __builtin_ctzll(bits);
+            BQ_Entry *entry = &cpu->bq[i];
+
+            bits &= bits - 1;
+            if (!entry->src1_valid_bit && entry->src1_tag == tag)
+            {
+                entry->src1_valid_bit = 1;
+                entry->src1_value = is_conditional_branch(entry->opcode) ? flags : value;
+            }
+            if (entry->src1_valid_bit && entry->src2_valid_bit)
+            {
+                mask_set(cpu->bq_ready, i);
+            }
+        }
+    }
+}
+
+/*
+ * Result bus: writes a result into physical register 'tag' and wakes up the
+ * IQ and BQ entries that wait on it. Entries register themselves at dispatch,
+ * so a broadcast only touches its own consumers and never scans the queues.
+ */
+static void
+broadcast_result(APEX_CPU *cpu, int tag, int value, int flags)
+{
+    Register_Rename *reg;
+
+    if (tag < 0)
+    {
+        return;
+    }
+
+    reg = &cpu->physical_register[tag];
+    reg->data = value;
+    reg->flags = flags;
+    reg->valid_bit = 1;
+
+    wakeup_iq(cpu, &cpu->iq_waiting[tag * cpu->iq_words], tag, value);
+    wakeup_bq(cpu, &cpu->bq_waiting[tag * cpu->bq_words], tag, value, flags);
+}
+
+/*
+ * Reads a source operand at dispatch. Returns TRUE with the value when it is
+ * available and FALSE when the entry has to wait for the broadcast of 'tag'.
+ */
+static int
+read_operand(const APEX_CPU *cpu, int tag, int *value)
+{
+    if (cpu->physical_register[tag].valid_bit)
+    {
+        *value = cpu->physical_register[tag].data;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* As read_operand, for the flags a conditional branch tests. Tag -1 is the
+ * architectural flags, no flag-setting instruction is in flight */
+static int
+read_flags(const APEX_CPU *cpu, int tag, int *value)
+{
+    if (tag < 0)
+    {
+        *value = cpu_flags(cpu);
+        return TRUE;
+    }
+    if (cpu->physical_register[tag].valid_bit)
+    {
+        *value = cpu->physical_register[tag].flags;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+ * Age matrix helpers, 'matrix' has 'entries' rows of 'words' words. A new
+ * entry is younger than every occupied entry; a freed entry stops being
+ * older than anybody, so its column is cleared.
+ */
+static void
+age_insert(uint64_t *matrix, int words, const uint64_t *free_mask, int entries, int i)
+{
+    uint64_t *row = &matrix[i * words];
+
+    for (int w = 0; w < words; w++)
+    {
+        row[w] = ~free_mask[w];
+    }
+    /* Bits past the last entry of the final word are not entries */
+    if (entries & 63)
+    {
+        row[words - 1] &= (1ull << (entries & 63)) - 1;
+    }
+    mask_clear(row, i);
+}
+
+static void
+age_remove(uint64_t *matrix, int words, int entries, int i)
+{
+    for (int r = 0; r < entries; r++)
+    {
+        mask_clear(&matrix[r * words], i);
+    }
+}
+
+/* Returns the oldest entry set in 'candidates', or -1 if none is. The
+ * oldest candidate is the one with no other candidate in its row */
+static int
+age_oldest(const uint64_t *matrix, int words, const uint64_t *candidates)
+{
+    for (int w = 0; w < words; w++)
+    {
+        uint64_t bits = candidates[w];
+
+        while (bits)
+        {
+            int i = w * 64 + __builtin_ctzll(bits);
+            const uint64_t *row = &matrix[i * words];
+            uint64_t older = 0;
+
+            for (int k = 0; k < words; k++)
+            {
+                older |= row[k] & candidates[k];
+            }
+            if (!older)
+            {
+                return i;
+            }
+            bits &= bits - 1;
+        }
+    }
+    return -1;
+}
+
+/* Function unit, FU_*, an IQ entry issues to */
+static int
+fu_class(int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_MUL:
+            return FU_MUL;
+
+        case OPCODE_LOAD:
+        case OPCODE_LOADP:
+        case OPCODE_STORE:
+        case OPCODE_STOREP:
+            return FU_ADDR;
+
+        default:
+            return FU_INT;
+    }
+}
+
+static void reinitialize_iq(APEX_CPU *cpu, int i) {
+    cpu->iq_entries[i].allocated = 0;
+    cpu->iq_entries[i].dest = 0;
+    cpu->iq_entries[i].literal = 0;
+    cpu->iq_entries[i].opcode = 0;
+    cpu->iq_entries[i].pc_address = 0;
+    cpu->iq_entries[i].src1_tag = 0;
+    cpu->iq_entries[i].src1_valid_bit = 0;
+    cpu->iq_entries[i].src1_value = 0;
+    cpu->iq_entries[i].src2_valid_bit = 0;
+    cpu->iq_entries[i].src2_value = 0;
+    cpu->iq_entries[i].src2_tag = 0;
+    mask_clear(cpu->iq_ready, i);
+    for (int fu = 0; fu < NUM_ISSUE_FU; fu++) {
+        mask_clear(&cpu->iq_fu[fu * cpu->iq_words], i);
+    }
+    age_remove(cpu->iq_age, cpu->iq_words, cpu->config.iq_size, i);
+    mask_set(cpu->iq_free, i);
+}
+
+static void reinitialize_bq(APEX_CPU *cpu, int i) {
+    cpu->bq[i].allocated = 0;
+    cpu->bq[i].src1_valid_bit = 0;
+    cpu->bq[i].src2_valid_bit = 0;
+    mask_clear(cpu->bq_ready, i);
+    age_remove(cpu->bq_age, cpu->bq_words, cpu->config.bq_size, i);
+    mask_set(cpu->bq_free, i);
+}
+
+/*
+ * Inserts the instruction in dispatch slot 'stage' into a free IQ entry. Each
+ * source that is not available yet registers the entry in the waiting row
+ * of its physical register; an entry with all sources available is ready
+ * to be selected right away.
+ */
+static void
+iq_insert(APEX_CPU *cpu, const CPU_Stage *stage, int use_src1, int use_src2, int rob_index, int lsq_index)
+{
+    int i = mask_first(cpu->iq_free, cpu->iq_words);
+    IQ_Entries *entry = &cpu->iq_entries[i];
+
+    mask_clear(cpu->iq_free, i);
+    age_insert(cpu->iq_age, cpu->iq_words, cpu->iq_free, cpu->config.iq_size, i);
+    mask_set(&cpu->iq_fu[fu_class(stage->opcode) * cpu->iq_words], i);
+    entry->allocated = 1;
+    entry->opcode = stage->opcode;
+    entry->literal = stage_insn(cpu, stage)->imm;
+    entry->dest = stage->pd;
+    entry->pc_address = stage->pc;
+    entry->rob_index = rob_index;
+    entry->lsq_index = lsq_index;
+    entry->base_dest = stage->base_pd;
+
+    entry->src1_tag = use_src1 ? stage->ps1 : -1;
+    entry->src1_value = 0;
+    entry->src1_valid_bit = !use_src1
+                            || read_operand(cpu, stage->ps1, &entry->src1_value);
+    if (!entry->src1_valid_bit)
+    {
+        mask_set(&cpu->iq_waiting[entry->src1_tag * cpu->iq_words], i);
+    }
+
+    entry->src2_tag = use_src2 ? stage->ps2 : -1;
+    entry->src2_value = 0;
+    entry->src2_valid_bit = !use_src2
+                            || read_operand(cpu, stage->ps2, &entry->src2_value);
+    if (!entry->src2_valid_bit)
+    {
+        mask_set(&cpu->iq_waiting[entry->src2_tag * cpu->iq_words], i);
+    }
+
+    if (entry->src1_valid_bit && entry->src2_valid_bit)
+    {
+        mask_set(cpu->iq_ready, i);
+    }
+}
+
+/* As iq_insert, for branches. Conditional branches wait on the flags */
+static void
+bq_insert(APEX_CPU *cpu, const CPU_Stage *stage, int rob_index)
+{
+    int i = mask_first(cpu->bq_free, cpu->bq_words);
+    BQ_Entry *entry = &cpu->bq[i];
+
+    mask_clear(cpu->bq_free, i);
+    age_insert(cpu->bq_age, cpu->bq_words, cpu->bq_free, cpu->config.bq_size, i);
+    entry->allocated = 1;
+    entry->opcode = stage->opcode;
+    entry->literal = stage_insn(cpu, stage)->imm;
+    entry->dest = stage->pd;
+    entry->pc_address = stage->pc;
+    entry->branch_prediction = stage->is_btb_hit;
+    entry->target_address = stage->predicted_pc;
+    entry->rob_index = rob_index;
+    entry->checkpoint = stage->checkpoint;
+
+    entry->src1_tag = stage->ps1;
+    entry->src1_value = 0;
+    if (is_conditional_branch(entry->opcode))
+    {
+        /* ps1 is the flags producer seen at decode, or -1 if that producer
+         * has retired since, see forget_cc_tag() */
+        entry->src1_valid_bit = read_flags(cpu, entry->src1_tag, &entry->src1_value);
+    }
+    else
+    {
+        entry->src1_valid_bit = read_operand(cpu, entry->src1_tag, &entry->src1_value);
+    }
+    entry->src2_valid_bit = 1;
+
+    if (!entry->src1_valid_bit)
+    {
+        mask_set(&cpu->bq_waiting[entry->src1_tag * cpu->bq_words], i);
+    }
+    else
+    {
+        mask_set(cpu->bq_ready, i);
+    }
+}
+
+/* Stage 'k' of the multiplier, 0 being the mulfu latch the IQ issues to */
+static CPU_Stage *mul_stage(APEX_CPU *cpu, int k) {
+    return k == 0 ? &cpu->mulfu : &cpu->mul_pipe[k - 1];
+}
+
+/* TRUE while any multiplier stage holds a MUL */
+static int mul_pipe_busy(const APEX_CPU *cpu) {
+    if (cpu->mulfu.has_insn) {
+        return TRUE;
+    }
+    for (int k = 0; k < cpu->config.mul_latency - 1; k++) {
+        if (cpu->mul_pipe[k].has_insn) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Function unit latch of an FU_* */
+static CPU_Stage *
+function_unit(APEX_CPU *cpu, int fu)
+{
+    switch (fu)
+    {
+        case FU_MUL:
+            return &cpu->mulfu;
+
+        case FU_ADDR:
+            return &cpu->afu;
+
+        default:
+            return &cpu->intfu;
+    }
+}
+
+/*
+ * Issue Queue stage of APEX Pipeline
+ *
+ * Wakeup happens on the result bus, see broadcast_result(), so select only
+ * looks at the ready bitmap. Every free function unit is granted the oldest
+ * ready entry that issues to it, using the age matrix.
+ */
+static void
+APEX_issue_queue(APEX_CPU *cpu)
+{
+    int issued = 0;
+
+    for (int fu = 0; fu < NUM_ISSUE_FU; fu++)
+    {
+        CPU_Stage *stage = function_unit(cpu, fu);
+        uint64_t *candidates = cpu->iq_select;
+        int i;
+
+        if (stage->has_insn)
+        {
+            continue;
+        }
+
+        for (int w = 0; w < cpu->iq_words; w++)
+        {
+            candidates[w] = cpu->iq_ready[w] & cpu->iq_fu[fu * cpu->iq_words + w];
+        }
+        i = age_oldest(cpu->iq_age, cpu->iq_words, candidates);
+        if (i < 0)
+        {
+            continue;
+        }
+
+        latch_iq_entry(stage, &cpu->iq_entries[i]);
+        reinitialize_iq(cpu, i);
+        log_issue_event(cpu, stage, fu);
+        issued++;
+
+        if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_STAGE))
+        {
+            display_stage_content(cpu, "Issue_Queue/RF", stage);
+        }
+    }
 
+    /* Nothing issued from a non-empty IQ */
+    if (issued == 0 && !mask_all_set(cpu->iq_free, cpu->config.iq_size))
+    {
+        cpu->stalls[mask_first(cpu->iq_ready, cpu->iq_words) >= 0
+                    ? STALL_ISSUE_FU_BUSY : STALL_ISSUE_NOT_READY]++;
+    }
+}
+
+/* Branch Queue stage, issues the oldest ready branch to the BFU */
+static void
+APEX_branch_queue(APEX_CPU *cpu)
+{
+    int i = age_oldest(cpu->bq_age, cpu->bq_words, cpu->bq_ready);
+
+    if (i < 0 && !mask_all_set(cpu->bq_free, cpu->config.bq_size))
+    {
+        cpu->stalls[STALL_BRANCH_NOT_READY]++;
+    }
+    if (i < 0 || cpu->bfu.has_insn)
+    {
+        return;
+    }
 
+    latch_bq_entry(&cpu->bfu, &cpu->bq[i]);
+    reinitialize_bq(cpu, i);
+    log_issue_event(cpu, &cpu->bfu, FU_BRANCH);
 
-static void remove_from_btb(APEX_CPU *cpu) {
-    for(int i = 0; i < 3; i++) {
-        cpu->branch_target_buffer[i] = cpu->branch_target_buffer[i + 1];
+    if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_STAGE))
+    {
+        display_stage_content(cpu, "Branch_Queue", &cpu->bfu);
     }
 }
 
-int isEmpty(APEX_CPU *cpu) {
+
+
+
+int isEmpty(const APEX_CPU *cpu) {
     return (cpu->ROB_queue.capacity == 0);
 }
 
 int isFull(APEX_CPU *cpu) {
-    return (cpu->ROB_queue.capacity >= 32);
+    return (cpu->ROB_queue.capacity >= cpu->config.rob_size);
 }
 
 void enqueue(APEX_CPU *cpu) {
     if(isFull(cpu)) {
-        printf("ROB Queue is full.");
+        TRACE(&cpu->trace, APEX_VERBOSITY_STAGE, "ROB Queue is full.");
         return;
     }
     if(isEmpty(cpu)) {
         cpu->ROB_queue.ROB_head = cpu->ROB_queue.ROB_tail = 0;
     } else {
-        cpu->ROB_queue.ROB_tail = (cpu->ROB_queue.ROB_tail + 1) % 32;
+        cpu->ROB_queue.ROB_tail = (cpu->ROB_queue.ROB_tail + 1) % cpu->config.rob_size;
     }
     cpu->ROB_queue.capacity++;
     cpu->ROB_queue.rob_entries[cpu->ROB_queue.ROB_tail] = cpu->rob_entry;
@@ -877,7 +1180,7 @@ void enqueue(APEX_CPU *cpu) {
 
 ROB_Entries dequeue(APEX_CPU *cpu) {
     if(isFull(cpu)) {
-        printf("ROB Queue is full.");
+        TRACE(&cpu->trace, APEX_VERBOSITY_STAGE, "ROB Queue is full.");
     }
 
     ROB_Entries rob_entry = cpu->ROB_queue.rob_entries[cpu->ROB_queue.ROB_head];
@@ -885,285 +1188,147 @@ ROB_Entries dequeue(APEX_CPU *cpu) {
         cpu->ROB_queue.ROB_head = -1;
         cpu->ROB_queue.ROB_tail = -1;
     } else {
-        cpu->ROB_queue.ROB_head = (cpu->ROB_queue.ROB_head + 1) % 32;
+        cpu->ROB_queue.ROB_head = (cpu->ROB_queue.ROB_head + 1) % cpu->config.rob_size;
     }
     cpu->ROB_queue.capacity--;
     return rob_entry;
 }
 
 
-static void rename_rd(APEX_CPU *cpu) {
-    int length = cpu->physical_queue_length;
-    if(cpu->isRenamed[cpu->decode.rd] == 0){
-        cpu->isRenamed[cpu->decode.rd] = 1;
-    }
-    for (int i = 0; i < length; i++) {
-        if(cpu->rename_table[cpu->physical_queue[i]] == cpu->decode.rd) {
-            cpu->prev_dest = cpu->physical_queue[i];
-        }
-        if (cpu->rename_table[cpu->physical_queue[i]] == -1) {
-            cpu->rename_table[cpu->physical_queue[i]] = cpu->decode.rd;
-            cpu->physical_register[cpu->physical_queue[i]].allocated = 1;
-            cpu->physical_register[cpu->physical_queue[i]].valid_bit = 0;
-            cpu->physical_register[cpu->physical_queue[i]].data = 0;
-            cpu->decode.pd = cpu->physical_queue[i];
-            cpu->free_list -= 1;
-            break;
-        }
-    }
+/* Takes the physical register at the head of the free list */
+static int allocate_physical_register(APEX_CPU *cpu) {
+    int preg = cpu->physical_queue[cpu->free_list_head];
+
+    cpu->free_list_head = (cpu->free_list_head + 1) % cpu->phys_regs;
+    cpu->free_list -= 1;
+    cpu->physical_register[preg].allocated = 1;
+    cpu->physical_register[preg].valid_bit = 0;
+    cpu->physical_register[preg].data = 0;
+    cpu->physical_register[preg].flags = 0;
+    return preg;
 }
 
-static void rename_rs1(APEX_CPU *cpu) {
-    int length = cpu->physical_queue_length;
-    int rs1_flag = 0;
-    for(int i = 0; i < length; i++) {
-      if (cpu->rename_table[cpu->physical_queue[i]] == cpu->decode.rs1) {
-        rs1_flag = 1;
-        cpu->decode.ps1 = cpu->physical_queue[i];
-        cpu->physical_register[cpu->decode.ps1].allocated = 1;
-        cpu->VCount[cpu->decode.rs1]++;
-        if(!cpu->has_afu_data && cpu->afu_data.physical_address == cpu->decode.ps1) {
-            cpu->physical_register[cpu->decode.ps1].data = cpu->afu_data.updated_src_data;
-            cpu->physical_register[cpu->decode.ps1].valid_bit = 1;
-            // cpu->physical_register[cpu->decode.ps1].allocated = 1;
-        }
-        if(!cpu->has_mulfu_data[cpu->decode.ps1] && cpu->mulfu_data[cpu->decode.ps1].physical_address == cpu->decode.ps1) {
-            cpu->physical_register[cpu->decode.ps1].data = cpu->mulfu_data[cpu->decode.ps1].dest_data;
-            cpu->physical_register[cpu->decode.ps1].valid_bit = 1;
-            // cpu->physical_register[cpu->decode.ps1].allocated = 1;
-        }
-        if(!cpu->has_intfu_data[cpu->decode.ps1] && cpu->intfu_data[cpu->decode.ps1].physical_address == cpu->decode.ps1
-        && cpu->intfu_data[cpu->decode.ps1].is_allocated) {
-            cpu->physical_register[cpu->decode.ps1].data = cpu->intfu_data[cpu->decode.ps1].dest_data;
-            cpu->physical_register[cpu->decode.ps1].valid_bit = 1;
-            // cpu->physical_register[cpu->decode.ps1].allocated = 1;
-        }
-        break;
-      }
-    }
-    if (rs1_flag == 0) {
-      for (int i = 0; i < length; i++) {
-        if (cpu->rename_table[cpu->physical_queue[i]] == -1) {
-          cpu->rename_table[cpu->physical_queue[i]] = cpu->decode.rs1;
-          cpu->physical_register[cpu->physical_queue[i]].allocated = 1;
-          cpu->physical_register[cpu->physical_queue[i]].valid_bit = 0;
-          cpu->physical_register[cpu->physical_queue[i]].data = 0;
-          cpu->decode.ps1 = cpu->physical_queue[i];
-          break;
-        }
-      }
-    }
-}
-
-static void rename_rs2(APEX_CPU *cpu) {
-    int length = cpu->physical_queue_length;
-    int rs2_flag = 0;
-    for(int i = 0; i < length; i++) {
-      if (cpu->rename_table[cpu->physical_queue[i]] == cpu->decode.rs2) {
-        rs2_flag = 1;
-        cpu->decode.ps2 = cpu->physical_queue[i];
-        cpu->physical_register[cpu->decode.ps2].allocated = 1;
-        cpu->VCount[cpu->decode.rs2]++;
-        // if(!cpu->has_afu_data && cpu->afu_data.physical_address == cpu->decode.ps2) {
-        //     cpu->physical_register[cpu->decode.ps2].data = cpu->afu_data.updated_src_data;
-        //     cpu->physical_register[cpu->decode.ps2].valid_bit = 1;
-        //     // cpu->physical_register[cpu->decode.ps1].allocated = 1;
-        // }
-        if(!cpu->has_mulfu_data[cpu->decode.ps2] && cpu->mulfu_data[cpu->decode.ps2].physical_address == cpu->decode.ps2
-        && cpu->mulfu_data[cpu->decode.ps2].is_allocated) {
-            cpu->physical_register[cpu->decode.ps2].data = cpu->mulfu_data[cpu->decode.ps2].dest_data;
-            cpu->physical_register[cpu->decode.ps2].valid_bit = 1;
-            // cpu->physical_register[cpu->decode.ps1].allocated = 1;
-        }
-        if(!cpu->has_intfu_data[cpu->decode.ps2] && cpu->intfu_data[cpu->decode.ps2].physical_address == cpu->decode.ps2
-        && cpu->intfu_data[cpu->decode.ps2].is_allocated) {
-            cpu->physical_register[cpu->decode.ps2].data = cpu->intfu_data[cpu->decode.ps2].dest_data;
-            cpu->physical_register[cpu->decode.ps2].valid_bit = 1;
-            // cpu->physical_register[cpu->decode.ps1].allocated = 1;
-        }
-
-        break;
-      }
-    }
-    if (rs2_flag == 0) {
-      for (int i = 0; i < length; i++) {
-        if (cpu->rename_table[cpu->physical_queue[i]] == -1) {
-          cpu->rename_table[cpu->physical_queue[i]] = cpu->decode.rs2;
-          cpu->physical_register[cpu->physical_queue[i]].allocated = 1;
-          cpu->physical_register[cpu->physical_queue[i]].valid_bit = 0;
-          cpu->physical_register[cpu->physical_queue[i]].data = 0;
-          cpu->decode.ps2 = cpu->physical_queue[i];
-          break;
-        }
-      }
-    }
-}
-
-static void iq_entry_pd_ps1_ps2(APEX_CPU *cpu) {
-    for(int i = 0; i < 24; i++) {
-            if(cpu->iq_entries[i].allocated == 0) {
-                cpu->iq_entries[i].allocated = 1;
-                cpu->iq_entries[i].opcode = cpu->dispatch.opcode;
-
-                cpu->iq_entries[i].dest = cpu->dispatch.pd;
-                
-                cpu->iq_entries[i].src1_tag = cpu->dispatch.ps1;
-                cpu->iq_entries[i].literal = cpu->dispatch.imm;
-                cpu->iq_dest_index[cpu->dispatch.pd] = i;
-                cpu->iq_entries[i].is_issued = 0;
-                cpu->iq_entries[i].src1_value = 0;
-                cpu->iq_entries[i].src1_valid_bit = 0;
-                
-                update_src1_with_forwarded_data(cpu, i);
-
-                cpu->iq_entries[i].src2_tag = cpu->dispatch.ps2;
-                cpu->iq_entries[i].src2_value = 0;
-                cpu->iq_entries[i].src1_valid_bit = 0;
-                update_src2_with_forwarded_data(cpu, i);
-                if(cpu->forwarded == 1) {
-                    cpu->VCount[cpu->iq_entries[i].src1_tag]+=3;
-                }
-                break;
-            }
-        }
+/* Returns a physical register to the tail of the free list */
+static void free_physical_register(APEX_CPU *cpu, int preg) {
+    int tail = (cpu->free_list_head + cpu->free_list) % cpu->phys_regs;
+
+    cpu->physical_queue[tail] = preg;
+    cpu->free_list += 1;
+    cpu->physical_register[preg].allocated = 0;
 }
 
-static void iq_entry_pd_ps1(APEX_CPU *cpu) {
-    for(int i = 0; i < 24; i++) {
-            if(cpu->iq_entries[i].allocated == 0) {
-                cpu->iq_entries[i].allocated = 1;
-                cpu->iq_entries[i].opcode = cpu->dispatch.opcode;
-
-                cpu->iq_entries[i].dest = cpu->dispatch.pd;
-                
-                cpu->iq_entries[i].src1_tag = cpu->dispatch.ps1;
-                cpu->iq_entries[i].literal = cpu->dispatch.imm;
-                cpu->iq_entries[i].src1_value = 0;
-                cpu->iq_entries[i].src1_valid_bit = 0;
-                if(cpu->physical_register[cpu->dispatch.ps1].allocated == 1 && 
-                cpu->physical_register[cpu->dispatch.ps1].valid_bit == 1) {
-                    cpu->iq_entries[i].src1_valid_bit = 1;
-                    cpu->iq_entries[i].src1_value = cpu->physical_register[cpu->dispatch.ps1].data;
-                } 
-                cpu->iq_dest_index[cpu->dispatch.pd] = i;
-                cpu->iq_entries[i].is_issued = 0;
-                update_src1_with_forwarded_data(cpu, i);
-                break;
-            }
-        }
+/* Physical registers an instruction allocates at rename */
+static int physical_registers_needed(int opcode) {
+    switch (opcode) {
+        case OPCODE_LOADP:
+            return 2;
+        case OPCODE_STORE:
+        case OPCODE_JUMP:
+        case OPCODE_NOP:
+        case OPCODE_HALT:
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+        case OPCODE_BP:
+        case OPCODE_BNP:
+        case OPCODE_BN:
+        case OPCODE_BNN:
+            return 0;
+        default:
+            return 1;
+    }
 }
 
-static void iq_entry_ps1_ps2(APEX_CPU *cpu) {
-    for(int i = 0; i < 24; i++) {
-            if(cpu->iq_entries[i].allocated == 0) {
-                cpu->iq_entries[i].allocated = 1;
-                cpu->iq_entries[i].opcode = cpu->dispatch.opcode;
-
-                cpu->iq_entries[i].src1_tag = cpu->dispatch.ps1;
-                cpu->iq_entries[i].literal = cpu->dispatch.imm;
-                cpu->iq_entries[i].src1_value = 0;
-                cpu->iq_entries[i].src1_valid_bit = 0;
-                if(cpu->physical_register[cpu->dispatch.ps1].allocated == 1 && 
-                cpu->physical_register[cpu->dispatch.ps1].valid_bit == 1) {
-                    cpu->iq_entries[i].src1_valid_bit = 1;
-                    cpu->iq_entries[i].src1_value = cpu->physical_register[cpu->dispatch.ps1].data;
-                } 
-                update_src1_with_forwarded_data(cpu, i);
-
-                cpu->iq_entries[i].src2_tag = cpu->dispatch.ps2;
-                cpu->iq_entries[i].src2_value = 0;
-                cpu->iq_entries[i].src2_valid_bit = 0;
-                if(cpu->physical_register[cpu->dispatch.ps2].allocated == 1 && 
-                cpu->physical_register[cpu->dispatch.ps2].valid_bit == 1) {
-                    cpu->iq_entries[i].src2_valid_bit = 1;
-                    cpu->iq_entries[i].src2_value = cpu->physical_register[cpu->dispatch.ps2].data;
-                } 
-                update_src2_with_forwarded_data(cpu, i);
-                if(cpu->forwarded == 1) {
-                    cpu->VCount[cpu->iq_entries[i].src1_tag]+=3;
-                }
-                break;
-            }
-        }
+static void rename_rd(APEX_CPU *cpu, CPU_Stage *stage) {
+    int rd = stage_insn(cpu, stage)->rd;
+
+    stage->prev_pd = cpu->rename_table[rd];
+    stage->pd = allocate_physical_register(cpu);
+    cpu->rename_table[rd] = stage->pd;
 }
 
-static void iq_entry_ps1(APEX_CPU *cpu) {
-    for(int i = 0; i < 24; i++) {
-            if(cpu->iq_entries[i].allocated == 0) {
-                cpu->iq_entries[i].allocated = 1;
-                cpu->iq_entries[i].opcode = cpu->dispatch.opcode;
+/* LOADP and STOREP also write their base register back, incremented by 4 */
+static void rename_base(APEX_CPU *cpu, CPU_Stage *stage, int reg) {
+    stage->prev_base_pd = cpu->rename_table[reg];
+    stage->base_pd = allocate_physical_register(cpu);
+    cpu->rename_table[reg] = stage->base_pd;
+}
 
-                
-                cpu->iq_entries[i].src1_tag = cpu->dispatch.ps1;
-                cpu->iq_entries[i].literal = cpu->dispatch.imm;
-                cpu->iq_entries[i].src1_value = 0;
-                cpu->iq_entries[i].src1_valid_bit = 0;
-                if(cpu->physical_register[cpu->dispatch.ps1].allocated == 1 && 
-                cpu->physical_register[cpu->dispatch.ps1].valid_bit == 1) {
-                    cpu->iq_entries[i].src1_valid_bit = 1;
-                    cpu->iq_entries[i].src1_value = cpu->physical_register[cpu->dispatch.ps1].data;
-                }
-                update_src1_with_forwarded_data(cpu, i);
-                break;
-            }
-        }
+/* CMP and CML have no destination register, their flags get a physical
+ * register of their own which no architectural register maps to */
+static void rename_cc(APEX_CPU *cpu, CPU_Stage *stage) {
+    stage->pd = allocate_physical_register(cpu);
 }
 
-static void iq_entry_pd(APEX_CPU *cpu) {
-    for(int i = 0; i < 24; i++) {
-            if(cpu->iq_entries[i].allocated == 0) {
-                cpu->iq_entries[i].allocated = 1;
-                cpu->iq_entries[i].opcode = cpu->dispatch.opcode;
-                cpu->iq_entries[i].dest = cpu->dispatch.pd;
-                cpu->iq_entries[i].src1_valid_bit = 1;
-                cpu->iq_entries[i].src2_valid_bit = 1;
-                cpu->iq_entries[i].literal = cpu->dispatch.imm;
-                cpu->iq_dest_index[cpu->dispatch.pd] = i;
-                cpu->iq_entries[i].is_issued = 0;
-                break;
-            }
-        }
+static void rename_rs1(APEX_CPU *cpu, CPU_Stage *stage) {
+    stage->ps1 = cpu->rename_table[stage_insn(cpu, stage)->rs1];
 }
 
-static void initialize_R2R_rob_entry(APEX_CPU *cpu) {
-    if(!isFull(cpu)) {
-        cpu->rob_entry.entry_bit = 1;
-        cpu->rob_entry.dest_arch_register = cpu->dispatch.rd;
-        cpu->rob_entry.dest_phsyical_register = cpu->dispatch.pd;
-        cpu->rob_entry.lsq_index = 0;
-        cpu->rob_entry.memory_error_code = 0;
-        cpu->rob_entry.pc_value = cpu->dispatch.pc;
-        cpu->rob_entry.opcode = cpu->dispatch.opcode;
-        cpu->rob_entry.rename_table_entry = cpu->prev_dest;
-        enqueue(cpu);
-    }
+static void rename_rs2(APEX_CPU *cpu, CPU_Stage *stage) {
+    stage->ps2 = cpu->rename_table[stage_insn(cpu, stage)->rs2];
 }
 
-static void initialize_load_rob_entry(APEX_CPU *cpu) {
-    if(!isFull(cpu)) {
-        cpu->rob_entry.entry_bit = 1;
-        cpu->rob_entry.dest_arch_register = cpu->dispatch.rd;
-        cpu->rob_entry.dest_phsyical_register = cpu->dispatch.pd;
-        cpu->rob_entry.lsq_index = cpu->entry.entryIndex;
-        cpu->rob_entry.memory_error_code = 0;
-        cpu->rob_entry.pc_value = cpu->dispatch.pc;
-        cpu->rob_entry.opcode = cpu->dispatch.opcode;
-        cpu->rob_entry.rename_table_entry = cpu->prev_dest;
+/* Allocates the ROB entry of the instruction in dispatch slot 'stage' and
+ * returns its index */
+static int initialize_rob_entry(APEX_CPU *cpu, const CPU_Stage *stage) {
+    int flags_only = (stage->opcode == OPCODE_CMP || stage->opcode == OPCODE_CML);
+
+    cpu->rob_entry.entry_bit = 1;
+    cpu->rob_entry.dest_arch_register = (stage->pd >= 0 && !flags_only)
+                                        ? stage_insn(cpu, stage)->rd : -1;
+    cpu->rob_entry.dest_phsyical_register = stage->pd;
+    cpu->rob_entry.lsq_index = -1;
+    cpu->rob_entry.memory_error_code = 0;
+    cpu->rob_entry.pc_value = stage->pc;
+    cpu->rob_entry.opcode = stage->opcode;
+    cpu->rob_entry.rename_table_entry = stage->prev_pd;
+    cpu->rob_entry.base_arch_register = -1;
+    if (stage->base_pd >= 0) {
+        cpu->rob_entry.base_arch_register = stage->opcode == OPCODE_LOADP
+                                            ? stage_insn(cpu, stage)->rs1
+                                            : stage_insn(cpu, stage)->rs2;
     }
+    cpu->rob_entry.base_physical_register = stage->base_pd;
+    cpu->rob_entry.base_rename_table_entry = stage->prev_base_pd;
+    cpu->rob_entry.completed = 0;
+    cpu->rob_entry.mispredicted = 0;
+    cpu->rob_entry.seq = stage->seq;
+    cpu->rob_entry.taken = FALSE;
+    cpu->rob_entry.bp = stage->bp;
+    enqueue(cpu);
+    return cpu->ROB_queue.ROB_tail;
 }
 
-static void initialize_store_rob_entry(APEX_CPU *cpu) {
-    if(!isFull(cpu)) {
-        cpu->rob_entry.entry_bit = 1;
-        cpu->rob_entry.lsq_index = cpu->entry.entryIndex;
-        cpu->rob_entry.pc_value = cpu->dispatch.pc;
-        cpu->rob_entry.opcode = cpu->dispatch.opcode;
+/*
+ * The flags producer 'tag' has retired and its register may be reused, so
+ * everything still naming it as the flags source reads the cpu flags
+ * instead: cc_tag, the rename checkpoints and the conditional branches
+ * waiting in dispatch.
+ */
+static void forget_cc_tag(APEX_CPU *cpu, int tag) {
+    if (cpu->cc_tag == tag) {
+        cpu->cc_tag = -1;
+    }
+    for (int i = 0; i < cpu->config.branch_checkpoints; i++) {
+        if (cpu->rename_checkpoints[i].seq >= 0 && cpu->rename_checkpoints[i].cc_tag == tag) {
+            cpu->rename_checkpoints[i].cc_tag = -1;
+        }
+    }
+    for (int i = 0; i < cpu->dispatch_count; i++) {
+        if (is_conditional_branch(cpu->dispatch[i].opcode) && cpu->dispatch[i].ps1 == tag) {
+            cpu->dispatch[i].ps1 = -1;
+        }
     }
 }
 
-static void do_commit(Register_Rename physical_entry, int dest_address, APEX_CPU *cpu) {
+static void do_commit(APEX_CPU *cpu, const ROB_Entries *entry) {
+    Register_Rename *physical_entry = NULL;
+
+    if (entry->dest_phsyical_register >= 0) {
+        physical_entry = &cpu->physical_register[entry->dest_phsyical_register];
+    }
+
     /* Write result to register file based on instruction type */
-        switch (cpu->rob.opcode)
+        switch (entry->opcode)
         {
             case OPCODE_ADD:
             case OPCODE_SUB:
@@ -1172,1577 +1337,1119 @@ static void do_commit(Register_Rename physical_entry, int dest_address, APEX_CPU
             case OPCODE_OR:
             case OPCODE_XOR:
             case OPCODE_DIV:
-            {
-                cpu->regs[dest_address] = physical_entry.data;
-                break;
-            }
-
             case OPCODE_ADDL:
             case OPCODE_SUBL:
-            {
-                cpu->regs[dest_address] = physical_entry.data;
-                break;
-            }
-
             case OPCODE_LOAD:
-            {
-                cpu->regs[dest_address] = physical_entry.data;
-                break;
-            }
-
-            case OPCODE_MOVC: 
-            {
-                cpu->regs[dest_address] = physical_entry.data;
-                break;
-            }
-
             case OPCODE_LOADP:
+            case OPCODE_MOVC:
+            case OPCODE_JALR:
             {
-                cpu->regs[dest_address] = physical_entry.data;
-                cpu->regs[cpu->writeback.rs1] = cpu->writeback.updated_register_src1;
-                printf("src1 %d \n",cpu->regs[cpu->writeback.rs1]);
+                cpu->regs[entry->dest_arch_register] = physical_entry->data;
                 break;
             }
 
-            case OPCODE_NOP:
+            case OPCODE_STORE:
+            case OPCODE_STOREP:
             {
+                TRACE(&cpu->trace, APEX_VERBOSITY_STAGE, "MEM[%d] : %d \n",
+                      entry->store_address, entry->store_data);
                 break;
             }
 
-            case OPCODE_STORE:
+            default:
             {
-                printf("MEM[%d] : %d \n", cpu->writeback.memory_address, cpu->writeback.rs1_value);
                 break;
             }
+        }
 
-            case OPCODE_STOREP:
-            {
-                cpu->regs[cpu->writeback.rs2] = cpu->writeback.updated_register_src1;
-                printf("MEM[%d] : %d \n", cpu->writeback.memory_address, cpu->writeback.rs1_value);
-                break;
-            }
-
-            case OPCODE_CMP:
-            {
-                break;
-            }
+        if (sets_flags(entry->opcode)) {
+            cpu->zero_flag = (physical_entry->flags & FLAG_ZERO) != 0;
+            cpu->positive_flag = (physical_entry->flags & FLAG_POSITIVE) != 0;
+            cpu->negative_flag = (physical_entry->flags & FLAG_NEGATIVE) != 0;
+            forget_cc_tag(cpu, entry->dest_phsyical_register);
+        }
 
-            case OPCODE_CML:
-            {
-                break;
-            }
+        /* The base register is written before rd, a LOADP into its own base
+         * register keeps the loaded value */
+        if (entry->base_arch_register >= 0) {
+            cpu->regs[entry->base_arch_register] =
+                cpu->physical_register[entry->base_physical_register].data;
+            cpu->retirement_rat[entry->base_arch_register] = entry->base_physical_register;
+            free_physical_register(cpu, entry->base_rename_table_entry);
+        }
 
-            case OPCODE_JALR:
-            {
-                cpu->regs[dest_address] = physical_entry.data;
-                break;
-            }
+        /* The committed mapping replaces the previous one, which nothing
+         * can read any more */
+        if (entry->dest_arch_register >= 0) {
+            cpu->retirement_rat[entry->dest_arch_register] = entry->dest_phsyical_register;
+            free_physical_register(cpu, entry->rename_table_entry);
+        } else if (physical_entry) {
+            /* CMP/CML flags, cc_tag no longer points at them */
+            free_physical_register(cpu, entry->dest_phsyical_register);
         }
 }
 
-static int APEX_ROB(APEX_CPU *cpu) {
-    if(cpu->rob.has_insn) {
-        if(cpu->rob.opcode == OPCODE_HALT) {
-            return TRUE;
-        }
-        for(int i = 0; i < 24; i++) {
-            if(cpu->ROB_queue.rob_entries[cpu->ROB_queue.ROB_head].entry_bit == 1 && cpu->rename_table[cpu->physical_queue[i]] == cpu->ROB_queue.rob_entries[cpu->ROB_queue.ROB_head].dest_phsyical_register && cpu->VCount[cpu->rename_table[cpu->physical_queue[i]]] <= 0) {
-                if(cpu->physical_register[cpu->physical_queue[i]].allocated == 1 ) {
-                    ROB_Entries current_entry = dequeue(cpu);
-                    do_commit(cpu->physical_register[cpu->physical_queue[i]], current_entry.dest_arch_register ,
-                    cpu);
-                    cpu->rename_table[cpu->physical_queue[i]] = -1;
-                    cpu->rob.has_insn = FALSE;
-
-                    if (ENABLE_DEBUG_MESSAGES)
-                    {
-                        display_stage_content("ROB/RF", &cpu->rob);
-                    }
-                }
-            }
+/* Age of ROB entry 'rob_index', its distance from the ROB head */
+static int rob_age(const APEX_CPU *cpu, int rob_index) {
+    return (rob_index - cpu->ROB_queue.ROB_head + cpu->config.rob_size) % cpu->config.rob_size;
+}
+
+/* Drops function unit latch 'stage' if it holds an instruction younger than 'age' */
+static void squash_latch(APEX_CPU *cpu, CPU_Stage *stage, int age) {
+    if (stage->has_insn && rob_age(cpu, stage->op.rob_index) > age) {
+        stage->has_insn = FALSE;
+    }
+}
+
+/* Takes queue entry 'i' out of every row of a [phys_regs][words] waiting matrix */
+static void clear_waiting(uint64_t *waiting, int rows, int words, int i) {
+    for (int r = 0; r < rows; r++) {
+        mask_clear(&waiting[r * words], i);
+    }
+}
+
+/* Returns a free rename checkpoint, -1 when all are taken */
+static int free_checkpoint(const APEX_CPU *cpu) {
+    for (int i = 0; i < cpu->config.branch_checkpoints; i++) {
+        if (cpu->rename_checkpoints[i].seq < 0) {
+            return i;
         }
     }
-    return FALSE;
+    return -1;
 }
 
-static void fetch_LSQ_Entry(APEX_CPU *cpu){
+/* Saves the rename state right after the branch in decode slot 'stage' renamed */
+static void take_checkpoint(APEX_CPU *cpu, CPU_Stage *stage, int i) {
+    Rename_Checkpoint *ckpt = &cpu->rename_checkpoints[i];
 
-        cpu->entry.lsqEntryEstablished = 1;
-        cpu->entry.srcDataValidBit = 1;
+    ckpt->seq = stage->seq;
+    memcpy(ckpt->rename_table, cpu->rename_table, sizeof(ckpt->rename_table));
+    ckpt->free_list_head = cpu->free_list_head;
+    ckpt->cc_tag = cpu->cc_tag;
+    stage->checkpoint = i;
+}
 
+/*
+ * Recovers from the branch in ROB entry 'rob_index' as soon as the BFU finds
+ * it mispredicted. Only the instructions younger than the branch are on the
+ * wrong path: they leave the front end, the IQ, BQ and LSQ, the function
+ * units and the ROB, while older ones keep executing. The rename map, the
+ * free list and the flags producer go back to the checkpoint decode took
+ * right after the branch, and fetch restarts at 'target'.
+ */
+static void recover_branch(APEX_CPU *cpu, int rob_index, int target) {
+    const ROB_Entries *branch = &cpu->ROB_queue.rob_entries[rob_index];
+    const Rename_Checkpoint *ckpt = &cpu->rename_checkpoints[cpu->bfu.checkpoint];
+    int age = rob_age(cpu, rob_index);
 
-        if(cpu->physical_register[cpu->dispatch.pd].allocated == 1 && 
-            cpu->physical_register[cpu->dispatch.pd].valid_bit == 1) {
-            cpu->entry.srcDataValidBit = 0;
-            cpu->entry.destRegAddressForLoad = cpu->physical_register[cpu->dispatch.pd].data;
-        } else if(cpu->data_forward[0].physical_address == cpu->decode.pd) {
-            cpu->entry.srcDataValidBit = 0;
-            cpu->entry.destRegAddressForLoad = cpu->data_forward[0].data;
-            cpu->data_forward[0].is_allocated = 0;
-        } else if(cpu->data_forward[1].physical_address == cpu->decode.pd) {
-            cpu->entry.srcDataValidBit = 0;
-            cpu->entry.destRegAddressForLoad = cpu->data_forward[1].data;
-            cpu->data_forward[1].is_allocated = 0;
+    if (EVENTS_ON(cpu)) {
+        for (int i = age + 1; i < cpu->ROB_queue.capacity; i++) {
+            log_rob_event(cpu, (cpu->ROB_queue.ROB_head + i) % cpu->config.rob_size,
+                          EVENT_FLUSH);
         }
-        
-        
-        if(cpu->physical_register[cpu->dispatch.ps1].allocated == 1 && 
-            cpu->physical_register[cpu->dispatch.ps1].valid_bit == 1) {
-            cpu->entry.srcDataValidBit = 1;
-            cpu->entry.srcTag = cpu->physical_register[cpu->dispatch.ps1].data;
-        } else if(cpu->data_forward[0].physical_address == cpu->decode.ps1) {
-            cpu->entry.srcDataValidBit = 1;
-            cpu->entry.srcTag = cpu->data_forward[0].data;
-            cpu->data_forward[0].is_allocated = 0;
-        } else if(cpu->data_forward[1].physical_address == cpu->decode.ps1) {
-            cpu->entry.srcDataValidBit = 1;
-            cpu->entry.srcTag = cpu->data_forward[1].data;
-            cpu->data_forward[1].is_allocated = 0;
+        for (int i = 0; i < cpu->dispatch_count; i++) {
+            log_stage_event(cpu, &cpu->dispatch[i], EVENT_FLUSH);
         }
-}
+        for (int i = 0; i < cpu->decode_count; i++) {
+            log_stage_event(cpu, &cpu->decode[i], EVENT_FLUSH);
+        }
+    }
+    cpu->insn_squashed += cpu->ROB_queue.capacity - age - 1
+                          + cpu->dispatch_count + cpu->decode_count;
+    cpu->decode_count = 0;
+    cpu->dispatch_count = 0;
+
+    squash_latch(cpu, &cpu->afu, age);
+    squash_latch(cpu, &cpu->intfu, age);
+    squash_latch(cpu, &cpu->mau, age);
+    for (int k = 0; k < cpu->config.mul_latency; k++) {
+        squash_latch(cpu, mul_stage(cpu, k), age);
+    }
 
-static int isLSQFull(APEX_CPU *cpu) {
-    if (cpu->lsq.numberOfEntries < 16) {
-        return 0;
-    } else {
-        return 1;
+    for (int i = 0; i < cpu->config.iq_size; i++) {
+        if (cpu->iq_entries[i].allocated && rob_age(cpu, cpu->iq_entries[i].rob_index) > age) {
+            reinitialize_iq(cpu, i);
+            clear_waiting(cpu->iq_waiting, cpu->phys_regs, cpu->iq_words, i);
+        }
+    }
+    for (int i = 0; i < cpu->config.bq_size; i++) {
+        if (cpu->bq[i].allocated && rob_age(cpu, cpu->bq[i].rob_index) > age) {
+            reinitialize_bq(cpu, i);
+            clear_waiting(cpu->bq_waiting, cpu->phys_regs, cpu->bq_words, i);
+        }
     }
-}
 
-static int isLSQEmpty(APEX_CPU *cpu) {
-    return (cpu->lsq.numberOfEntries == 0);
-}
+    /* Younger loads and stores are at the rear of the LSQ, as in the ROB */
+    while (cpu->lsq.numberOfEntries > 0 && rob_age(cpu, cpu->lsq.entries[cpu->lsq.rear].entryIndex) > age) {
+        cpu->lsq.rear = (cpu->lsq.rear - 1 + cpu->config.lsq_size) % cpu->config.lsq_size;
+        cpu->lsq.numberOfEntries--;
+    }
+    cpu->ROB_queue.ROB_tail = rob_index;
+    cpu->ROB_queue.capacity = age + 1;
 
-static void LSQ_enqueue(APEX_CPU *cpu) {
-    while(isLSQFull(cpu)) {
-        //spin
+    /* Registers taken from the free list since the checkpoint go back to it */
+    for (int i = ckpt->free_list_head; i != cpu->free_list_head; i = (i + 1) % cpu->phys_regs) {
+        cpu->physical_register[cpu->physical_queue[i]].allocated = 0;
+        cpu->free_list++;
     }
+    cpu->free_list_head = ckpt->free_list_head;
+    memcpy(cpu->rename_table, ckpt->rename_table, sizeof(cpu->rename_table));
+    cpu->cc_tag = ckpt->cc_tag;
+
+    /* Fetch restarts right after the branch, and so does the history */
+    cpu->bpred.history = is_conditional_branch(branch->opcode)
+        ? bpred_history_after(&cpu->bpred, &branch->bp, branch->taken)
+        : branch->bp.history;
+    ras_restore(&cpu->ras, &branch->bp);
 
-    if (isLSQEmpty(cpu)) {
-        cpu->lsq.front = 0; // Set front to 0 for the first element
+    /* The checkpoints of the branch and of the younger, squashed ones */
+    for (int i = 0; i < cpu->config.branch_checkpoints; i++) {
+        if (cpu->rename_checkpoints[i].seq >= branch->seq) {
+            cpu->rename_checkpoints[i].seq = -1;
+        }
     }
 
-    cpu->lsq.rear = (cpu->lsq.rear + 1) % 16; // Circular increment
-    cpu->lsq.entries[cpu->lsq.rear] = cpu->entry;
-    cpu->lsq.numberOfEntries = cpu->lsq.numberOfEntries+1;
+    cpu->branch_flushes++;
+    cpu->recovering = TRUE;
+    cpu->refill_seq = -1;
+    cpu->pc = target;
+    cpu->fetch_wait = 0;            /* The fill of a wrong-path line is dropped */
 
-}
+    /* Since we are using reverse callbacks for pipeline stages,
+     * this will prevent the new instruction from being fetched in the current
+     * cycle*/
+    cpu->fetch_from_next_cycle = TRUE;
 
-static LSQEntry LSQ_dequeue(APEX_CPU *cpu){
+    /* Make sure fetch stage is enabled to start fetching from new PC */
+    cpu->fetch.has_insn = TRUE;
+}
 
-    LSQEntry entry1 = cpu->lsq.entries[cpu->lsq.front];
-    cpu->lsq.front = (cpu->lsq.front + 1) % 16; // Circular increment
-    cpu->lsq.numberOfEntries--;
+/*
+ * CPI_* category of the commit slots left unused this cycle when commit
+ * stops at the ROB head. An empty ROB is charged to the front end, or to
+ * bad speculation while it refills after a flush, and so is the first
+ * instruction of the refill until it retires; any other incomplete head to
+ * the memory or the core side by its opcode.
+ */
+static int lost_slot_category(const APEX_CPU *cpu) {
+    const ROB_Entries *head;
 
-    return entry1;
+    if (isEmpty(cpu)) {
+        return cpu->recovering ? CPI_BAD_SPECULATION : CPI_FRONTEND;
+    }
+    head = &cpu->ROB_queue.rob_entries[cpu->ROB_queue.ROB_head];
+    if (cpu->recovering && head->seq == cpu->refill_seq) {
+        return CPI_BAD_SPECULATION;
+    }
+    switch (head->opcode) {
+        case OPCODE_LOAD:
+        case OPCODE_LOADP:
+        case OPCODE_STORE:
+        case OPCODE_STOREP:
+            return CPI_MEMORY;
+        default:
+            return CPI_CORE;
+    }
 }
 
+/*
+ * Retires up to config.width instructions from the ROB head, in order, each
+ * once its result has been broadcast. Retirement stops at the first
+ * incomplete entry. Every commit slot of
+ * the cycle is charged to a CPI_* category. Returns TRUE when the head is
+ * HALT.
+ */
+static int APEX_ROB(APEX_CPU *cpu) {
+    int retired = 0;
+    int lost = -1;      /* CPI_* of the unused slots */
 
+    while (retired < cpu->config.width) {
+        ROB_Entries *head;
 
-static void LSQEntryStore(APEX_CPU *cpu){
+        if (isEmpty(cpu)) {
+            if (retired == 0) {
+                cpu->stalls[STALL_COMMIT_EMPTY]++;
+            }
+            lost = lost_slot_category(cpu);
+            break;
+        }
 
-    cpu->entry.lsqEntryEstablished = 1;
-                cpu->entry.isLoadStore = 0;
-                cpu->entry.validBitMemoryAddress = 1;
-                cpu->entry.entryIndex = cpu->lsq.numberOfEntries+1;
-
-                fetch_LSQ_Entry(cpu);
-
-                if(cpu->physical_register[cpu->dispatch.ps1].allocated == 1 && 
-                    cpu->physical_register[cpu->dispatch.ps1].valid_bit == 1) {
-                    cpu->entry.srcDataValidBit = 1;
-                    cpu->entry.srcTag = cpu->physical_register[cpu->dispatch.ps1].data;
-                } else if(cpu->data_forward[0].physical_address == cpu->decode.ps1) {
-                    cpu->entry.srcDataValidBit = 1;
-                    cpu->entry.srcTag = cpu->data_forward[0].data;
-                    cpu->data_forward[0].is_allocated = 0;
-                } else if(cpu->data_forward[1].physical_address == cpu->decode.ps1) {
-                    cpu->entry.srcDataValidBit = 1;
-                    cpu->entry.srcTag = cpu->data_forward[1].data;
-                    cpu->data_forward[1].is_allocated = 0;
-                }
+        head = &cpu->ROB_queue.rob_entries[cpu->ROB_queue.ROB_head];
+        if (!head->completed) {
+            if (retired == 0) {
+                cpu->stalls[STALL_COMMIT_NOT_COMPLETE]++;
+            }
+            lost = lost_slot_category(cpu);
+            break;
+        }
 
-                for(int i = 0; i < 24; i++) {
-                    if(cpu->iq_entries[i].allocated == 0) {
-                        cpu->iq_entries[i].allocated = 1;
-                        cpu->iq_entries[i].opcode = 0;
-
-                        cpu->iq_entries[i].dest = 0;
-                        
-                        cpu->iq_entries[i].src1_tag = cpu->dispatch.ps1;
-                        if(cpu->physical_register[cpu->dispatch.ps1].allocated == 1 && 
-                        cpu->physical_register[cpu->dispatch.ps1].valid_bit == 1) {
-                            cpu->iq_entries[i].src1_valid_bit = 1;
-                            cpu->iq_entries[i].src1_value = cpu->physical_register[cpu->dispatch.ps1].data;
-                        } else if(cpu->data_forward[0].physical_address == cpu->decode.ps1) {
-                            cpu->iq_entries[i].src1_valid_bit = 1;
-                            cpu->iq_entries[i].src1_value = cpu->data_forward[0].data;
-                            cpu->data_forward[0].is_allocated = 0;
-                        } else if(cpu->data_forward[1].physical_address == cpu->decode.ps1) {
-                            cpu->iq_entries[i].src1_valid_bit = 1;
-                            cpu->iq_entries[i].src1_value = cpu->data_forward[1].data;
-                            cpu->data_forward[1].is_allocated = 0;
-                        }
-
-                        cpu->iq_entries[i].src2_tag = cpu->dispatch.ps2;
-                        if(cpu->physical_register[cpu->dispatch.ps2].allocated == 1 && 
-                        cpu->physical_register[cpu->dispatch.ps2].valid_bit == 1) {
-                            cpu->iq_entries[i].src2_valid_bit = 1;
-                            cpu->iq_entries[i].src2_value = cpu->physical_register[cpu->dispatch.ps2].data;
-                        } else if(cpu->data_forward[0].physical_address == cpu->decode.ps2) {
-                            cpu->iq_entries[i].src2_valid_bit = 1;
-                            cpu->iq_entries[i].src2_value = cpu->data_forward[0].data;
-                            cpu->data_forward[0].is_allocated = 0;
-                        } else if(cpu->data_forward[1].physical_address == cpu->decode.ps2) {
-                            cpu->iq_entries[i].src2_valid_bit = 1;
-                            cpu->iq_entries[i].src2_value = cpu->data_forward[1].data;
-                            cpu->data_forward[1].is_allocated = 0;
-                        }
-                        }
-                    }
-
-                    LSQ_enqueue(cpu);
-}
-
-static void LSQEntryLoad(APEX_CPU *cpu){
-
-    iq_entry_pd_ps1(cpu);
-                cpu->entry.lsqEntryEstablished = 1;
-                cpu->entry.entryIndex = cpu->lsq.numberOfEntries+1;
-                    for(int i = 0; i < 24; i++) {
-                    if(cpu->iq_entries[i].allocated == 0) {
-                        cpu->iq_entries[i].allocated = 1;
-                        cpu->iq_entries[i].opcode = 0;
-
-                        cpu->iq_entries[i].dest = 0;
-                        cpu->iq_entries[i].src1_valid_bit = 1;
-                        
-                        cpu->iq_entries[i].src1_tag = cpu->dispatch.ps1;
-                        if(cpu->physical_register[cpu->dispatch.ps1].allocated == 1 && 
-                        cpu->physical_register[cpu->dispatch.ps1].valid_bit == 1) {
-                            cpu->iq_entries[i].src1_value = cpu->physical_register[cpu->dispatch.ps1].data;
-                        } else if(cpu->data_forward[0].physical_address == cpu->decode.ps1) {
-                            cpu->iq_entries[i].src1_value = cpu->data_forward[0].data;
-                            cpu->data_forward[0].is_allocated = 0;
-                        } else if(cpu->data_forward[1].physical_address == cpu->decode.ps1) {
-                            cpu->iq_entries[i].src1_value = cpu->data_forward[1].data;
-                            cpu->data_forward[1].is_allocated = 0;
-                        }
-
-                        cpu->iq_entries[i].src2_tag = cpu->dispatch.ps2;
-                        if(cpu->physical_register[cpu->dispatch.ps2].allocated == 1 && 
-                        cpu->physical_register[cpu->dispatch.ps2].valid_bit == 1) {
-                            cpu->iq_entries[i].src2_valid_bit = 1;
-                            cpu->iq_entries[i].src2_value = cpu->physical_register[cpu->dispatch.ps2].data;
-                        } else if(cpu->data_forward[0].physical_address == cpu->decode.ps2) {
-                            cpu->iq_entries[i].src2_valid_bit = 1;
-                            cpu->iq_entries[i].src2_value = cpu->data_forward[0].data;
-                            cpu->data_forward[0].is_allocated = 0;
-                        } else if(cpu->data_forward[1].physical_address == cpu->decode.ps2) {
-                            cpu->iq_entries[i].src2_valid_bit = 1;
-                            cpu->iq_entries[i].src2_value = cpu->data_forward[1].data;
-                            cpu->data_forward[1].is_allocated = 0;
-                        }
-                        }
-                    }
-
-                    if(cpu->physical_register[cpu->dispatch.pd].allocated == 1 && 
-                            cpu->physical_register[cpu->dispatch.pd].valid_bit == 1) {
-                            cpu->entry.srcDataValidBit = 0;
-                            cpu->entry.destRegAddressForLoad = cpu->physical_register[cpu->dispatch.pd].data;
-                        } else if(cpu->data_forward[0].physical_address == cpu->decode.pd) {
-                            cpu->entry.srcDataValidBit = 0;
-                            cpu->entry.destRegAddressForLoad = cpu->data_forward[0].data;
-                            cpu->data_forward[0].is_allocated = 0;
-                        } else if(cpu->data_forward[1].physical_address == cpu->decode.pd) {
-                            cpu->entry.srcDataValidBit = 0;
-                            cpu->entry.destRegAddressForLoad = cpu->data_forward[1].data;
-                            cpu->data_forward[1].is_allocated = 0;
-                    }
-
-                    cpu->entry.isLoadStore = 1;
-                    cpu->entry.validBitMemoryAddress = 1;
-
-                    fetch_LSQ_Entry(cpu);
-                    LSQ_enqueue(cpu);
-}
+        cpu->rob.has_insn = TRUE;
+        cpu->rob.pc = head->pc_value;
+        cpu->rob.insn_index = get_code_memory_index_from_pc(head->pc_value);
+        cpu->rob.opcode = head->opcode;
+        cpu->insn_completed++;
+        retired++;
+        log_rob_event(cpu, cpu->ROB_queue.ROB_head, EVENT_RETIRE);
 
-/*
- * Dispatch Stage of APEX Pipeline
- *
- */
-static void
-APEX_dispatch(APEX_CPU *cpu) {
-    if(cpu->dispatch.has_insn && !isLSQFull(cpu) && !isFull(cpu)) {
-        switch (cpu->dispatch.opcode)
+        if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_STAGE))
         {
-            case OPCODE_ADD:
-            case OPCODE_SUB:
-            case OPCODE_AND:
-            case OPCODE_OR:
-            case OPCODE_XOR:
-            case OPCODE_MUL:
-            case OPCODE_DIV:
-            {
-                iq_entry_pd_ps1_ps2(cpu);
-                initialize_R2R_rob_entry(cpu);
-                // cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                // cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
+            print_stage_content(cpu, "ROB/RF", &cpu->rob);
+        }
 
-                // update_with_forwarded_value(cpu);
-                // cpu->is_data_forwarded = 0;
-                break;
-            }
+        if (head->opcode == OPCODE_HALT) {
+            cpu->cpi_slots[CPI_RETIRING] += retired;
+            return TRUE;
+        }
 
-            case OPCODE_ADDL:
-            case OPCODE_SUBL:
-            case OPCODE_JALR:
-            {
-                // cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                iq_entry_pd_ps1(cpu);
-                initialize_R2R_rob_entry(cpu);
+        ROB_Entries current_entry = dequeue(cpu);
+        do_commit(cpu, &current_entry);
+        cpu->rob.has_insn = FALSE;
+        if (cpu->recovering && current_entry.seq == cpu->refill_seq) {
+            cpu->recovering = FALSE;
+        }
 
-                // update_rs1_with_forwarded_value(cpu);
-                // printf("rs1 %d", cpu->decode.rs1_value);
-                // cpu->is_data_forwarded = 0;
-                break;
+        if (is_conditional_branch(current_entry.opcode)) {
+            bpred_update(&cpu->bpred, current_entry.pc_value, &current_entry.bp,
+                         current_entry.taken);
+        } else if (current_entry.opcode == OPCODE_JUMP || current_entry.opcode == OPCODE_JALR) {
+            bpred_count_target(&cpu->bpred, &current_entry.bp, !current_entry.mispredicted);
+            if (current_entry.opcode == OPCODE_JUMP && current_entry.bp.source != TARGET_RAS) {
+                indirect_update(&cpu->indirect, current_entry.pc_value,
+                                current_entry.bp.history, current_entry.target_address);
             }
+        }
+    }
 
-            case OPCODE_LOAD:
-            case OPCODE_LOADP:
-            {
-                // cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                iq_entry_pd_ps1(cpu);
-                LSQEntryLoad(cpu);
-                initialize_load_rob_entry(cpu);
-                // update_rs1_with_forwarded_value(cpu);
-                // cpu->is_data_forwarded = 0;
-                // cpu->scoreBoarding[cpu->decode.rd] = 1;
-                // cpu->scoreBoarding[cpu->decode.rs1] = 1;
-
-                
-                break;
-            }
+    cpu->cpi_slots[CPI_RETIRING] += retired;
+    if (lost >= 0) {
+        cpu->cpi_slots[lost] += cpu->config.width - retired;
+    }
+    return FALSE;
+}
 
+static int isLSQFull(APEX_CPU *cpu) {
+    if (cpu->lsq.numberOfEntries < cpu->config.lsq_size) {
+        return 0;
+    } else {
+        return 1;
+    }
+}
 
-            case OPCODE_MOVC:
-            {
-                /* MOVC doesn't have register operands */
-                // cpu->scoreBoarding[cpu->decode.rd] = 1;
-                iq_entry_pd(cpu);
-                initialize_R2R_rob_entry(cpu);
-                break;
-            }
+static int isLSQEmpty(const APEX_CPU *cpu) {
+    return (cpu->lsq.numberOfEntries == 0);
+}
 
-            case OPCODE_NOP:
-            case OPCODE_HALT:
-            {
-                iq_entry_pd(cpu);
-                break;
-            }
+/* Appends cpu->entry to the LSQ and returns its index */
+static int LSQ_enqueue(APEX_CPU *cpu) {
+    cpu->lsq.rear = (cpu->lsq.rear + 1) % cpu->config.lsq_size; // Circular increment
+    cpu->lsq.entries[cpu->lsq.rear] = cpu->entry;
+    cpu->lsq.numberOfEntries = cpu->lsq.numberOfEntries+1;
+    return cpu->lsq.rear;
+}
 
-            case OPCODE_STORE:
-            case OPCODE_STOREP:
-            {
-                iq_entry_ps1_ps2(cpu);
-                LSQEntryStore(cpu);
-                initialize_store_rob_entry(cpu);
-                // cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                // cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
+static LSQEntry LSQ_dequeue(APEX_CPU *cpu){
 
-                // update_with_forwarded_value(cpu);
-                // cpu->is_data_forwarded = 0;
-                // cpu->scoreBoarding[cpu->decode.rs1] = 1;
-                // cpu->scoreBoarding[cpu->decode.rs2] = 1;
+    LSQEntry entry1 = cpu->lsq.entries[cpu->lsq.front];
+    cpu->lsq.front = (cpu->lsq.front + 1) % cpu->config.lsq_size; // Circular increment
+    cpu->lsq.numberOfEntries--;
 
-                
-                
+    return entry1;
+}
 
-                break;   
-            }
+/* Sets up the LSQ entry of a LOAD or STORE in dispatch slot 'stage'. The AFU
+ * fills in the address, and the data of a store, once the IQ entry issues */
+static int LSQEntryMemory(APEX_CPU *cpu, const CPU_Stage *stage, int rob_index) {
+    int isLoad = (stage->opcode == OPCODE_LOAD || stage->opcode == OPCODE_LOADP);
+    int index;
 
-            case OPCODE_CMP:
-            {
-                iq_entry_ps1_ps2(cpu);
-                initialize_R2R_rob_entry(cpu);
-                // cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                // cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
+    cpu->entry.lsqEntryEstablished = 1;
+    cpu->entry.isLoadStore = isLoad;
+    cpu->entry.validBitMemoryAddress = 0;
+    cpu->entry.memoryAddress = 0;
+    cpu->entry.destRegAddressForLoad = isLoad ? stage->pd : -1;
+    cpu->entry.srcDataValidBit = isLoad;
+    cpu->entry.srcTag = isLoad ? -1 : stage->ps1;
+    cpu->entry.srcData = 0;
+    cpu->entry.entryIndex = rob_index;
+    cpu->entry.opcode = stage->opcode;
+    cpu->entry.pc = stage->pc;
+
+    index = LSQ_enqueue(cpu);
+    cpu->ROB_queue.rob_entries[rob_index].lsq_index = index;
+    return index;
+}
 
-                // update_with_forwarded_value(cpu);
-                // cpu->is_data_forwarded = 0;
-                break;
-            }
+/* Returns the STALL_* reason dispatch slot 'stage' cannot dispatch for, or
+ * -1 when the queues it needs all have a free entry */
+static int dispatch_stall(APEX_CPU *cpu, const CPU_Stage *stage) {
+    if (isFull(cpu)) {
+        return STALL_DISPATCH_ROB_FULL;
+    }
+    switch (stage->opcode) {
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+        case OPCODE_BP:
+        case OPCODE_BNP:
+        case OPCODE_BN:
+        case OPCODE_BNN:
+        case OPCODE_JUMP:
+        case OPCODE_JALR:
+            return mask_first(cpu->bq_free, cpu->bq_words) >= 0 ? -1 : STALL_DISPATCH_BQ_FULL;
 
-            case OPCODE_CML:
-            case OPCODE_JUMP:
-            {
-                iq_entry_ps1(cpu);
-                initialize_R2R_rob_entry(cpu);
-                // cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
+        case OPCODE_NOP:
+        case OPCODE_HALT:
+            return -1;
 
-                // update_rs1_with_forwarded_value(cpu);
-                // cpu->is_data_forwarded = 0;
-                break;
+        case OPCODE_LOAD:
+        case OPCODE_LOADP:
+        case OPCODE_STORE:
+        case OPCODE_STOREP:
+            if (isLSQFull(cpu)) {
+                return STALL_DISPATCH_LSQ_FULL;
             }
+            /* fall through */
+        default:
+            return mask_first(cpu->iq_free, cpu->iq_words) >= 0 ? -1 : STALL_DISPATCH_IQ_FULL;
+    }
+}
 
-            case OPCODE_BZ:
-            case OPCODE_BNZ:
-            case OPCODE_BP:
-            case OPCODE_BNP:
-            {
-                for(int i = 0; i < 16; i++) {
-                    if(cpu->bq[i].allocated == 0) {
-                        cpu->bq[i].allocated = 1;
-                        cpu->bq[i].opcode = cpu->dispatch.opcode;
-                        cpu->bq[i].dest = cpu->dispatch.pd;
-                        cpu->bq[i].src1_valid_bit = 1;
-                        cpu->bq[i].src2_valid_bit = 1;
-                    }
-                }
-                initialize_R2R_rob_entry(cpu);
-                break;
-            }
-        }
-        if (cpu->bq_size > 0) {
-            int index = cpu->bq[0].index;
-            cpu->bq[index].is_used = 0;
-            cpu->bq_size--;
-            cpu->fetch.pc = cpu->bq[index].target_address;
-        }
-
-        // if (cpu->dispatch.is_used && cpu->dispatch.data_forward) {
-        //     for (int i = 0; i < 24; i++) {
-        //         if (cpu->iq_entries[i].is_used && cpu->iq_entries[i].src1_valid_bit &&
-        //             cpu->iq_entries[i].src1_tag == cpu->dispatch.rd) {
-        //             // Forward the result to dependent instructions in IQ
-        //             cpu->iq_entries[i].src1_value = cpu->dispatch.result_buffer;
-        //             cpu->iq_entries[i].src1_valid_bit = 1;
-        //         }
-        //         if (cpu->iq_entries[i].is_used && cpu->iq_entries[i].src2_valid_bit &&
-        //             cpu->iq_entries[i].src2_tag == cpu->dispatch.rd) {
-        //             // Forward the result to dependent instructions in IQ
-        //             cpu->iq_entries[i].src2_value = cpu->dispatch.result_buffer;
-        //             cpu->iq_entries[i].src2_valid_bit = 1;
-        //         }
-        //     }
-        // }
-       /*if (cpu->dispatch.has_insn) {
-            int issue_ready = check_issue_ready(cpu->dispatch);
-
-            if (issue_ready) {
-                if (is_branch_instruction(cpu->dispatch.opcode)) {
-                    // Dispatch to Branch Queue (BQ)
-                    dispatch_to_BQ(cpu, &cpu->bq[cpu->bq_index]);
-                    cpu->bq_index = (cpu->bq_index + 1) % 16;
-                    cpu->bq_size++;
-                } else {
-                    // Dispatch to Issue Queue (IQ)
-                    dispatch_to_IQ(cpu, &cpu->iq_entries[cpu->iq_index]);
-                    cpu->iq_index = (cpu->iq_index + 1) % 24;
-                    cpu->iq_size++;
-                }
-            }
-        }*/
-
-        /* // Check if there is forwarded data
-        if (cpu->data_forward[0].flag || cpu->data_forward[1].flag) {
-            for (int i = 0; i < 24; i++) {
-                if (cpu->iq_entries[i].allocated) {
-                    if (cpu->data_forward[0].flag && cpu->iq_entries[i].src1_tag == cpu->data_forward[0].physical_address) {
-                        cpu->iq_entries[i].src1_value = cpu->data_forward[0].data;
-                        cpu->iq_entries[i].src1_valid_bit = TRUE;
-                    }
-
-                    if (cpu->data_forward[1].flag && cpu->iq_entries[i].src2_tag == cpu->data_forward[1].physical_address) {
-                        cpu->iq_entries[i].src2_value = cpu->data_forward[1].data;
-                        cpu->iq_entries[i].src2_valid_bit = TRUE;
-                    }
-                }
-            }
+/* Moves the instruction in dispatch slot 'stage' into the ROB and its queue */
+static void
+dispatch_insn(APEX_CPU *cpu, CPU_Stage *stage) {
+    int rob_index = initialize_rob_entry(cpu, stage);
 
-            // Clear forwarding information
-            cpu->data_forward[0].flag = 0;
-            cpu->data_forward[1].flag = 0;
+    if (cpu->recovering && cpu->refill_seq < 0) {
+        cpu->refill_seq = stage->seq;
+    }
+    log_stage_event(cpu, stage, EVENT_DISPATCH);
+    switch (stage->opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_CMP:
+        {
+            iq_insert(cpu, stage, TRUE, TRUE, rob_index, -1);
+            break;
         }
 
-        if (cpu->dispatch.is_used && cpu->dispatch.is_bq) {
-        cpu->dispatch.simulate_counter = 1;
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        case OPCODE_CML:
+        {
+            iq_insert(cpu, stage, TRUE, FALSE, rob_index, -1);
+            break;
         }
 
-        cpu->dispatch.simulate_counter = 1; */
+        case OPCODE_MOVC:
+        {
+            /* MOVC doesn't have register operands */
+            iq_insert(cpu, stage, FALSE, FALSE, rob_index, -1);
+            break;
+        }
 
+        case OPCODE_LOAD:
+        case OPCODE_LOADP:
+        {
+            iq_insert(cpu, stage, TRUE, FALSE, rob_index, LSQEntryMemory(cpu, stage, rob_index));
+            break;
+        }
 
-        /* Copy data from decode latch to execute latch*/
-    
-        cpu->lsqStage = cpu->dispatch;
-        cpu->iq_stage = cpu->dispatch;
-        cpu->bq_stage = cpu->dispatch;
-        // cpu->rob = cpu->dispatch;
+        case OPCODE_STORE:
+        case OPCODE_STOREP:
+        {
+            /* src1 is the data to store, src2 the base address */
+            iq_insert(cpu, stage, TRUE, TRUE, rob_index, LSQEntryMemory(cpu, stage, rob_index));
+            break;
+        }
 
-        cpu->dispatch.has_insn = FALSE;
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+        case OPCODE_BP:
+        case OPCODE_BNP:
+        case OPCODE_BN:
+        case OPCODE_BNN:
+        case OPCODE_JUMP:
+        case OPCODE_JALR:
+        {
+            bq_insert(cpu, stage, rob_index);
+            break;
+        }
 
-        if (ENABLE_DEBUG_MESSAGES)
+        case OPCODE_NOP:
+        case OPCODE_HALT:
         {
-            display_stage_content("Dispatch/RF", &cpu->dispatch);
+            complete_rob_entry(cpu, rob_index);
+            break;
         }
     }
+
+    stage->has_insn = FALSE;
+
+    if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_STAGE))
+    {
+        display_stage_content(cpu, "Dispatch/RF", stage);
+    }
 }
 
-int is_branch_instruction(int opcode) {
-    return (opcode == OPCODE_BZ || opcode == OPCODE_BNZ || opcode == OPCODE_JUMP || opcode == OPCODE_JALR);
+/*
+ * Dispatch Stage of APEX Pipeline
+ *
+ * Dispatches the group in program order until an instruction finds its
+ * queue full, the rest of the group stays for the next cycle.
+ */
+static void
+APEX_dispatch(APEX_CPU *cpu) {
+    int dispatched = 0;
+
+    while (dispatched < cpu->dispatch_count) {
+        int stall = dispatch_stall(cpu, &cpu->dispatch[dispatched]);
+
+        if (stall >= 0) {
+            cpu->stalls[stall]++;
+            break;
+        }
+        dispatch_insn(cpu, &cpu->dispatch[dispatched]);
+        dispatched++;
+    }
+
+    if (dispatched > 0) {
+        cpu->dispatch_count -= dispatched;
+        memmove(cpu->dispatch, &cpu->dispatch[dispatched],
+                cpu->dispatch_count * sizeof(CPU_Stage));
+    }
 }
 
-int check_issue_ready(CPU_Stage stage) {
-    return (stage.is_empty_rs1 || stage.rs1_value) &&
-           (stage.is_empty_rs2 || stage.rs2_value);
+/* TRUE when the oldest LSQ entry can go to the MAU. Memory operations leave
+ * the LSQ in program order, and stores only once they are the oldest
+ * instruction in the ROB since they cannot be undone */
+static int
+lsq_head_ready(const APEX_CPU *cpu)
+{
+    const LSQEntry *head;
+
+    if (isLSQEmpty(cpu))
+    {
+        return FALSE;
+    }
+
+    head = &cpu->lsq.entries[cpu->lsq.front];
+    if (!head->validBitMemoryAddress)
+    {
+        return FALSE;
+    }
+    return head->isLoadStore || head->entryIndex == cpu->ROB_queue.ROB_head;
 }
 
-void dispatch_to_IQ(APEX_CPU *cpu, IQ_Entries *iq_entry) {
-    iq_entry->allocated = 1;
-    iq_entry->opcode = cpu->dispatch.opcode;
-    iq_entry->literal = cpu->dispatch.imm;
-    iq_entry->src1_valid_bit = !cpu->dispatch.is_empty_rs1;
-    iq_entry->src1_tag = cpu->dispatch.rs1;
-    iq_entry->src1_value = cpu->dispatch.rs1_value;
-    iq_entry->src2_valid_bit = !cpu->dispatch.is_empty_rs2;
-    iq_entry->src2_tag = cpu->dispatch.rs2;
-    iq_entry->src2_value = cpu->dispatch.rs2_value;
-    iq_entry->dest = cpu->dispatch.rd;
-    iq_entry->pc_address = cpu->dispatch.pc;
-    iq_entry->is_used = 1;
-    iq_entry->dispatch_time = cpu->counter;
+/*
+ * Cycles the MAU takes for a load or store to 'address', looked up in the
+ * L1D as it enters the MAU. A miss adds the fill of the line, which goes
+ * into the L1D as the access finishes, see mau_fill. A store to a
+ * write-through L1D does not allocate and is buffered. Without an L1D, and
+ * for addresses outside data memory, every access takes a cycle.
+ */
+static int
+mau_latency(APEX_CPU *cpu, unsigned int address, int write)
+{
+    cpu->mau_fill = FALSE;
+    if (cpu->dcache.sets == 0 || address >= DATA_MEMORY_SIZE)
+    {
+        return 1;
+    }
+    if (cache_lookup(&cpu->dcache, address, write)
+        || (write && cpu->dcache.policy == CACHE_WRITE_THROUGH))
+    {
+        return cpu->config.dcache_hit_latency;
+    }
+    cpu->mau_fill = TRUE;
+    return cpu->config.dcache_hit_latency + cpu->config.dcache_miss_latency;
 }
 
-void dispatch_to_BQ(APEX_CPU *cpu, BQ_Entry *bq_entry) {
-    bq_entry->allocated = 1;
-    bq_entry->opcode = cpu->dispatch.opcode;
-    bq_entry->literal = cpu->dispatch.imm;
-    bq_entry->src1_valid_bit = !cpu->dispatch.is_empty_rs1;
-    bq_entry->src1_tag = cpu->dispatch.rs1;
-    bq_entry->src1_value = cpu->dispatch.rs1_value;
-    bq_entry->src2_valid_bit = !cpu->dispatch.is_empty_rs2;
-    bq_entry->src2_tag = cpu->dispatch.rs2;
-    bq_entry->src2_value = cpu->dispatch.rs2_value;
-    bq_entry->dest = cpu->dispatch.rd;
-    bq_entry->pc_address = cpu->dispatch.pc;
-    bq_entry->branch_prediction = 0;
-    bq_entry->target_address = 0;
-    bq_entry->is_used = 1;
-    bq_entry->index = cpu->counter;
+static void
+APEX_LSQ(APEX_CPU *cpu)
+{
+    LSQEntry entry;
 
-    if (cpu->data_forward[0].flag) {
-        bq_entry->src1_value = cpu->data_forward[0].data;
-        bq_entry->src1_valid_bit = TRUE;
+    if (!isLSQEmpty(cpu) && !lsq_head_ready(cpu))
+    {
+        cpu->stalls[STALL_LSQ_NOT_READY]++;
+    }
+    if (cpu->mau.has_insn || !lsq_head_ready(cpu))
+    {
+        return;
     }
 
-    if (cpu->data_forward[1].flag) {
-        bq_entry->src2_value = cpu->data_forward[1].data;
-        bq_entry->src2_valid_bit = TRUE;
+    entry = LSQ_dequeue(cpu);
+    cpu->mau.has_insn = TRUE;
+    cpu->mau.pc = entry.pc;
+    cpu->mau.insn_index = get_code_memory_index_from_pc(entry.pc);
+    cpu->mau.opcode = entry.opcode;
+    cpu->mau.pd = entry.destRegAddressForLoad;
+    cpu->mau.ps1 = entry.srcTag;
+    cpu->mau.ps2 = -1;
+    cpu->mau.memory_address = entry.memoryAddress;
+    cpu->mau.rs1_value = entry.srcData;
+    cpu->mau.op.opcode = entry.opcode;
+    cpu->mau.op.dest = entry.destRegAddressForLoad;
+    cpu->mau.op.rob_index = entry.entryIndex;
+    cpu->mau_wait = mau_latency(cpu, entry.memoryAddress, !entry.isLoadStore);
+    log_rob_event(cpu, entry.entryIndex, EVENT_MEMORY);
+
+    if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_STAGE))
+    {
+        display_stage_content(cpu, "LSQ/RF", &cpu->mau);
     }
+}
 
-    // Clear forwarding information
-    cpu->data_forward[0].flag = 0;
-    cpu->data_forward[1].flag = 0;
 
-}
+/* Renames the instruction in decode slot 'stage' against the rename table */
 static void
-APEX_LSQ(APEX_CPU *cpu)
+rename_insn(APEX_CPU *cpu, CPU_Stage *stage)
 {
-    if(cpu->lsqStage.has_insn && cpu->lsq.numberOfEntries > 0){
+    stage->pd = -1;
+    stage->ps1 = -1;
+    stage->ps2 = -1;
+    stage->prev_pd = -1;
+    stage->base_pd = -1;
+    stage->prev_base_pd = -1;
+
+    /* Sources are renamed before the destination, so that an instruction
+     * reading its own destination register sees the previous producer */
+    switch (stage->opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        {
+            rename_rs1(cpu, stage);
+            rename_rs2(cpu, stage);
+            rename_rd(cpu, stage);
+            break;
+        }
 
-    //CHECKING CONDITION 1
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        case OPCODE_JALR:
+        case OPCODE_LOAD:
+        {
+            rename_rs1(cpu, stage);
+            rename_rd(cpu, stage);
+            break;
+        }
 
-        //checking contition 2
+        case OPCODE_LOADP:
+        {
+            rename_rs1(cpu, stage);
+            rename_base(cpu, stage, stage_insn(cpu, stage)->rs1);
+            rename_rd(cpu, stage);
+            break;
+        }
 
-            if(cpu->memory_address != -1){
-                cpu->entry.memoryAddress = cpu->memory_address;
-                cpu->memory_address = -1;
-                cpu->entry.validBitMemoryAddress = 0;
-            }
 
-            
+        case OPCODE_MOVC:
+        {
+            /* MOVC doesn't have register operands */
+            rename_rd(cpu, stage);
+            break;
+        }
 
-            if(cpu->entry.validBitMemoryAddress == 0){
-                    if(cpu->ROB_queue.rob_entries[cpu->ROB_queue.ROB_head].lsq_index == cpu->lsq.entries[cpu->lsq.front].entryIndex){
+        case OPCODE_NOP:
+        {
+            break;
+        }
 
-                        if(isLSQEmpty(cpu)){
-                            return;
-                        }
+        case OPCODE_STORE:
+        {
+            rename_rs1(cpu, stage);
+            rename_rs2(cpu, stage);
+            break;
+        }
+
+        case OPCODE_STOREP:
+        {
+            rename_rs1(cpu, stage);
+            rename_rs2(cpu, stage);
+            rename_base(cpu, stage, stage_insn(cpu, stage)->rs2);
+            break;
+        }
+
+        case OPCODE_CMP:
+        {
+            rename_rs1(cpu, stage);
+            rename_rs2(cpu, stage);
+            rename_cc(cpu, stage);
+            break;
+        }
+
+        case OPCODE_CML:
+        {
+            rename_rs1(cpu, stage);
+            rename_cc(cpu, stage);
+            break;
+        }
+
+        case OPCODE_JUMP:
+        {
+            rename_rs1(cpu, stage);
+            break;
+        }
 
-                        cpu->lsqStage.dqLsq = LSQ_dequeue(cpu);
-                        cpu->mau = cpu->lsqStage;
-                        cpu->lsqStage.has_insn = FALSE;
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+        case OPCODE_BP:
+        case OPCODE_BNP:
+        case OPCODE_BN:
+        case OPCODE_BNN:
+        {
+            /* The flags of the latest flag-setting instruction */
+            stage->ps1 = cpu->cc_tag;
+            break;
+        }
+    }
 
-                        if (ENABLE_DEBUG_MESSAGES)
-                        {
-                            display_stage_content("LSQ/RF", &cpu->lsqStage);
-                        }
+    if (sets_flags(stage->opcode)) {
+        cpu->cc_tag = stage->pd;
+    }
 
-                }
-            }
-        
-        }
+    if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_STAGE))
+    {
+        display_stage_content(cpu, "Decode/RF", stage);
+    }
 }
 
-
 /*
  * Decode Stage of APEX Pipeline
  *
+ * Renames the group in program order and moves it to dispatch once the
+ * dispatch group has drained. Each instruction reads the rename table as
+ * left by the ones before it, which resolves dependencies within the group
+ * the same way as comparing its sources against their destinations would.
+ * Renaming stops at the first instruction short of free physical registers,
+ * the rest of the group stays for the next cycle.
+ *
  * Note: You are free to edit this function according to your implementation
  */
 static void
 APEX_decode(APEX_CPU *cpu)
 {
-    if (cpu->decode.has_insn && (cpu->free_list != 0))
-    // && (cpu->free_list != 0) &&
-    // ((cpu->decode.is_empty_rd || cpu->scoreBoarding[cpu->decode.rd] == 0) &&  (cpu->decode.is_empty_rs1 || cpu->scoreBoarding[cpu->decode.rs1] == 0) && (cpu->decode.is_empty_rs2 || cpu->scoreBoarding[cpu->decode.rs2] == 0)))
-    {
-        /* Read operands from register file based on the instruction type */
-        switch (cpu->decode.opcode)
-        {
-            case OPCODE_ADD:
-            case OPCODE_SUB:
-            case OPCODE_AND:
-            case OPCODE_OR:
-            case OPCODE_XOR:
-            case OPCODE_MUL:
-            case OPCODE_DIV:
-            {
-                rename_rd(cpu);
-                rename_rs1(cpu);
-                rename_rs2(cpu);
-                // if(cpu->decode.ps1 == cpu->decode.ps2){
-                //     cpu->VCount[cpu->decode.ps2]--;
-                // }
-                // cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                // cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-
-                // update_with_forwarded_value(cpu);
-                // cpu->is_data_forwarded = 0;
-                break;
-            }
-
-            case OPCODE_ADDL:
-            case OPCODE_SUBL:
-            case OPCODE_JALR:
-            {
-                // cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                rename_rd(cpu);
-                rename_rs1(cpu);
-
-                // update_rs1_with_forwarded_value(cpu);
-                // printf("rs1 %d", cpu->decode.rs1_value);
-                // cpu->is_data_forwarded = 0;
-                break;
-            }
-
-            case OPCODE_LOAD:
-            {
-                rename_rd(cpu);
-                rename_rs1(cpu);
-                cpu->entry.opcode = cpu->decode.opcode;
-
-            }
-            case OPCODE_LOADP:
-            {
-                // cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                rename_rd(cpu);
-                rename_rs1(cpu);
-                cpu->entry.opcode = cpu->decode.opcode;
-
-                // update_rs1_with_forwarded_value(cpu);
-                // cpu->is_data_forwarded = 0;
-                // cpu->scoreBoarding[cpu->decode.rd] = 1;
-                // cpu->scoreBoarding[cpu->decode.rs1] = 1;
-                break;
-            }
-
-
-            case OPCODE_MOVC:
-            {
-                /* MOVC doesn't have register operands */
-                // cpu->scoreBoarding[cpu->decode.rd] = 1;
-                rename_rd(cpu);
-                break;
-            }
-
-            case OPCODE_NOP:
-            {
-                break;
-            }
-
-            case OPCODE_STORE:
-            {
-                rename_rs1(cpu);
-                rename_rs2(cpu);
-                if(cpu->decode.ps1 == cpu->decode.ps2){
-                    cpu->VCount[cpu->decode.ps2] -= 1;
-                }
-                cpu->entry.opcode = cpu->decode.opcode;
-                break;
-            }
-            case OPCODE_STOREP:
-            {
-                rename_rs1(cpu);
-                rename_rs2(cpu);
-                cpu->entry.opcode = cpu->decode.opcode;
-                // cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                // cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-
-                // update_with_forwarded_value(cpu);
-                // cpu->is_data_forwarded = 0;
-                // cpu->scoreBoarding[cpu->decode.rs1] = 1;
-                // cpu->scoreBoarding[cpu->decode.rs2] = 1;
-                break;   
-            }
-
-            case OPCODE_CMP:
-            {
-                rename_rs1(cpu);
-                rename_rs2(cpu);
-                // if(cpu->decode.ps1 == cpu->decode.ps2){
-                //     cpu->VCount[cpu->decode.ps2]--;
-                // }
-                // cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                // cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-
-                // update_with_forwarded_value(cpu);
-                // cpu->is_data_forwarded = 0;
-                break;
-            }
+    int renamed = 0;
 
-            case OPCODE_CML:
-            case OPCODE_JUMP:
-            {
-                rename_rs1(cpu);
-                // cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
+    if (cpu->decode_count > 0 && cpu->dispatch_count > 0)
+    {
+        cpu->stalls[STALL_DECODE_DISPATCH_BUSY]++;
+        return;
+    }
 
-                // update_rs1_with_forwarded_value(cpu);
-                // cpu->is_data_forwarded = 0;
-                break;
-            }
+    while (renamed < cpu->decode_count)
+    {
+        int checkpoint = -1;
 
-            case OPCODE_BZ:
-            case OPCODE_BNZ:
-            case OPCODE_BP:
-            case OPCODE_BNP:
+        if (cpu->free_list < physical_registers_needed(cpu->decode[renamed].opcode))
+        {
+            cpu->stalls[STALL_DECODE_FREE_LIST]++;
+            break;
+        }
+        if (is_branch(cpu->decode[renamed].opcode))
+        {
+            checkpoint = free_checkpoint(cpu);
+            if (checkpoint < 0)
             {
-                if(!cpu->decode.is_btb_hit) {
-                    if(!cpu->branch_target_buffer[cpu->decode.btb_index].allocated) {
-                        cpu->branch_target_buffer[cpu->decode.btb_index].pc_address = cpu->decode.pc;
-                        cpu->branch_target_buffer[cpu->decode.btb_index].allocated = 1;
-                        cpu->branch_target_buffer[cpu->decode.btb_index].index = cpu->decode.btb_index;
-                        if((cpu->decode.opcode == OPCODE_BZ) || (cpu->decode.opcode == OPCODE_BNP)) {
-                            cpu->branch_target_buffer[cpu->decode.btb_index].branch_prediction = 0;
-                        } else {
-                            cpu->branch_target_buffer[cpu->decode.btb_index].branch_prediction = 1;
-                        }
-                    } else if(cpu->branch_target_buffer[cpu->decode.btb_index].pc_address != cpu->decode.pc) {
-                        int flag = 0;
-                        for(int i = 0; i < 4; i++) {
-                            if(cpu->branch_target_buffer->allocated != 1)
-                                flag = 1;
-                            else
-                                flag = 0;
-                        }
-                        if(flag == 0) {
-                            remove_from_btb(cpu);
-                            cpu->branch_target_buffer[3].pc_address = cpu->decode.pc;
-                            cpu->branch_target_buffer[3].allocated = 1;
-                            cpu->decode.btb_index = 3;
-                            cpu->branch_target_buffer[cpu->decode.btb_index].index = cpu->decode.btb_index;
-                        }
-                    }
-                }
+                cpu->stalls[STALL_DECODE_NO_CHECKPOINT]++;
                 break;
             }
         }
-
-        // Check if forwarding cycles are active
-        if (cpu->forwarding_cycles > 0) {
-            if (cpu->decode.is_used && cpu->decode.is_bq) {
-                // Check if forwarding data is valid
-                if (cpu->data_forward[0].flag) {
-                    cpu->decode.rs1_value = cpu->data_forward[0].data;
-                    cpu->decode.is_empty_rs1 = FALSE;
-                }
-
-                // Check if both sources have been forwarded
-                if (cpu->data_forward[1].flag) {
-                    cpu->decode.rs2_value = cpu->data_forward[1].data;
-                    cpu->decode.is_empty_rs2 = FALSE;
-                }
-
-                // Clear forwarding information
-                cpu->data_forward[0].flag = 0;
-                cpu->data_forward[1].flag = 0;
-            }
-
-            // Decrement forwarding cycles
-            cpu->forwarding_cycles--;
-        } else {
-            // Check if instruction is used and in the branch queue
-            if (cpu->decode.is_used && cpu->decode.is_bq) {
-                // Set forwarding cycles for tag and data broadcast
-                cpu->forwarding_cycles = 2;
-            }
-        }
-        cpu->decode.simulate_counter = 1;
-
-        /* Copy data from decode latch to execute latch*/
-        cpu->dispatch = cpu->decode;
-        cpu->decode.has_insn = FALSE;
-
-
-        if (ENABLE_DEBUG_MESSAGES)
+        rename_insn(cpu, &cpu->decode[renamed]);
+        cpu->decode[renamed].checkpoint = -1;
+        if (checkpoint >= 0)
         {
-            display_stage_content("Decode/RF", &cpu->decode);
+            take_checkpoint(cpu, &cpu->decode[renamed], checkpoint);
         }
+        log_stage_event(cpu, &cpu->decode[renamed], EVENT_RENAME);
 
+        /* Copy data from decode latch to dispatch latch */
+        cpu->dispatch[cpu->dispatch_count++] = cpu->decode[renamed];
+        renamed++;
     }
-}
 
-static void set_branch_flags(APEX_CPU *cpu) {
-    if (cpu->intfu.result_buffer == 0) {
-        cpu->zero_flag = TRUE;
-        cpu->intfu_data[cpu->decode.ps1].zero_flag = cpu->zero_flag;
-    } else {
-        cpu->zero_flag = FALSE;
-        cpu->intfu_data[cpu->decode.ps1].zero_flag = cpu->zero_flag;
-    }
-    if(cpu->intfu.result_buffer > 0) {
-        cpu->positive_flag = TRUE;
-        cpu->intfu_data[cpu->decode.ps1].positive_flag = cpu->positive_flag;
-    } else {
-      cpu->positive_flag = FALSE;
-      cpu->intfu_data[cpu->decode.ps1].positive_flag = cpu->positive_flag;
+    if (renamed > 0)
+    {
+        cpu->decode_count -= renamed;
+        memmove(cpu->decode, &cpu->decode[renamed], cpu->decode_count * sizeof(CPU_Stage));
     }
-    // if (cpu->intfu.result_buffer < 0) {
-    //   cpu->negative_flag = TRUE;
-    // } else {
-    //   cpu->negative_flag = FALSE;
-    // }
 }
 
-static void do_branching(APEX_CPU *cpu) {
-  /* Calculate new PC, and send it to fetch unit */
-  cpu->pc = cpu->execute.pc + cpu->execute.imm;
-
-  /* Since we are using reverse callbacks for pipeline stages,
-   * this will prevent the new instruction from being fetched in the current
-   * cycle*/
-  cpu->fetch_from_next_cycle = TRUE;
-
-  /* Flush previous stages */
-  cpu->decode.has_insn = FALSE;
-
-  /* Make sure fetch stage is enabled to start fetching from new PC */
-  cpu->fetch.has_insn = TRUE;
+static int branch_taken(int opcode, int flags) {
+    switch (opcode) {
+        case OPCODE_BZ:
+            return (flags & FLAG_ZERO) != 0;
+        case OPCODE_BNZ:
+            return (flags & FLAG_ZERO) == 0;
+        case OPCODE_BP:
+            return (flags & FLAG_POSITIVE) != 0;
+        case OPCODE_BNP:
+            return (flags & FLAG_POSITIVE) == 0;
+        case OPCODE_BN:
+            return (flags & FLAG_NEGATIVE) != 0;
+        case OPCODE_BNN:
+            return (flags & FLAG_NEGATIVE) == 0;
+        default:
+            return FALSE;
+    }
 }
 
-// static void update_stalling_flags(APEX_CPU *cpu) {
-//     if (cpu->execute.rd != cpu->execute.rs1) {
-//         cpu->scoreBoarding[cpu->execute.rs1] = 0;
-//     } else {
-//         cpu->scoreBoarding[cpu->execute.rs1] = 1;
-//     }
-//     if (cpu->execute.rd != cpu->execute.rs2) {
-//         cpu->scoreBoarding[cpu->execute.rs2] = 0;
-//     } else {
-//         cpu->scoreBoarding[cpu->execute.rs2] = 1;
-//     }
-// }
-
-
 static void APEX_AFU(APEX_CPU *cpu) {
-    cpu->has_afu_data = FALSE;
     if(cpu->afu.has_insn) {
-        int opcode = 0;
-        switch (opcode) {
+        LSQEntry *entry = &cpu->lsq.entries[cpu->afu.op.lsq_index];
+
+        switch (cpu->afu.op.opcode) {
             case OPCODE_LOAD:
-                //get rs1 and imm from lsq entry
-                cpu->afu.memory_address = cpu->afu.iq_entry.src2_value + cpu->afu.iq_entry.literal;
-                        // = cpu->afu.rs1_value + cpu->afu.imm;
-                cpu->has_afu_data = TRUE;
-                cpu->afu_data.dest_data = cpu->afu.memory_address;
-                cpu->afu_data.physical_address = cpu->afu.iq_entry.dest;
-                cpu->memory_address = cpu->afu.memory_address;
-                break;
             case OPCODE_LOADP:
-            //get rs1 and imm from lsq entry
-                cpu->afu.memory_address = cpu->afu.iq_entry.src2_value + cpu->afu.iq_entry.literal;
-                cpu->has_afu_data = TRUE;
-                cpu->afu_data.dest_data = cpu->afu.memory_address;
-                cpu->afu_data.physical_address = cpu->afu.iq_entry.dest;
-                cpu->afu_data.updated_src_data = cpu->afu.iq_entry.src1_value + 4;
-                cpu->memory_address = cpu->afu.memory_address;
-                        // = cpu->afu.rs1_value + cpu->afu.imm;
-                // cpu->memory_address = cpu->afu.memory_address;
-                //update src2 + 4
+                entry->memoryAddress = cpu->afu.op.src1_value + cpu->afu.op.literal;
+                if (cpu->afu.op.opcode == OPCODE_LOADP) {
+                    broadcast_result(cpu, cpu->afu.op.base_dest, cpu->afu.op.src1_value + 4, 0);
+                }
                 break;
-            
+
             case OPCODE_STORE:
-                //get rs1 and imm from lsq entry
-                cpu->afu.memory_address = cpu->afu.iq_entry.src1_value + cpu->afu.iq_entry.src2_value;
-                cpu->has_afu_data = TRUE;
-                cpu->afu_data.dest_data = cpu->afu.memory_address;
-                cpu->afu_data.physical_address = cpu->afu.iq_entry.dest;
-                        // = cpu->afu.rs1_value + cpu->afu.rs2_value;
-                cpu->memory_address = cpu->afu.memory_address;
-            
             case OPCODE_STOREP:
-            //get rs1 and imm from lsq entry
-                cpu->afu.memory_address = cpu->afu.iq_entry.src1_value + cpu->afu.iq_entry.literal;
-                cpu->has_afu_data = TRUE;
-                cpu->afu_data.dest_data = cpu->afu.memory_address;
-                cpu->afu_data.physical_address = cpu->afu.iq_entry.dest;
-                cpu->afu_data.updated_src_data = cpu->afu.iq_entry.src2_value + 4;
-                        // = cpu->afu.rs1_value + cpu->afu.imm;
-                cpu->memory_address = cpu->afu.memory_address;
-                //update src2 + 4
-                break;
-
-            case OPCODE_BZ:
-            case OPCODE_BNZ:
-            case OPCODE_BP:
-            case OPCODE_BNP:
-                //get imm from BQ entry
-                cpu->memory_address = cpu->afu.iq_entry.pc_address + cpu->afu.iq_entry.literal;
-                cpu->has_afu_data = TRUE;
-                cpu->afu_data.dest_data = cpu->afu.memory_address;
-                cpu->afu_data.physical_address = cpu->afu.iq_entry.dest;
-                // cpu->afu.pc + cpu->afu.imm;
-                break;
-
-            case OPCODE_JUMP:
-                //get imm from BQ entry
-                cpu->memory_address = cpu->afu.iq_entry.src1_value + cpu->afu.iq_entry.literal;
-                cpu->has_afu_data = TRUE;
-                cpu->afu_data.dest_data = cpu->afu.memory_address;
-                cpu->afu_data.physical_address = cpu->afu.iq_entry.dest;
-                // cpu->afu.rs1_value + cpu->afu.imm;
-                break;
-            
-            case OPCODE_JALR:
-                //get imm from BQ entry
-                cpu->memory_address = cpu->afu.iq_entry.pc_address + 4;
-                cpu->has_afu_data = TRUE;
-                cpu->afu_data.dest_data = cpu->afu.memory_address;
-                cpu->afu_data.physical_address = cpu->afu.iq_entry.dest;
-                // cpu->execute.pc + 4;
+                entry->memoryAddress = cpu->afu.op.src2_value + cpu->afu.op.literal;
+                entry->srcData = cpu->afu.op.src1_value;
+                entry->srcDataValidBit = 1;
+                if (cpu->afu.op.opcode == OPCODE_STOREP) {
+                    broadcast_result(cpu, cpu->afu.op.base_dest, cpu->afu.op.src2_value + 4, 0);
+                }
                 break;
-            
         }
-
-        /* for (int i = 0; i < cpu->iq_size; ++i) {
-            afu_entry = &cpu->iq_stage.entries[i];
-
-            // Check if the instruction is ready to be issued
-            if (iq_entry->is_ready) {
-                // Issue the instruction to the AFU
-                cpu->afu = cpu->afu_entry;
-                cpu->afu_stage.has_insn = TRUE;
-
-            }
-            // Reset readiness status for the IQ entry
-            iq_entry->is_ready = FALSE;
-        }*/
-
-        cpu->rob = cpu->afu;
+        entry->validBitMemoryAddress = 1;
+        cpu->afu.memory_address = entry->memoryAddress;
+        log_rob_event(cpu, cpu->afu.op.rob_index, EVENT_ADDRESS);
         cpu->afu.has_insn = FALSE;
-        
 
-        if (ENABLE_DEBUG_MESSAGES)
+        if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_STAGE))
         {
-            display_stage_content("AFU/RF", &cpu->decode);
-        }
+            display_stage_content(cpu, "AFU/RF", &cpu->afu);
         }
+    }
 }
 
 static void APEX_BFU(APEX_CPU *cpu) {
     if(cpu->bfu.has_insn) {
-        int opcode = 0;
-        switch(opcode) {
-            case OPCODE_BP:
-            {
-                cpu->branch_target_buffer[cpu->bfu.btb_index].target_address = cpu->memory_address;
-                printf("BP positiveflag %d", cpu->positive_flag);
-                if (cpu->positive_flag == TRUE)
-                {
-                    switch (cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction) {
-                    case 0:
-                        do_branching(cpu);
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 1;
-                        break;
-                    case 1:
-                        if(cpu->bfu.is_btb_hit == 0) {
-                            do_branching(cpu);
-                        } else {
-                            cpu->decode.has_insn = TRUE;
-                        }
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 11;
-                        break;
-                    case 11:
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 11;
-                        cpu->decode.has_insn = TRUE;
-                        break;
-                    default:
-                        break;
-                }
-                } else if(cpu->bfu.is_btb_hit == 1){
-                    switch (cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction) {
-                    case 0:
-                        break;
-                    case 1:
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 0;
-                        break;
-                    case 11:
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 1;
-                        break;
-                    default:
-                        break;
-                    }
-                    cpu->pc = cpu->branch_target_buffer[cpu->bfu.btb_index].pc_address + 4;
-                    cpu->decode.has_insn = FALSE;
-                    cpu->fetch_from_next_cycle = TRUE;
-                    cpu->fetch.has_insn = TRUE;
-                }
-                cpu->has_bfu_data[cpu->bfu.bq_bfu.dest] = TRUE;
-                //cpu->bfu_data[cpu->bfu.bq_bfu.dest].is_allocated = TRUE;
-                //cpu->bfu_data[cpu->bfu.bq_bfu.dest].physical_address = cpu->bfu.bq_bfu.dest;
-                break;
-            }
+        Issued_Op *op = &cpu->bfu.op;
+        int next_pc = op->pc_address + 4;
+        /* A BTB target may be stale, compare with the path fetch took */
+        int predicted_pc = cpu->bfu.predicted_pc;
 
+        switch(op->opcode) {
+            case OPCODE_BZ:
             case OPCODE_BNZ:
-            {
-                cpu->branch_target_buffer[cpu->bfu.btb_index].target_address = cpu->memory_address;
-                printf("BNZ zeroflag %d", cpu->zero_flag);
-                if (cpu->zero_flag == FALSE)
-                {
-                    switch (cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction) {
-                    case 0:
-                        do_branching(cpu);
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 1;
-                        break;
-                    case 1:
-                        if(cpu->bfu.is_btb_hit == 0) {
-                            do_branching(cpu);
-                        } else {
-                            cpu->decode.has_insn = TRUE;
-                        }
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 11;
-                        break;
-                    case 11:
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 11;
-                        cpu->decode.has_insn = TRUE;
-                        break;
-                    default:
-                        break;
-                }
-                } else if(cpu->bfu.is_btb_hit == 1){
-                    switch (cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction) {
-                    case 0:
-                        break;
-                    case 1:
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 0;
-                        break;
-                    case 11:
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 1;
-                        break;
-                    default:
-                        break;
-                    }
-                    cpu->pc = cpu->branch_target_buffer[cpu->bfu.btb_index].pc_address + 4;
-                    cpu->decode.has_insn = FALSE;
-                    cpu->fetch_from_next_cycle = TRUE;
-                    cpu->fetch.has_insn = TRUE;
-                }
-                cpu->has_bfu_data[cpu->bfu.bq_bfu.dest] = TRUE;
-                //cpu->bfu_data[cpu->bfu.bq_bfu.dest].is_allocated = TRUE;
-                //cpu->bfu_data[cpu->bfu.bq_bfu.dest].physical_address = cpu->bfu.bq_bfu.dest;
-                break;
-            }
-
+            case OPCODE_BP:
             case OPCODE_BNP:
+            case OPCODE_BN:
+            case OPCODE_BNN:
             {
-                cpu->branch_target_buffer[cpu->bfu.btb_index].target_address = cpu->memory_address;
-                printf("BNP positiveflag %d", cpu->positive_flag);
-                if (cpu->positive_flag == FALSE)
-                {
-                    switch (cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction) {
-                    case 0:
-                        do_branching(cpu);
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 1;
-                        break;
-                    case 1:
-                        do_branching(cpu);
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 11;
-                        break;
-                    case 11:
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 11;
-                        cpu->decode.has_insn = TRUE;
-                        break;
-                    default:
-                        break;
-                }
-                } else if(cpu->bfu.is_btb_hit == 1){
-                    switch (cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction) {
-                        case 0:
-                            break;
-                        case 1:
-                            cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 0;
-                            break;
-                        case 11:
-                            cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 1;
-                            break;
-                        default:
-                            break;
-                    }
-                    cpu->pc = cpu->branch_target_buffer[cpu->bfu.btb_index].pc_address + 4;
-                    cpu->decode.has_insn = FALSE;
-                    cpu->fetch_from_next_cycle = TRUE;
-                    cpu->fetch.has_insn = TRUE;
-                }
-                cpu->has_bfu_data[cpu->bfu.bq_bfu.dest] = TRUE;
-                //cpu->bfu_data[cpu->bfu.bq_bfu.dest].is_allocated = TRUE;
-                //cpu->bfu_data[cpu->bfu.bq_bfu.dest].physical_address = cpu->bfu.bq_bfu.dest;
-                break;
-            }
-
-            case OPCODE_BZ:
-            {
-                cpu->branch_target_buffer[cpu->bfu.btb_index].target_address = cpu->memory_address;
-                printf("BZ zeroflag %d", cpu->zero_flag);
-              if (cpu->zero_flag == TRUE) 
-                {
-                    switch (cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction) {
-                    case 0:
-                        do_branching(cpu);
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 1;
-                        break;
-                    case 1:
-                        do_branching(cpu);
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 11;
-                        break;
-                    case 11:
-                        cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 11;
-                        cpu->decode.has_insn = TRUE;
-                        break;
-                    default:
-                        break;
-                }
-                } else if(cpu->bfu.is_btb_hit == 1){
-                    switch (cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction) {
-                        case 0:
-                            break;
-                        case 1:
-                            cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 0;
-                            break;
-                        case 11:
-                            cpu->branch_target_buffer[cpu->bfu.btb_index].branch_prediction = 1;
-                            break;
-                        default:
-                            break;
-                    }
-                    cpu->pc = cpu->branch_target_buffer[cpu->bfu.btb_index].pc_address + 4;
-                    cpu->decode.has_insn = FALSE;
-                    cpu->fetch_from_next_cycle = TRUE;
-                    cpu->fetch.has_insn = TRUE;
+                TRACE(&cpu->trace, APEX_VERBOSITY_STAGE, "%s flags %d\n",
+                      get_opcode_str(op->opcode), op->src1_value);
+                if (branch_taken(op->opcode, op->src1_value)) {
+                    next_pc = op->pc_address + op->literal;
+                    cpu->ROB_queue.rob_entries[op->rob_index].taken = TRUE;
+                    btb_update(&cpu->btb, op->pc_address, next_pc);
                 }
-                cpu->has_bfu_data[cpu->bfu.bq_bfu.dest] = TRUE;
-                //cpu->bfu_data[cpu->bfu.bq_bfu.dest].is_allocated = TRUE;
-                //cpu->bfu_data[cpu->bfu.bq_bfu.dest].physical_address = cpu->bfu.bq_bfu.dest;
                 break;
             }
 
             case OPCODE_JALR:
             {
-                /* Calculate new PC, and send it to fetch unit */
-                cpu->bfu.result_buffer = cpu->memory_address;
-                // cpu->pc = cpu->regs[cpu->execute.rs1] + cpu->execute.imm;
-                cpu->pc = cpu->memory_address;
-
-                // Forwarding
-                //cpu->bfu_data_forward.physical_address = cpu->bfu_data.physical_address;
-                //cpu->bfu_data_forward.data = cpu->bfu.result_buffer;
-                //cpu->bfu_data_forward.is_allocated = TRUE;
-
-                //cpu->bfu.result_buffer = cpu->bfu.bq_bfu.src1_value | cpu->bfu.bq_bfu.src2_value;
-                /* cpu->has_bfu_data[cpu->bfu.bq_bfu.dest] = TRUE;
-                cpu->bfu_data[cpu->bfu.bq_bfu.dest].physical_address = cpu->bfu.bq_bfu.dest;
-                cpu->bfu_data[cpu->bfu.bq_bfu.dest].dest_data = cpu->bfu.result_buffer;
-                cpu->bfu_data[cpu->bfu.bq_bfu.dest].is_allocated = TRUE;*/
-
-
-                /* Since we are using reverse callbacks for pipeline stages, 
-                * this will prevent the new instruction from being fetched in the current cycle*/
-                cpu->fetch_from_next_cycle = TRUE;
-
-                /* Flush previous stages */
-                cpu->decode.has_insn = FALSE;
-
-                /* Make sure fetch stage is enabled to start fetching from new PC */
-                cpu->fetch.has_insn = TRUE;
+                /* Link register gets the return address */
+                broadcast_result(cpu, op->dest, op->pc_address + 4, 0);
+                next_pc = op->src1_value + op->literal;
+                btb_update(&cpu->btb, op->pc_address, next_pc);
                 break;
             }
 
             case OPCODE_JUMP:
             {
-                /* Calculate new PC, and send it to fetch unit */
-                cpu->bfu.result_buffer = cpu->memory_address;
-                cpu->pc = cpu->memory_address;
-                printf("New addres %d\n", cpu->bfu.result_buffer);
-
-                //cpu->bfu.result_buffer = cpu->bfu.bq_bfu.src1_value | cpu->bfu.bq_bfu.src2_value;
-                /*cpu->has_bfu_data[cpu->bfu.bq_bfu.dest] = TRUE;
-                cpu->bfu_data[cpu->bfu.bq_bfu.dest].is_allocated = TRUE;
-                cpu->bfu_data[cpu->bfu.bq_bfu.dest].dest_data = cpu->bfu.result_buffer;
-                cpu->bfu_data[cpu->bfu.bq_bfu.dest].physical_address = cpu->bfu.bq_bfu.dest;*/
-
-
-                /* Since we are using reverse callbacks for pipeline stages, 
-                * this will prevent the new instruction from being fetched in the current cycle*/
-                cpu->fetch_from_next_cycle = TRUE;
-
-                /* Flush previous stages */
-                cpu->decode.has_insn = FALSE;
-
-                /* Make sure fetch stage is enabled to start fetching from new PC */
-                cpu->fetch.has_insn = TRUE;
+                next_pc = op->src1_value + op->literal;
+                TRACE(&cpu->trace, APEX_VERBOSITY_STAGE, "New addres %d\n", next_pc);
                 break;
             }
-
         }
-        cpu->rob = cpu->bfu;
+
+        cpu->ROB_queue.rob_entries[op->rob_index].target_address = next_pc;
+        cpu->bfu.result_buffer = next_pc;
+        complete_rob_entry(cpu, op->rob_index);
         cpu->bfu.has_insn = FALSE;
 
-        if (ENABLE_DEBUG_MESSAGES)
+        /* Fetch went the wrong way, squash what came after the branch */
+        if (next_pc != predicted_pc) {
+            cpu->ROB_queue.rob_entries[op->rob_index].mispredicted = 1;
+            recover_branch(cpu, op->rob_index, next_pc);
+        } else {
+            cpu->rename_checkpoints[cpu->bfu.checkpoint].seq = -1;
+        }
+
+        if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_STAGE))
         {
-            display_stage_content("BFU", &cpu->bfu);
+            display_stage_content(cpu, "BFU", &cpu->bfu);
         }
     }
 }
 
 
+/*
+ * The multiplier is a pipeline of config.mul_latency stages. The MUL in the
+ * last stage broadcasts its result, the others advance one stage, and the
+ * first stage is free again for the IQ to issue a new MUL this cycle.
+ */
 static void APEX_MulFu(APEX_CPU *cpu) {
-    cpu->has_mulfu_data[cpu->mulfu.iq_mulfu.dest] = FALSE;
-    if(cpu->mulfu.has_insn) {
-        int opcode = cpu->mulfu.iq_mulfu.opcode;
-    switch(opcode) {
-        case OPCODE_MUL:
+    int last = cpu->config.mul_latency - 1;
+    CPU_Stage *done = mul_stage(cpu, last);
+
+    if(done->has_insn) {
+        done->result_buffer = done->op.src1_value * done->op.src2_value;
+        broadcast_result(cpu, done->op.dest, done->result_buffer,
+                         flags_of(done->result_buffer));
+        complete_rob_entry(cpu, done->op.rob_index);
+        TRACE(&cpu->trace, APEX_VERBOSITY_STAGE, "output is %d \n",done->result_buffer);
+
+        done->has_insn = FALSE;
+
+        if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_STAGE))
         {
-            cpu->mulfu.result_buffer = cpu->mulfu.iq_mulfu.src1_value * cpu->mulfu.iq_mulfu.src2_value;
-            cpu->has_mulfu_data[cpu->mulfu.iq_mulfu.dest] = TRUE;
-            cpu->mulfu_data[cpu->mulfu.iq_mulfu.dest].is_allocated = TRUE;
-            cpu->mulfu_data[cpu->mulfu.iq_mulfu.dest].dest_data = cpu->mulfu.result_buffer;
-            cpu->mulfu_data[cpu->mulfu.iq_mulfu.dest].physical_address = cpu->mulfu.iq_mulfu.dest;
-            if (cpu->mulfu.result_buffer == 0) {
-                cpu->zero_flag = TRUE;
-                cpu->mulfu_data[cpu->mulfu.iq_mulfu.dest].zero_flag = cpu->zero_flag;
-            } else {
-                cpu->zero_flag = FALSE;
-                cpu->mulfu_data[cpu->mulfu.iq_mulfu.dest].zero_flag = cpu->zero_flag;
-            }
-            if(cpu->mulfu.result_buffer > 0) {
-                cpu->positive_flag = TRUE;
-                cpu->mulfu_data[cpu->mulfu.iq_mulfu.dest].positive_flag = cpu->positive_flag;
-            } else {
-                cpu->positive_flag = FALSE;
-                cpu->mulfu_data[cpu->mulfu.iq_mulfu.dest].positive_flag = cpu->positive_flag;
-            }
-                // = cpu->mulfu.rs1_value * cpu->mulfu.rs2_value;
-            /* Set the zero flag based on the result buffer */
-            // set_branch_flags(cpu);
-            // update_stalling_flags(cpu);
-            printf("output is %d \n",cpu->mulfu.result_buffer);
-            break;
-            }
+            display_stage_content(cpu, "MulFu", done);
+        }
     }
 
-    cpu->rob = cpu->mulfu;
-    cpu->mulfu.has_insn = FALSE;
+    for (int k = last; k > 0; k--) {
+        CPU_Stage *prev = mul_stage(cpu, k - 1);
 
-    if (ENABLE_DEBUG_MESSAGES)
-    {
-        printf("%-15s: pc(%d) ", "MulFu", cpu->pc - 4);
-        {
-            printf("%s,P%d,P%d,P%d ", "Mul", cpu->mulfu.iq_mulfu.dest, cpu->mulfu.iq_mulfu.src1_tag,
-                   cpu->mulfu.iq_mulfu.src2_tag);
+        if (prev->has_insn) {
+            *mul_stage(cpu, k) = *prev;
+            prev->has_insn = FALSE;
+
+            if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_STAGE))
+            {
+                char name[24];
+
+                snprintf(name, sizeof(name), "MulFu/%d", k + 1);
+                display_stage_content(cpu, name, mul_stage(cpu, k));
+            }
         }
-        printf("\n");
     }
 }
-}
 
 static void APEX_MAU(APEX_CPU *cpu) {
-    cpu->has_mau_data = FALSE;
     if(cpu->mau.has_insn) {
-    int opcode = cpu->lsq.entries[cpu->lsq.rear].opcode;
-    switch(opcode) {
-        case OPCODE_LOAD:
-        case OPCODE_LOADP:
-        {
+        unsigned int address = (unsigned int)cpu->mau.memory_address;
 
-            cpu->has_mau_data = TRUE;
-            cpu->mau_data.physical_address = cpu->mau.iq_entry.dest;
-                /* Read from data memory */
-            cpu->mau.result_buffer
-                = cpu->data_memory[cpu->memory_address];
-                cpu->mau_data.dest_data = cpu->mau.result_buffer;
-            // cpu->memory.data_forward = cpu->memory.result_buffer;
-            // printf("loadp %d", cpu->memory.data_forward);
-            break;
+        /* Loads and stores stay here until the L1D has the line */
+        if (--cpu->mau_wait > 0) {
+            cpu->stalls[STALL_MAU_BUSY]++;
+            return;
+        }
+        if (cpu->mau_fill) {
+            cache_fill(&cpu->dcache, address,
+                       cpu->mau.opcode == OPCODE_STORE || cpu->mau.opcode == OPCODE_STOREP);
         }
 
-        case OPCODE_STORE:
-        case OPCODE_STOREP:
-        {
-            /* Read from data memory */
-            cpu->data_memory[cpu->memory_address] = cpu->mau.dqLsq.srcTag;
-            break;
+        if (cpu->mau.opcode == OPCODE_STORE || cpu->mau.opcode == OPCODE_STOREP) {
+            ROB_Entries *rob_entry = &cpu->ROB_queue.rob_entries[cpu->mau.op.rob_index];
+
+            rob_entry->store_address = address;
+            rob_entry->store_data = cpu->mau.rs1_value;
         }
-    }
-    cpu->rob = cpu->mau;
-    cpu->mau.has_insn = FALSE;
 
-    if (ENABLE_DEBUG_MESSAGES)
-    {
-        display_stage_content("MAU", &cpu->mau);
-    }
+        if (address >= DATA_MEMORY_SIZE) {
+            cpu->ROB_queue.rob_entries[cpu->mau.op.rob_index].memory_error_code = 1;
+            cpu->mau.result_buffer = 0;
+        } else {
+            switch(cpu->mau.opcode) {
+                case OPCODE_LOAD:
+                case OPCODE_LOADP:
+                {
+                    /* Read from data memory */
+                    cpu->mau.result_buffer = cpu->data_memory[address];
+                    break;
+                }
+
+                case OPCODE_STORE:
+                case OPCODE_STOREP:
+                {
+                    /* Write to data memory */
+                    cpu->data_memory[address] = cpu->mau.rs1_value;
+                    break;
+                }
+            }
+        }
+
+        /* Loads broadcast even after a bad address so consumers do not hang */
+        if (cpu->mau.opcode == OPCODE_LOAD || cpu->mau.opcode == OPCODE_LOADP) {
+            broadcast_result(cpu, cpu->mau.op.dest, cpu->mau.result_buffer, 0);
+        }
+        complete_rob_entry(cpu, cpu->mau.op.rob_index);
+        cpu->mau.has_insn = FALSE;
+
+        if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_STAGE))
+        {
+            display_stage_content(cpu, "MAU", &cpu->mau);
+        }
     }
 }
 
 static void APEX_IntFu(APEX_CPU *cpu) {
-    cpu->has_intfu_data[cpu->intfu.iq_intfu.dest] = FALSE;
     if(cpu->intfu.has_insn) {
-        int opcode = cpu->intfu.iq_intfu.opcode;
-        switch(opcode) {
-            case OPCODE_ADD:
-            {
-                    cpu->intfu.result_buffer = cpu->intfu.iq_intfu.src1_value + cpu->intfu.iq_intfu.src2_value;
-                    cpu->has_intfu_data[cpu->intfu.iq_intfu.dest] = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].is_allocated = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].dest_data = cpu->intfu.result_buffer;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].physical_address = cpu->intfu.iq_intfu.dest;
-                    // = cpu->execute.rs1_value + cpu->execute.rs2_value;
-                    /* Set the zero flag based on the result buffer */
-                    set_branch_flags(cpu);
-                    // cpu->intfu.data_forward = cpu->intfu.result_buffer;
-                    // update_stalling_flags(cpu);
-                    printf("output is %d \n",cpu->intfu.result_buffer);
-                break;
-            }
-
-            case OPCODE_DIV:
-            {
-                    cpu->intfu.result_buffer = cpu->intfu.iq_intfu.src1_value / cpu->intfu.iq_intfu.src2_value;
-                    cpu->has_intfu_data[cpu->intfu.iq_intfu.dest] = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].is_allocated = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].dest_data = cpu->intfu.result_buffer;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].physical_address = cpu->intfu.iq_intfu.dest;
-                    // = cpu->execute.rs1_value / cpu->execute.rs2_value;
-                    // cpu->intfu.data_forward = cpu->intfu.result_buffer;
-                    /* Set the zero flag based on the result buffer */
-                    set_branch_flags(cpu);
-                    // update_stalling_flags(cpu);
-                    printf("output is %d \n",cpu->intfu.result_buffer);
-                break;
-            }
+        Issued_Op *op = &cpu->intfu.op;
+        int result = 0;
 
-            case OPCODE_ADDL:
-            {
-                    cpu->intfu.result_buffer = cpu->intfu.iq_intfu.src1_value + cpu->intfu.iq_intfu.literal;
-                    cpu->has_intfu_data[cpu->intfu.iq_intfu.dest] = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].is_allocated = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].dest_data = cpu->intfu.result_buffer;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].physical_address = cpu->intfu.iq_intfu.dest;
-                    // = cpu->execute.rs1_value + cpu->execute.imm;
-                    // cpu->intfu.data_forward = cpu->intfu.result_buffer;
-                    /* Set the zero flag based on the result buffer */
-                    set_branch_flags(cpu);
-                    // if(cpu->execute.rd != cpu->execute.rs1) {
-                    //     cpu->scoreBoarding[cpu->execute.rs1] = 0;
-                    // } else {
-                    //     cpu->scoreBoarding[cpu->execute.rs1] = 1;
-                    // }
-                    printf("output is %d \n",cpu->intfu.result_buffer);
+        switch(op->opcode) {
+            case OPCODE_ADD:
+                result = op->src1_value + op->src2_value;
                 break;
-            }
 
             case OPCODE_SUB:
-            {
-                    cpu->intfu.result_buffer = cpu->intfu.iq_intfu.src1_value - cpu->intfu.iq_intfu.src2_value;
-                    cpu->has_intfu_data[cpu->intfu.iq_intfu.dest] = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].is_allocated = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].dest_data = cpu->intfu.result_buffer;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].physical_address = cpu->intfu.iq_intfu.dest;
-                    // = cpu->execute.rs1_value - cpu->execute.rs2_value;
-                    // cpu->intfu.data_forward = cpu->intfu.result_buffer;
-                    /* Set the zero flag based on the result buffer */
-                    set_branch_flags(cpu);
-                    // update_stalling_flags(cpu);
-                    printf("output is %d \n",cpu->intfu.result_buffer);
+            case OPCODE_CMP:
+                result = op->src1_value - op->src2_value;
                 break;
-            }
 
-            case OPCODE_SUBL:
-            {
-                    cpu->intfu.result_buffer = cpu->intfu.iq_intfu.src1_value - cpu->intfu.iq_intfu.literal;
-                    cpu->has_intfu_data[cpu->intfu.iq_intfu.dest] = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].is_allocated = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].dest_data = cpu->intfu.result_buffer;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].physical_address = cpu->intfu.iq_intfu.dest;
-                    // = cpu->execute.rs1_value - cpu->execute.imm;
-                    // cpu->intfu.data_forward = cpu->intfu.result_buffer;
-                    /* Set the zero flag based on the result buffer */
-                    set_branch_flags(cpu);
-                    // if(cpu->execute.rd != cpu->execute.rs1) {
-                    //     cpu->scoreBoarding[cpu->execute.rs1] = 0;
-                    // } else {
-                    //     cpu->scoreBoarding[cpu->execute.rs1] = 1;
-                    // }
-                    printf("output is %d \n",cpu->intfu.result_buffer);
+            case OPCODE_DIV:
+                result = APEX_DIV(op->src1_value, op->src2_value);
                 break;
-            }
-
-            
 
             case OPCODE_AND:
-            {
-                    cpu->intfu.result_buffer = cpu->intfu.iq_intfu.src1_value & cpu->intfu.iq_intfu.src2_value;
-                    cpu->has_intfu_data[cpu->intfu.iq_intfu.dest] = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].is_allocated = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].dest_data = cpu->intfu.result_buffer;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].physical_address = cpu->intfu.iq_intfu.dest;
-                    // = cpu->execute.rs1_value & cpu->execute.rs2_value;
-                    // cpu->intfu.data_forward = cpu->intfu.result_buffer;
-                    /* Set the zero flag based on the result buffer */
-                    set_branch_flags(cpu);
-                    // update_stalling_flags(cpu);
-                    printf("output is %d \n",cpu->intfu.result_buffer);
+                result = op->src1_value & op->src2_value;
                 break;
-            }
 
             case OPCODE_OR:
-            {
-                    cpu->intfu.result_buffer = cpu->intfu.iq_intfu.src1_value | cpu->intfu.iq_intfu.src2_value;
-                    cpu->has_intfu_data[cpu->intfu.iq_intfu.dest] = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].is_allocated = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].dest_data = cpu->intfu.result_buffer;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].physical_address = cpu->intfu.iq_intfu.dest;
-                    // = cpu->execute.rs1_value | cpu->execute.rs2_value;
-                    // cpu->intfu.data_forward = cpu->intfu.result_buffer;
-                    /* Set the zero flag based on the result buffer */
-                    set_branch_flags(cpu);
-                    // update_stalling_flags(cpu);
-                    printf("output is %d \n",cpu->intfu.result_buffer);
+                result = op->src1_value | op->src2_value;
                 break;
-            }
 
             case OPCODE_XOR:
-            {
-                    cpu->execute.result_buffer = cpu->intfu.iq_intfu.src1_value ^ cpu->intfu.iq_intfu.src2_value;
-                    cpu->has_intfu_data[cpu->intfu.iq_intfu.dest] = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].is_allocated = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].dest_data = cpu->intfu.result_buffer;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].physical_address = cpu->intfu.iq_intfu.dest;
-                    // = cpu->execute.rs1_value ^ cpu->execute.rs2_value;
-                    cpu->intfu.data_forward = cpu->intfu.result_buffer;
-                    /* Set the zero flag based on the result buffer */
-                    set_branch_flags(cpu);
-                    // update_stalling_flags(cpu);
-                    printf("output is %d \n",cpu->intfu.result_buffer);
+                result = op->src1_value ^ op->src2_value;
                 break;
-            }
 
+            case OPCODE_ADDL:
+                result = op->src1_value + op->literal;
+                break;
 
-            case OPCODE_MOVC: 
-            {
-                cpu->intfu.result_buffer = cpu->intfu.iq_intfu.literal + 0;
-                cpu->has_intfu_data[cpu->intfu.iq_intfu.dest] = TRUE;
-                cpu->intfu_data[cpu->intfu.iq_intfu.dest].is_allocated = TRUE;
-                cpu->intfu_data[cpu->intfu.iq_intfu.dest].dest_data = cpu->intfu.result_buffer;
-                cpu->intfu_data[cpu->intfu.iq_intfu.dest].physical_address = cpu->intfu.iq_intfu.dest;
-                // cpu->intfu.data_forward = cpu->intfu.result_buffer;
+            case OPCODE_SUBL:
+            case OPCODE_CML:
+                result = op->src1_value - op->literal;
                 break;
-            }
 
-            case OPCODE_NOP:
-            {
+            case OPCODE_MOVC:
+                result = op->literal;
                 break;
-            }
+        }
 
-            case OPCODE_CMP:
-            {
-                if(cpu->intfu.iq_intfu.src1_value > cpu->intfu.iq_intfu.src2_value) {
-                    cpu->positive_flag = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].positive_flag = cpu->positive_flag;
-                } else {
-                    cpu->positive_flag = FALSE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].positive_flag = cpu->positive_flag;
-                }
-                if(cpu->intfu.iq_intfu.src1_value == cpu->intfu.iq_intfu.src2_value) {
-                    cpu->zero_flag = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].zero_flag = cpu->zero_flag;
-                } else {
-                    cpu->zero_flag = FALSE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].zero_flag = cpu->zero_flag;
-                }
-                break;   
-            }
+        cpu->intfu.result_buffer = result;
+        broadcast_result(cpu, op->dest, result, flags_of(result));
+        complete_rob_entry(cpu, op->rob_index);
+        TRACE(&cpu->trace, APEX_VERBOSITY_STAGE, "output is %d \n",cpu->intfu.result_buffer);
 
-            case OPCODE_CML:
-            {
-                if(cpu->intfu.iq_intfu.src1_value > cpu->intfu.iq_intfu.literal) {
-                    cpu->positive_flag = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].positive_flag = cpu->positive_flag;
-                } else {
-                    cpu->positive_flag = FALSE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].positive_flag = cpu->positive_flag;
-                }
-                if(cpu->intfu.iq_intfu.src1_value == cpu->intfu.iq_intfu.literal) {
-                    cpu->zero_flag = TRUE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].zero_flag = cpu->zero_flag;
-                } else {
-                    cpu->zero_flag = FALSE;
-                    cpu->intfu_data[cpu->intfu.iq_intfu.dest].zero_flag = cpu->zero_flag;
-                }
-                break;   
-            }
-        }
-        cpu->rob = cpu->intfu;
         cpu->intfu.has_insn = FALSE;
 
-        if (ENABLE_DEBUG_MESSAGES)
+        if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_STAGE))
         {
-            display_stage_content("IntFu", &cpu->intfu);
+            display_stage_content(cpu, "IntFu", &cpu->intfu);
         }
     }
 }
 
-
-void init_iq_stage(APEX_CPU *cpu) {
-    cpu->iq_stage.is_used = 0;
+/*
+ * Carves the arrays sized by cpu->config out of the single block 'arena'.
+ * With 'arena' NULL only the derived sizes and cpu->arena_size are set, so
+ * the caller can allocate the block. Every array starts on a cache line.
+ */
+void
+APEX_cpu_layout(APEX_CPU *cpu, void *arena)
+{
+    const APEX_Config *config = &cpu->config;
+    char *base = arena;
+    size_t offset = 0;
+
+    cpu->phys_regs = REG_FILE_SIZE + config->rename_regs;
+    cpu->iq_words = MASK_WORDS(config->iq_size);
+    cpu->bq_words = MASK_WORDS(config->bq_size);
+    /* btb-size is rounded down to whole sets */
+    cpu->btb.ways = config->btb_ways < config->btb_size ? config->btb_ways : config->btb_size;
+    cpu->btb.sets = config->btb_size / cpu->btb.ways;
+    cpu->ras.size = config->ras_size;
+    cpu->indirect.size = config->indirect_size;
+    cache_configure(&cpu->icache, config->icache_size, config->icache_ways,
+                    config->icache_line, CACHE_WRITE_BACK);
+    cache_configure(&cpu->dcache, config->dcache_size, config->dcache_ways,
+                    config->dcache_line, config->dcache_policy);
+
+#define CARVE(field, count)                                               \
+    do                                                                    \
+    {                                                                     \
+        cpu->field = base ? (void *)(base + offset) : NULL;               \
+        offset += ((count) * sizeof(*cpu->field) + 63) & ~(size_t)63;     \
+    } while (0)
+
+    CARVE(ROB_queue.rob_entries, config->rob_size);
+    CARVE(lsq.entries, config->lsq_size);
+    CARVE(btb.entries, cpu->btb.sets * cpu->btb.ways);
+    CARVE(physical_register, cpu->phys_regs);
+    CARVE(physical_queue, cpu->phys_regs);
+    CARVE(iq_entries, config->iq_size);
+    CARVE(bq, config->bq_size);
+    CARVE(iq_free, cpu->iq_words);
+    CARVE(iq_ready, cpu->iq_words);
+    CARVE(iq_waiting, cpu->phys_regs * cpu->iq_words);
+    CARVE(bq_free, cpu->bq_words);
+    CARVE(bq_ready, cpu->bq_words);
+    CARVE(bq_waiting, cpu->phys_regs * cpu->bq_words);
+    CARVE(iq_select, cpu->iq_words);
+    CARVE(iq_age, config->iq_size * cpu->iq_words);
+    CARVE(iq_fu, NUM_ISSUE_FU * cpu->iq_words);
+    CARVE(bq_age, config->bq_size * cpu->bq_words);
+    CARVE(decode, config->width);
+    CARVE(dispatch, config->width);
+    CARVE(mul_pipe, config->mul_latency - 1);
+    CARVE(bpred.bimodal, config->bpred_size);
+    CARVE(bpred.gshare, config->bpred_size);
+    CARVE(bpred.chooser, config->bpred_size);
+    CARVE(ras.stack, config->ras_size);
+    CARVE(ras.link, config->ras_size);
+    CARVE(indirect.entries, config->indirect_size);
+    CARVE(rename_checkpoints, config->branch_checkpoints);
+    CARVE(icache.lines, cpu->icache.sets * cpu->icache.ways);
+    CARVE(dcache.lines, cpu->dcache.sets * cpu->dcache.ways);
+#undef CARVE
+
+    cpu->arena = arena;
+    cpu->arena_size = offset;
 }
 
-void init_bq_stage(APEX_CPU *cpu) {
-    cpu->bq_stage.is_used = 0;
-}
 /*
  * This function creates and initializes APEX cpu.
  *
  * Note: You are free to edit this function according to your implementation
  */
 APEX_CPU *
-APEX_cpu_init(const char *filename)
+APEX_cpu_init(const char *filename, const APEX_Config *config)
 {
-    int i;
     APEX_CPU *cpu;
+    void *arena;
     if (!filename)
     {
         return NULL;
     }
 
+    /* Checkpoint images resume where the saved CPU stopped */
+    if (APEX_checkpoint_probe(filename))
+    {
+        return APEX_checkpoint_restore(filename);
+    }
+
     cpu = calloc(1, sizeof(APEX_CPU));
 
     if (!cpu)
@@ -2750,69 +2457,108 @@ APEX_cpu_init(const char *filename)
         return NULL;
     }
 
+    /* Size every structure from the configuration, defaults if none */
+    if (config)
+    {
+        cpu->config = *config;
+    }
+    else
+    {
+        config_init(&cpu->config);
+    }
+    APEX_cpu_layout(cpu, NULL);
+    arena = aligned_alloc(64, cpu->arena_size);
+    if (!arena)
+    {
+        free(cpu);
+        return NULL;
+    }
+    memset(arena, 0, cpu->arena_size);
+    APEX_cpu_layout(cpu, arena);
+
     /* Initialize PC, Registers and all pipeline stages */
     cpu->pc = 4000;
     memset(cpu->regs, 0, sizeof(int) * REG_FILE_SIZE);
     memset(cpu->data_memory, 0, sizeof(int) * DATA_MEMORY_SIZE);
     cpu->single_step = ENABLE_SINGLE_STEP;
 
-    /* Parse input file and create code memory */
-    cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size);
+    /* Map a pre-assembled image, or parse the input file, into code memory */
+    if (is_code_image(filename))
+    {
+        cpu->code_memory = map_code_image(filename, &cpu->code_memory_size,
+                                          &cpu->code_map, &cpu->code_map_size);
+    }
+    else
+    {
+        cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size);
+    }
     if (!cpu->code_memory)
     {
+        free(cpu->arena);
         free(cpu);
         return NULL;
     }
 
-    if (ENABLE_DEBUG_MESSAGES)
+    /* Output goes to stdout unbuffered until APEX_cpu_set_trace is called */
+    cpu->trace.fp = stdout;
+    cpu->trace.level = APEX_VERBOSITY_STAGE;
+    cpu->checkpoint_cycle = -1;
+
+    /* Latches read their operands through insn_index, see stage_insn() */
     {
-        fprintf(stderr,
-                "APEX_CPU: Initialized APEX CPU, loaded %d instructions\n",
-                cpu->code_memory_size);
-        fprintf(stderr, "APEX_CPU: PC initialized to %d\n", cpu->pc);
-        fprintf(stderr, "APEX_CPU: Printing Code Memory\n");
-        printf("%-9s %-9s %-9s %-9s %-9s\n", "opcode_str", "rd", "rs1", "rs2",
-               "imm");
+        CPU_Stage *stages[] = {
+            &cpu->fetch, &cpu->afu, &cpu->bfu, &cpu->mulfu, &cpu->mau,
+            &cpu->intfu, &cpu->rob,
+        };
 
-        for (i = 0; i < cpu->code_memory_size; ++i)
+        for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); i++)
+        {
+            stages[i]->insn_index = -1;
+        }
+        for (int i = 0; i < cpu->config.width; i++)
+        {
+            cpu->decode[i].insn_index = -1;
+            cpu->dispatch[i].insn_index = -1;
+        }
+        for (int i = 0; i < cpu->config.mul_latency - 1; i++)
         {
-            printf("%-9s %-9d %-9d %-9d %-9d\n", cpu->code_memory[i].opcode_str,
-                   cpu->code_memory[i].rd, cpu->code_memory[i].rs1,
-                   cpu->code_memory[i].rs2, cpu->code_memory[i].imm);
+            cpu->mul_pipe[i].insn_index = -1;
         }
     }
 
-    for(int i = 0; i < 4; i++) {
-        cpu->branch_target_buffer[i].target_address = 0;
-        cpu->branch_target_buffer[i].branch_prediction = 0;
-        cpu->branch_target_buffer[i].pc_address = 0;
-        cpu->branch_target_buffer[i].allocated = 0;
+    btb_init(&cpu->btb);
+    cache_init(&cpu->icache);
+    cache_init(&cpu->dcache);
+    ras_init(&cpu->ras);
+    indirect_init(&cpu->indirect);
+    bpred_init(&cpu->bpred, cpu->config.bpred, cpu->config.bpred_size,
+               cpu->config.bpred_history);
+
+    /* Architectural register i starts out in physical register i, the rest
+     * of the physical registers are free */
+    for(int i = 0; i < REG_FILE_SIZE; i++) {
+        cpu->rename_table[i] = i;
+        cpu->retirement_rat[i] = i;
+        cpu->physical_register[i].allocated = 1;
+        cpu->physical_register[i].valid_bit = 1;
     }
-    cpu->branch_target_buffer->branch_prediction = 00;
-
-    int length = sizeof(cpu->rename_table) / sizeof(cpu->rename_table[0]);
-    for(int i = 0; i < length; i++) {
-        cpu->rename_table[i] = -1;
+    for(int i = REG_FILE_SIZE; i < cpu->phys_regs; i++) {
+        free_physical_register(cpu, i);
     }
-
-    int physical_queue_length = sizeof(cpu->physical_queue) / sizeof(cpu->physical_queue[0]);
-    for(int i = 0; i <physical_queue_length; i++) {
-        cpu->physical_queue[i] = i;
+    cpu->cc_tag = -1;
+    for (int i = 0; i < cpu->config.branch_checkpoints; i++) {
+        cpu->rename_checkpoints[i].seq = -1;
     }
-    cpu->physical_queue_length = physical_queue_length;
-
-
-    cpu->bq_size = 0;
-    cpu->bq_index = 0;
-    cpu->iq_index = 0;
-    init_iq_stage(cpu);
-    init_bq_stage(cpu);
 
+    /* Every IQ and BQ entry starts out free */
+    for (int i = 0; i < cpu->config.iq_size; i++) {
+        mask_set(cpu->iq_free, i);
+    }
+    for (int i = 0; i < cpu->config.bq_size; i++) {
+        mask_set(cpu->bq_free, i);
+    }
 
     cpu->counter = 0;
-    cpu->index = 0;
-
-    cpu->forwarding_cycles = 0;
 
     cpu->ROB_queue.ROB_head = -1;
     cpu->ROB_queue.ROB_tail = -1;
@@ -2820,45 +2566,372 @@ APEX_cpu_init(const char *filename)
 
     /* To start fetch stage */
     cpu->fetch.has_insn = TRUE;
-    cpu->free_list = 24;
 
-    cpu->lsq.entries = (LSQEntry *)malloc(16 * sizeof(LSQEntry));
-    cpu->lsq.front = -1;
+    cpu->lsq.front = 0;
     cpu->lsq.rear = -1;
     cpu->lsq.numberOfEntries = 0;
     return cpu;
 }
 
+static const char *const stall_names[NUM_STALLS] = {
+    "fetch_redirect", "fetch_decode_busy", "fetch_icache_miss", "decode_free_list",
+    "decode_no_checkpoint", "decode_dispatch_busy", "dispatch_rob_full",
+    "dispatch_iq_full", "dispatch_bq_full", "dispatch_lsq_full",
+    "issue_not_ready", "issue_fu_busy", "branch_not_ready", "lsq_not_ready",
+    "mau_busy", "commit_not_complete", "commit_empty",
+};
+
+/* Name of a STALL_* reason, as used in reports and CSV headers */
+const char *
+APEX_stall_name(int reason)
+{
+    return stall_names[reason];
+}
+
+static const char *const cpi_names[NUM_CPI] = {
+    "retiring", "frontend", "bad_speculation", "memory", "core",
+};
+
+/* Name of a CPI_* category, as used in reports and CSV headers */
+const char *
+APEX_cpi_name(int category)
+{
+    return cpi_names[category];
+}
+
+/*
+ * Prints the CPI stack, the share of the commit slots of every category
+ * and the part of the CPI it accounts for, then the same as one
+ * "APEX_CPI: name=share ..." line for scripts.
+ */
+static void
+print_cpi_stack(APEX_CPU *cpu)
+{
+    long slots = 0;
+    double cpi = cpu->insn_completed > 0 ? (double)cpu->clock / cpu->insn_completed : 0.0;
+
+    for (int i = 0; i < NUM_CPI; i++)
+    {
+        slots += cpu->cpi_slots[i];
+    }
+
+    trace_printf(&cpu->trace, "APEX_CPU: CPI stack, %ld commit slots, CPI %.3f\n", slots, cpi);
+    for (int i = 0; i < NUM_CPI; i++)
+    {
+        double share = slots > 0 ? (double)cpu->cpi_slots[i] / slots : 0.0;
+
+        trace_printf(&cpu->trace, "  %-22s %10ld %6.1f%% %8.3f\n", cpi_names[i],
+                     cpu->cpi_slots[i], 100.0 * share, share * cpi);
+    }
+
+    trace_printf(&cpu->trace, "APEX_CPI:");
+    for (int i = 0; i < NUM_CPI; i++)
+    {
+        trace_printf(&cpu->trace, " %s=%.4f", cpi_names[i],
+                     slots > 0 ? (double)cpu->cpi_slots[i] / slots : 0.0);
+    }
+    trace_printf(&cpu->trace, "\n");
+}
+
+/* Prints the stall counters, as cycles and share of all cycles */
+static void
+print_stall_counters(APEX_CPU *cpu)
+{
+    trace_printf(&cpu->trace, "APEX_CPU: Stall cycles by reason\n");
+    for (int i = 0; i < NUM_STALLS; i++)
+    {
+        trace_printf(&cpu->trace, "  %-22s %10ld %6.1f%%\n", stall_names[i], cpu->stalls[i],
+                     cpu->clock > 0 ? 100.0 * cpu->stalls[i] / cpu->clock : 0.0);
+    }
+}
+
+/*
+ * Prints how well the direction predictor did on the committed conditional
+ * branches, per component for the tournament predictor, the flushes
+ * caused by all mispredicted branches and the instructions they squashed
+ */
+static void
+print_bpred_stats(APEX_CPU *cpu)
+{
+    const APEX_BPred *bp = &cpu->bpred;
+    double branches = bp->branches > 0 ? bp->branches : 1;
+
+    trace_printf(&cpu->trace, "APEX_CPU: %s predictor, %ld branches, %.2f%% predicted, "
+                 "%ld flushes, %ld squashed\n", bpred_name(bp->kind), bp->branches,
+                 100.0 * bp->correct / branches, cpu->branch_flushes,
+                 cpu->insn_squashed);
+    if (bp->kind == BPRED_TOURNAMENT)
+    {
+        trace_printf(&cpu->trace, "  %-22s %6.2f%%\n  %-22s %6.2f%%\n", "bimodal",
+                     100.0 * bp->bimodal_correct / branches, "gshare",
+                     100.0 * bp->gshare_correct / branches);
+    }
+
+    trace_printf(&cpu->trace, "APEX_CPU: JUMP/JALR targets by source\n");
+    for (int i = 0; i < NUM_TARGETS; i++)
+    {
+        trace_printf(&cpu->trace, "  %-22s %10ld %6.2f%%\n", bpred_target_name(i),
+                     bp->targets[i],
+                     bp->targets[i] > 0 ? 100.0 * bp->targets_correct[i] / bp->targets[i] : 0.0);
+    }
+}
+
+/* Prints the BTB lookups of fetch and the evictions of one branch by another */
+static void
+print_btb_stats(APEX_CPU *cpu)
+{
+    const APEX_BTB *btb = &cpu->btb;
+    long lookups = btb->hits + btb->misses;
+
+    trace_printf(&cpu->trace, "APEX_CPU: BTB %d x %d, %ld lookups, %.2f%% hits, "
+                 "%ld misses, %ld conflicts\n", btb->sets, btb->ways, lookups,
+                 lookups > 0 ? 100.0 * btb->hits / lookups : 0.0, btb->misses,
+                 btb->conflicts);
+}
+
+/* Prints the I-cache lookups of fetch and the fetch groups cut short at the
+ * end of a line, if there is an I-cache */
+static void
+print_icache_stats(APEX_CPU *cpu)
+{
+    const APEX_Cache *ic = &cpu->icache;
+    long accesses = ic->hits + ic->misses;
+
+    if (ic->sets == 0)
+    {
+        return;
+    }
+    trace_printf(&cpu->trace, "APEX_CPU: I-cache %d x %d x %d B, %ld lookups, %.2f%% hits, "
+                 "%ld misses, %ld evictions, %ld groups cut at a line end\n", ic->sets,
+                 ic->ways, ic->line_size, accesses,
+                 accesses > 0 ? 100.0 * ic->hits / accesses : 0.0, ic->misses,
+                 ic->evictions, cpu->fetch_line_breaks);
+}
+
+/* Prints the L1D accesses of the MAU and the lines they evicted, if there is
+ * an L1D */
+static void
+print_dcache_stats(APEX_CPU *cpu)
+{
+    const APEX_Cache *dc = &cpu->dcache;
+    long accesses = dc->hits + dc->misses;
+
+    if (dc->sets == 0)
+    {
+        return;
+    }
+    trace_printf(&cpu->trace, "APEX_CPU: L1D %d x %d x %d B %s, %ld accesses, %.2f%% hits, "
+                 "%ld misses, %ld evictions, %ld writebacks\n", dc->sets, dc->ways,
+                 dc->line_size, cache_policy_name(dc->policy), accesses,
+                 accesses > 0 ? 100.0 * dc->hits / accesses : 0.0, dc->misses,
+                 dc->evictions, dc->writebacks);
+}
+
+/* TRUE when fetch does nothing next cycle but wait for an I-cache fill */
+static int
+fetch_waiting(const APEX_CPU *cpu)
+{
+    return cpu->fetch.has_insn && !cpu->fetch_from_next_cycle
+           && cpu->decode_count == 0 && cpu->fetch_wait > 1;
+}
+
+/* TRUE when the MAU does nothing next cycle but wait for its L1D access */
+static int
+mau_waiting(const APEX_CPU *cpu)
+{
+    return cpu->mau.has_insn && cpu->mau_wait > 1;
+}
+
+/*
+ * Returns TRUE when no stage has work to do, i.e. stepping the CPU would do
+ * nothing but advance the clock until the next scheduled event.
+ */
+static int
+pipeline_is_idle(const APEX_CPU *cpu)
+{
+    return (!cpu->fetch.has_insn || fetch_waiting(cpu)) && cpu->decode_count == 0
+           && cpu->dispatch_count == 0
+           && mask_first(cpu->iq_ready, cpu->iq_words) < 0
+           && mask_first(cpu->bq_ready, cpu->bq_words) < 0
+           && !cpu->afu.has_insn && !cpu->bfu.has_insn
+           && !mul_pipe_busy(cpu) && !cpu->intfu.has_insn
+           && (cpu->mau.has_insn ? mau_waiting(cpu) : !lsq_head_ready(cpu))
+           && !(!isEmpty(cpu)
+                && cpu->ROB_queue.rob_entries[cpu->ROB_queue.ROB_head].completed);
+}
+
+/*
+ * Returns the clock cycle of the earliest fixed-latency event pending in the
+ * pipeline, or -1 if nothing is scheduled. The events are:
+ *  - a pending checkpoint, so that it is not skipped over
+ *  - the end of an L1D access the MAU waits for, mau_wait
+ *  - the end of an I-cache fill fetch waits for, fetch_wait
+ *
+ * Note: Every unit that waits out a latency on a countdown must register it
+ * here, treat the wait as idle in pipeline_is_idle() and charge its stall in
+ * fast_forward_idle_cycles(), or event-driven runs step through the whole
+ * wait. The multiplier advances its pipeline every cycle, so a busy one
+ * keeps the pipeline from being idle rather than scheduling an event.
+ */
+static int
+next_event_cycle(const APEX_CPU *cpu)
+{
+    int next = -1;
+
+    if (cpu->checkpoint_cycle > cpu->clock)
+    {
+        next = cpu->checkpoint_cycle;
+    }
+    /* The MAU finishes in the cycle its mau_wait counts down to zero */
+    if (mau_waiting(cpu)
+        && (next < 0 || cpu->clock + cpu->mau_wait - 1 < next))
+    {
+        next = cpu->clock + cpu->mau_wait - 1;
+    }
+    /* ... and so does an I-cache fill with fetch_wait */
+    if (fetch_waiting(cpu)
+        && (next < 0 || cpu->clock + cpu->fetch_wait - 1 < next))
+    {
+        next = cpu->clock + cpu->fetch_wait - 1;
+    }
+    return next;
+}
+
+/*
+ * Event-driven mode: jumps the clock of an idle pipeline straight to the next
+ * scheduled event, or to the simulate limit, so that cycle counts stay
+ * identical to stepping through every idle cycle.
+ *
+ * Returns FALSE when nothing is scheduled and there is no limit, the pipeline
+ * can never make progress again.
+ */
+static int
+fast_forward_idle_cycles(APEX_CPU *cpu)
+{
+    int target = next_event_cycle(cpu);
+    int skipped;
+
+    if (cpu->simulator_flag)
+    {
+        int limit = cpu->clock + (cpu->simulate_counter - cpu->counter);
+
+        if (target < 0 || limit < target)
+        {
+            target = limit;
+        }
+    }
+
+    if (target < 0)
+    {
+        return FALSE;
+    }
+
+    skipped = target - cpu->clock;
+    if (skipped <= 0)
+    {
+        return TRUE;
+    }
+
+    cpu->clock += skipped;
+    cpu->counter += skipped;
+    cpu->cycles_skipped += skipped;
+
+    /* Every skipped cycle would have stalled the same way, nothing is ready */
+    if (!mask_all_set(cpu->iq_free, cpu->config.iq_size))
+    {
+        cpu->stalls[STALL_ISSUE_NOT_READY] += skipped;
+    }
+    if (!mask_all_set(cpu->bq_free, cpu->config.bq_size))
+    {
+        cpu->stalls[STALL_BRANCH_NOT_READY] += skipped;
+    }
+    if (!isLSQEmpty(cpu) && !lsq_head_ready(cpu))
+    {
+        cpu->stalls[STALL_LSQ_NOT_READY] += skipped;
+    }
+    if (cpu->mau.has_insn)
+    {
+        cpu->mau_wait -= skipped;
+        cpu->stalls[STALL_MAU_BUSY] += skipped;
+    }
+    if (cpu->fetch.has_insn)
+    {
+        cpu->fetch_wait -= skipped;
+        cpu->stalls[STALL_FETCH_ICACHE_MISS] += skipped;
+    }
+    cpu->stalls[isEmpty(cpu) ? STALL_COMMIT_EMPTY : STALL_COMMIT_NOT_COMPLETE] += skipped;
+    cpu->cpi_slots[lost_slot_category(cpu)] += (long)skipped * cpu->config.width;
+
+    TRACE(&cpu->trace, APEX_VERBOSITY_CYCLE,
+          "APEX_CPU: Skipped %d idle cycles, clock advanced to %d\n", skipped,
+          cpu->clock);
+    return TRUE;
+}
+
+/* Saves the pending checkpoint, the run goes on whether or not it worked */
+static void
+save_checkpoint(APEX_CPU *cpu)
+{
+    cpu->checkpoint_cycle = -1;
+    if (APEX_checkpoint_save(cpu, cpu->checkpoint_file) != 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to save checkpoint %s\n",
+                cpu->checkpoint_file);
+        return;
+    }
+    TRACE(&cpu->trace, APEX_VERBOSITY_SUMMARY,
+          "APEX_CPU: Checkpoint saved to %s, cycles = %d instructions = %d\n",
+          cpu->checkpoint_file, cpu->clock, cpu->insn_completed);
+}
+
 /*
  * APEX CPU simulation loop
  *
+ * Returns one of APEX_RUN_HALTED, APEX_RUN_STOPPED or APEX_RUN_DEADLOCK
+ *
  * Note: You are free to edit this function according to your implementation
  */
-void
+int
 APEX_cpu_run(APEX_CPU *cpu)
 {
     char user_prompt_val;
+    int status = APEX_RUN_STOPPED;
+
+    if (cpu->clock == 0 && TRACE_ON(&cpu->trace, APEX_VERBOSITY_STAGE))
+    {
+        print_code_memory(cpu);
+    }
 
     while (TRUE)
     {
+        if (cpu->clock == cpu->checkpoint_cycle)
+        {
+            save_checkpoint(cpu);
+        }
         if(cpu->simulator_flag && cpu->counter >= cpu->simulate_counter) {
             break;
         }
-        if (ENABLE_DEBUG_MESSAGES)
+        if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_CYCLE))
         {
-            printf("--------------------------------------------\n");
-            printf("Clock Cycle #: %d\n", cpu->clock);
-            printf("--------------------------------------------\n");
-            printf("P %d \n", cpu->positive_flag);
-            printf("Z %d \n", cpu->zero_flag);
-            printf("N %d \n", cpu->negative_flag);
+            trace_printf(&cpu->trace, "--------------------------------------------\n");
+            trace_printf(&cpu->trace, "Clock Cycle #: %d\n", cpu->clock);
+            trace_printf(&cpu->trace, "--------------------------------------------\n");
+            trace_printf(&cpu->trace, "P %d \n", cpu->positive_flag);
+            trace_printf(&cpu->trace, "Z %d \n", cpu->zero_flag);
+            trace_printf(&cpu->trace, "N %d \n", cpu->negative_flag);
         }
 
         
         if (APEX_ROB(cpu))
         {
+            /* Instructions ahead of HALT may have retired this cycle */
+            if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_CYCLE))
+            {
+                print_reg_file(cpu);
+            }
+
             /* Halt in writeback stage */
-            printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
+            status = APEX_RUN_HALTED;
             break;
         }
         APEX_MAU(cpu);
@@ -2867,42 +2940,142 @@ APEX_cpu_run(APEX_CPU *cpu)
         APEX_BFU(cpu);
         APEX_MulFu(cpu);
         APEX_IntFu(cpu);
+        APEX_branch_queue(cpu);
         APEX_issue_queue(cpu);
         APEX_dispatch(cpu);
         APEX_decode(cpu);
         APEX_fetch(cpu);
 
-        for(int i = 0; i < 24; i++) {
-            cpu->has_intfu_data[i] = FALSE;
-            cpu->has_mulfu_data[i] = FALSE;
+        if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_CYCLE))
+        {
+            print_reg_file(cpu);
+            trace_printf(&cpu->trace, "P %d \n", cpu->positive_flag);
+            trace_printf(&cpu->trace, "Z %d \n", cpu->zero_flag);
+            trace_printf(&cpu->trace, "N %d \n", cpu->negative_flag);
         }
-        print_reg_file(cpu);
-        printf("P %d \n", cpu->positive_flag);
-        printf("Z %d \n", cpu->zero_flag);
-        printf("N %d \n", cpu->negative_flag);
 
         if (!cpu->simulator_flag && cpu->single_step)
         {
+            trace_flush(&cpu->trace);
             printf("Press any key to advance CPU Clock or <q> to quit:\n");
             scanf("%c", &user_prompt_val);
 
             if ((user_prompt_val == 'Q') || (user_prompt_val == 'q'))
             {
-                printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
                 break;
             }
         }
-        cpu->bq_index = 0;
-        cpu->bq_size = 0;
-        cpu->iq_index = 0;
-        cpu->iq_size = 0;
-
         cpu->clock++;
         cpu->counter++;
+
+        if (cpu->event_driven && pipeline_is_idle(cpu)
+            && !fast_forward_idle_cycles(cpu))
+        {
+            status = APEX_RUN_DEADLOCK;
+            break;
+        }
+    }
+
+    if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_SUMMARY))
+    {
+        print_stall_counters(cpu);
+        print_cpi_stack(cpu);
+        print_bpred_stats(cpu);
+        print_btb_stats(cpu);
+        print_icache_stats(cpu);
+        print_dcache_stats(cpu);
+        trace_printf(&cpu->trace, "APEX_CPU: Simulation %s, cycles = %d instructions = %d\n",
+                     status == APEX_RUN_HALTED ? "Complete"
+                     : status == APEX_RUN_DEADLOCK ? "Deadlocked" : "Stopped",
+                     cpu->clock, cpu->insn_completed);
+    }
+    trace_flush(&cpu->trace);
+    return status;
+}
+
+/*
+ * Copies the architectural registers into the physical registers they are
+ * committed in. Used after the functional emulator has updated cpu->regs.
+ */
+void
+APEX_cpu_seed_registers(APEX_CPU *cpu)
+{
+    for (int i = 0; i < REG_FILE_SIZE; i++)
+    {
+        Register_Rename *reg = &cpu->physical_register[cpu->retirement_rat[i]];
+
+        reg->data = cpu->regs[i];
+        reg->valid_bit = 1;
+    }
+}
+
+/*
+ * Redirects the CPU output to 'filename' (stdout when NULL) at the given
+ * APEX_VERBOSITY_* level. Single-step prompts are only kept when somebody
+ * is reading the per-cycle dump on stdout.
+ *
+ * Returns 0 on success, -1 if the trace file could not be opened.
+ */
+int
+APEX_cpu_set_trace(APEX_CPU *cpu, const char *filename, int level)
+{
+    trace_close(&cpu->trace);
+    if (trace_open(&cpu->trace, filename, level) != 0)
+    {
+        return -1;
+    }
+
+    cpu->single_step = ENABLE_SINGLE_STEP && !filename
+                       && level >= APEX_VERBOSITY_CYCLE;
+    return 0;
+}
+
+/*
+ * Starts logging pipeline events of the instructions fetched from now on to
+ * 'filename' in Kanata format, or stops logging with filename NULL.
+ *
+ * Returns 0 on success, -1 if the log cannot be opened.
+ */
+int
+APEX_cpu_set_kanata(APEX_CPU *cpu, const char *filename)
+{
+    kanata_close(&cpu->kanata);
+    if (!filename)
+    {
+        return 0;
     }
+    return kanata_open(&cpu->kanata, filename, cpu->clock, cpu->next_seq);
 }
 
+/*
+ * Starts writing the binary event trace of the instructions fetched from
+ * now on to 'filename', or finishes the current one with filename NULL.
+ *
+ * Returns 0 on success, -1 if the trace cannot be created or the finished
+ * one could not be written completely.
+ */
+int
+APEX_cpu_set_btrace(APEX_CPU *cpu, const char *filename)
+{
+    int ret = 0;
 
+    if (cpu->btrace && btrace_close(cpu->btrace) != 0)
+    {
+        fprintf(stderr, "APEX_Error: Binary trace is incomplete, write failed\n");
+        ret = -1;
+    }
+    cpu->btrace = NULL;
+
+    if (filename)
+    {
+        cpu->btrace = btrace_open(filename);
+        if (!cpu->btrace)
+        {
+            ret = -1;
+        }
+    }
+    return ret;
+}
 
 /*
  * This function deallocates APEX CPU.
@@ -2912,6 +3085,17 @@ APEX_cpu_run(APEX_CPU *cpu)
 void
 APEX_cpu_stop(APEX_CPU *cpu)
 {
-    free(cpu->code_memory);
+    trace_close(&cpu->trace);
+    kanata_close(&cpu->kanata);
+    APEX_cpu_set_btrace(cpu, NULL);
+    free(cpu->arena);
+    if (cpu->code_map)
+    {
+        munmap(cpu->code_map, cpu->code_map_size);
+    }
+    else
+    {
+        free(cpu->code_memory);
+    }
     free(cpu);
 }
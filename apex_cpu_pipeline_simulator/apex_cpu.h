@@ -9,12 +9,21 @@
 #ifndef _APEX_CPU_H_
 #define _APEX_CPU_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "apex_bpred.h"
+#include "apex_btb.h"
+#include "apex_btrace.h"
+#include "apex_cache.h"
+#include "apex_config.h"
+#include "apex_kanata.h"
 #include "apex_macros.h"
+#include "apex_trace.h"
 
 /* Format of an APEX instruction  */
 typedef struct APEX_Instruction
 {
-    char opcode_str[128];
     int opcode;
     int rd;
     int rs1;
@@ -37,10 +46,9 @@ typedef struct IQ_Entries {
     int src2_value;
     int dest;
     int pc_address;
-    int is_used;
-    int dispatch_time;
-    int elapsed_cycles_at_dispatch;
-    int is_issued;
+    int rob_index;
+    int lsq_index;
+    int base_dest;          /* Incremented base register of LOADP/STOREP */
 }IQ_Entries;
 
 typedef struct BQ_Entry {
@@ -55,144 +63,97 @@ typedef struct BQ_Entry {
     int src2_value;
     int dest;
     int pc_address;
-    int branch_prediction;
-    int target_address;
-    int is_used;
-    int index;
-    int elapsed_cycles_at_dispatch;
+    int branch_prediction;  /* Fetch followed the taken path */
+    int target_address;     /* Next pc fetch followed */
+    int rob_index;
+    int checkpoint;         /* Rename checkpoint taken after the branch */
 } BQ_Entry;
 
-typedef struct AFU_Data_Forward {
-    int physical_address;
-    int data;
-    int dest_data;
-    int updated_src_data;
-    int zero_flag;
-    int positive_flag;
-    int is_allocated;
-}AFU_Data_Forward;
-
-typedef struct BFU_Data_Forward {
-    int physical_address;
-    int data;
-    int dest_data;
-    int updated_src_data;
-    int zero_flag;
-    int positive_flag;
-    int is_allocated;
-}BFU_Data_Forward;
-
-typedef struct MulFu_Data_Forward {
-    int physical_address;
-    int data;
-    int dest_data;
-    int updated_src_data;
-    int zero_flag;
-    int positive_flag;
-    int is_allocated;
-}MulFu_Data_Forward;
-
-typedef struct IntFu_Data_Forward {
-    int physical_address;
-    int data;
-    int dest_data;
-    int updated_src_data;
-    int zero_flag;
-    int positive_flag;
-    int is_allocated;
-}IntFu_Data_Forward;
-
-typedef struct MAU_Data_Forward {
-    int physical_address;
-    int data;
-    int dest_data;
-    int updated_src_data;
-    int zero_flag;
-    int positive_flag;
-    int is_allocated;
-}MAU_Data_Forward;
-
 typedef struct LSQEntry{
     int lsqEntryEstablished;
-    int isLoadStore;
-    int validBitMemoryAddress;
+    int isLoadStore;                 /* 1 for loads, 0 for stores */
+    int validBitMemoryAddress;       /* memoryAddress has been computed by the AFU */
     unsigned int memoryAddress;
-    int destRegAddressForLoad;               
-    int srcDataValidBit;
-    int srcTag;  
-    int entryIndex;
+    int destRegAddressForLoad;       /* Physical destination of a load */
+    int srcDataValidBit;             /* srcData holds the value a store writes */
+    int srcTag;
+    int srcData;
+    int entryIndex;                  /* ROB index of the memory instruction */
     int opcode;
+    int pc;
 } LSQEntry;
 
 /* Model of CPU stage latch */
+/* Operands of the IQ/BQ entry a function unit latch executes */
+typedef struct Issued_Op {
+    int opcode;
+    int literal;
+    int src1_tag;
+    int src1_value;
+    int src2_tag;
+    int src2_value;
+    int dest;
+    int pc_address;
+    int rob_index;
+    int lsq_index;
+    int base_dest;
+} Issued_Op;
+
+/*
+ * Model of CPU stage latch
+ *
+ * The latch only holds per-stage dynamic state. The static fields of the
+ * instruction (rd, rs1, rs2, imm) are read from code memory through
+ * insn_index, see stage_insn() in apex_cpu.c. opcode is kept as a copy since
+ * every stage switches on it.
+ */
 typedef struct CPU_Stage
 {
+    int insn_index;       /* Index into code memory, -1 if never filled */
+    int seq;              /* Fetch order of the instruction, see APEX_CPU.next_seq */
     int pc;
-    char opcode_str[128];
     int opcode;
-    int rs1;
-    int rs2;
-    int rd;
-    int imm;
     int rs1_value;
     int rs2_value;
     int result_buffer;
     int memory_address;
-    int has_insn;
     int updated_register_src1;
-    int is_empty_rd;
-    int is_empty_rs1;
-    int is_empty_rs2;
-    int simulate_counter;
-    int counter;
-    int simulator_flag;
-    int data_forward;
-    int btb_index;
-    int is_btb_hit;
+    int predicted_pc;     /* Where fetch went after this instruction */
+    BPred_Info bp;        /* Direction prediction of a branch */
     int pd;
     int ps1;
     int ps2;
-    int is_bq;
-    int is_iq;
-    int is_used;
-
-    IQ_Entries iq_entry;
-    LSQEntry dqLsq;
-    IQ_Entries iq_afu;
-    IQ_Entries iq_mulfu;
-    IQ_Entries iq_intfu;
-    BQ_Entry bq_bfu;
-    // AFU_Data_Forward afu_data;
-    // BFU_Data_Forward bfu_data;
-    // IntFu_Data_Forward intfu_data;
-    // MulFu_Data_Forward mulfu_data;
-    // MAU_Data_Forward mau_data;
+    int prev_pd;          /* Mapping of rd replaced by pd, freed at commit */
+    int base_pd;          /* LOADP/STOREP base register after the increment */
+    int prev_base_pd;
+    int checkpoint;       /* Rename checkpoint of a branch, -1 for none */
+    Issued_Op op;         /* Entry being executed by a function unit */
+    uint8_t has_insn;
+    uint8_t is_empty_rs1; /* Copied from the instruction at fetch */
+    uint8_t is_empty_rs2;
+    uint8_t is_btb_hit;
+    uint8_t is_used;
 } CPU_Stage;
 
-typedef struct BTB {
-    int pc_address;
-    int branch_prediction;
-    int target_address;
-    int allocated;
-    int is_used;
-    int index;
-}BTB;
+/*
+ * Rename state right after a branch renamed, taken by decode and restored
+ * when the branch turns out mispredicted. Registers allocated after it are
+ * the ones between free_list_head and the current head of the free list.
+ */
+typedef struct Rename_Checkpoint {
+    int seq;                            /* Branch owning it, -1 when free */
+    int rename_table[REG_FILE_SIZE];
+    int free_list_head;
+    int cc_tag;
+} Rename_Checkpoint;
 
 typedef struct Register_Rename {
     int allocated;
     int valid_bit;
     int data;
+    int flags;      /* FLAG_* of the result, read by conditional branches */
 }Register_Rename;
 
-typedef struct Data_Forward {
-    int physical_address;
-    int data;
-    int dest_data;
-    int updated_src_data;
-    int flag;
-    int is_allocated;
-}Data_Forward;
-
 typedef struct ROB_Entries {
     int entry_bit;
     int opcode;
@@ -202,10 +163,21 @@ typedef struct ROB_Entries {
     int dest_arch_register;
     int lsq_index;
     int memory_error_code;
+    unsigned int store_address;    /* Written by a store, copied by the MAU since */
+    int store_data;                /* its LSQ entry can be reused before commit */
+    int completed;
+    int base_arch_register;        /* LOADP/STOREP base register, -1 for none */
+    int base_physical_register;
+    int base_rename_table_entry;
+    int mispredicted;              /* Branch went the other way than fetch */
+    int target_address;            /* Next pc the branch resolved to */
+    int seq;                       /* Fetch order, identifies the instruction in event logs */
+    int taken;                     /* Direction a conditional branch went */
+    BPred_Info bp;                 /* Prediction of a branch, trained at commit */
 }ROB_Entries;
 
 typedef struct ROB_Queue {
-    ROB_Entries rob_entries[32];
+    ROB_Entries *rob_entries;
     int ROB_head;
     int ROB_tail;
     int capacity;
@@ -226,12 +198,21 @@ typedef struct APEX_CPU
     int clock;                     /* Clock cycles elapsed */
     int insn_completed;            /* Instructions retired */
     int regs[REG_FILE_SIZE];       /* Integer register file */
-    int scoreBoarding[REG_FILE_SIZE];
-    int has_prev_instr;
     int code_memory_size;          /* Number of instruction in the input file */
     APEX_Instruction *code_memory; /* Code Memory */
+    void *code_map;                /* Program image mapping backing code_memory, or NULL */
+    size_t code_map_size;
     int data_memory[DATA_MEMORY_SIZE]; /* Data Memory */
     int single_step;               /* Wait for user input after every cycle */
+    APEX_Trace trace;              /* Sink for all simulator output */
+    APEX_Kanata kanata;            /* Per-instruction event log, off unless opened */
+    APEX_BTrace *btrace;           /* Binary event trace, NULL when off */
+    int next_seq;                  /* Sequence number of the next fetched instruction */
+    int event_driven;              /* Skip idle cycles instead of stepping them */
+    int cycles_skipped;            /* Idle cycles jumped over in event-driven mode */
+    long insn_fast_forwarded;      /* Instructions executed by the functional emulator */
+    int checkpoint_cycle;          /* Save a checkpoint at this cycle, -1 for none */
+    const char *checkpoint_file;   /* Where to save the checkpoint */
     int zero_flag;                 /* {TRUE, FALSE} Used by BZ and BNZ to branch */
     int fetch_from_next_cycle;
     int positive_flag;
@@ -239,80 +220,112 @@ typedef struct APEX_CPU
     int simulate_counter;
     int counter;
     int simulator_flag;
-    int is_data_forwarded;
-    int index;
-    int rename_table[41];
-    int physical_queue[25];
-    int physical_queue_length;
-    int free_list;
-    int prev_dest;
-    int memory_address;
-    int has_afu_data;
-    int has_bfu_data[16];
-    int has_intfu_data[24];
-    int has_mau_data;
-    int has_mulfu_data[24];
-    int afu_entry;
-    int VCount[24];
-    int isRenamed[24];
-    int iq_dest_index[24];
-    int forwarded;
+    int rename_table[REG_FILE_SIZE];   /* Speculative map, arch -> phys */
+    int retirement_rat[REG_FILE_SIZE]; /* Committed map, arch -> phys */
+    int *physical_queue;               /* Circular free list */
+    int free_list_head;
+    int free_list;                     /* Number of free physical registers */
+    int cc_tag;                    /* Physical register of the latest flags, -1 for the cpu flags */
+    long stalls[NUM_STALLS];       /* Cycles lost per STALL_* reason */
+    long cpi_slots[NUM_CPI];       /* Commit slots per CPI_* category */
+    int recovering;                /* Flushed by a mispredict, refill not retired yet */
+    int refill_seq;                /* First instruction dispatched since, -1 for none yet */
+    APEX_BPred bpred;              /* Branch direction predictor, tables in the arena */
+    APEX_BTB btb;                  /* Branch targets, entries in the arena */
+    APEX_RAS ras;                  /* Return addresses, speculative */
+    APEX_Indirect indirect;        /* Targets of JUMPs other than returns */
+    long branch_flushes;           /* Mispredicted branches, conditional or not */
+    long insn_squashed;            /* Wrong-path instructions in flight at a recovery */
+    APEX_Cache icache;             /* Instruction cache, lines in the arena */
+    int fetch_wait;                /* Cycles until the I-cache fill fetch waits for */
+    long fetch_line_breaks;        /* Fetch groups cut short at the end of a line */
+    APEX_Cache dcache;             /* L1 data cache, lines in the arena */
+    int mau_wait;                  /* Cycles the access in the MAU has left */
+    int mau_fill;                  /* ... and it fills its L1D line as it finishes */
 
-    /* Pipeline stages */
+    /*
+     * Pipeline stages. Decode and dispatch hold a group of up to
+     * config.width instructions in program order, slots [0, *_count) are
+     * valid. fetch is the latch of the instruction being fetched.
+     */
     CPU_Stage fetch;
-    CPU_Stage decode;
-    CPU_Stage dispatch;
+    CPU_Stage *decode;             /* [config.width] */
+    CPU_Stage *dispatch;           /* [config.width] */
+    int decode_count;
+    int dispatch_count;
     CPU_Stage afu;
     CPU_Stage bfu;
-    CPU_Stage mulfu;
+    CPU_Stage mulfu;               /* First multiplier stage, filled at issue */
+    CPU_Stage *mul_pipe;           /* [config.mul_latency - 1] later stages */
     CPU_Stage mau;
     CPU_Stage intfu;
     CPU_Stage rob;
-    CPU_Stage lsqStage;
-    CPU_Stage execute;
-    CPU_Stage memory;
-    CPU_Stage writeback;
-    CPU_Stage iq_stage;
-    CPU_Stage bq_stage;
-    // CPU_Stage data_forward_bus;
 
 
-    BTB branch_target_buffer[8];
-    Register_Rename physical_register[25];
-    Register_Rename condition_code_register[16];
-    Data_Forward data_forward[2];
-    IQ_Entries iq_entries[24];
     ROB_Entries rob_entry;
     ROB_Queue ROB_queue;
     LSQ lsq;
     LSQEntry entry;
-    AFU_Data_Forward afu_data;
-    BFU_Data_Forward bfu_data;
-    IntFu_Data_Forward intfu_data[24];
-    MulFu_Data_Forward mulfu_data[24];
-    MAU_Data_Forward mau_data;
-    
-    BQ_Entry bq[16];
-    int bq_size;
-    int bq_index;
-    int iq_size;
-    int iq_index;
-    int forwarding_cycles;
 
-    BFU_Data_Forward bfu_data_forward;
+    /*
+     * Machine configuration and the sizes derived from it. Every array
+     * below is sized by the configuration and lives in one allocation,
+     * 'arena', see APEX_cpu_layout() in apex_cpu.c.
+     */
+    APEX_Config config;
+    int phys_regs;                 /* REG_FILE_SIZE + config.rename_regs */
+    int iq_words;                  /* Words of a bitmap over the IQ */
+    int bq_words;                  /* Words of a bitmap over the BQ */
+    void *arena;
+    size_t arena_size;
+
+    Register_Rename *physical_register;
+    IQ_Entries *iq_entries;
+    BQ_Entry *bq;
+    Rename_Checkpoint *rename_checkpoints; /* [config.branch_checkpoints] */
+
+    /*
+     * Wakeup and select bitmaps, one bit per queue entry. An entry waiting
+     * for a source sets its bit in the *_waiting row of that physical
+     * register; the result broadcast of the register wakes exactly those
+     * entries and moves the fully woken ones into *_ready. Rows of the
+     * two-dimensional masks are iq_words or bq_words long.
+     */
+    uint64_t *iq_free;
+    uint64_t *iq_ready;
+    uint64_t *iq_waiting;          /* [phys_regs][iq_words] */
+    uint64_t *bq_free;
+    uint64_t *bq_ready;
+    uint64_t *bq_waiting;          /* [phys_regs][bq_words] */
+    uint64_t *iq_select;           /* Scratch row for select */
+
+    /*
+     * Age matrices for oldest-first select: bit j of row i is set when
+     * entry j was dispatched before entry i. iq_fu splits the ready entries
+     * by the function unit (FU_*) they issue to.
+     */
+    uint64_t *iq_age;              /* [iq_size][iq_words] */
+    uint64_t *iq_fu;               /* [NUM_ISSUE_FU][iq_words] */
+    uint64_t *bq_age;              /* [bq_size][bq_words] */
 } APEX_CPU;
 
 
 APEX_Instruction *create_code_memory(const char *filename, int *size);
-APEX_CPU *APEX_cpu_init(const char *filename);
-void APEX_cpu_run(APEX_CPU *cpu);
+const char *get_opcode_str(int opcode);
+int is_code_image(const char *filename);
+int write_code_image(const char *filename, const APEX_Instruction *code_memory,
+                     int size);
+APEX_Instruction *map_code_image(const char *filename, int *size, void **map,
+                                 size_t *map_size);
+APEX_CPU *APEX_cpu_init(const char *filename, const APEX_Config *config);
+void APEX_cpu_layout(APEX_CPU *cpu, void *arena);
+int APEX_cpu_run(APEX_CPU *cpu);
+int APEX_cpu_set_trace(APEX_CPU *cpu, const char *filename, int level);
+int APEX_cpu_set_kanata(APEX_CPU *cpu, const char *filename);
+int APEX_cpu_set_btrace(APEX_CPU *cpu, const char *filename);
+void APEX_cpu_seed_registers(APEX_CPU *cpu);
+void print_reg_file(APEX_CPU *cpu);
 void APEX_cpu_stop(APEX_CPU *cpu);
-void init_bq(APEX_CPU *cpu);
-void init_iq(APEX_CPU *cpu);
-void dispatch_to_BQ(APEX_CPU *cpu, BQ_Entry *bq_entry);
-void dispatch_to_IQ(APEX_CPU *cpu, IQ_Entries *iq_entry);
-int is_branch_instruction(int opcode);
-int check_issue_ready(CPU_Stage stage);
-void APEX_branch_queue(APEX_CPU *cpu);
-int check_wakeup_condition_issue(APEX_CPU *cpu, IQ_Entries *iq_entry);
+const char *APEX_stall_name(int reason);
+const char *APEX_cpi_name(int category);
 #endif
@@ -0,0 +1,317 @@
+/*
+ * apex_emu.c
+ * Contains the APEX functional (ISA level) emulator
+ *
+ * Instruction semantics follow the pipeline: branch targets are pc relative,
+ * LOAD/LOADP read MEM[rs1 + imm], STORE/STOREP write rs1 to MEM[rs2 + imm],
+ * LOADP/STOREP post-increment their address register by 4, and arithmetic,
+ * logical and compare instructions update the P/Z/N flags.
+ */
+#include <stdlib.h>
+
+#include "apex_checkpoint.h"
+#include "apex_emu.h"
+
+#define SET_FLAGS(result) \
+    do                                  \
+    {                                   \
+        zero_flag = ((result) == 0);    \
+        positive_flag = ((result) > 0); \
+        negative_flag = ((result) < 0); \
+    } while (0)
+
+/*
+ * Executes up to 'max_insns' instructions starting at cpu->pc, updating
+ * cpu->regs, cpu->data_memory, the flags and cpu->pc. HALT is not executed,
+ * pc is left pointing at it. The number of instructions executed is stored
+ * in '*executed'.
+ *
+ * Returns one of APEX_EMU_DONE, APEX_EMU_HALT or APEX_EMU_FAULT.
+ */
+int
+APEX_emu_run(APEX_CPU *cpu, long max_insns, long *executed)
+{
+    const APEX_Instruction *code = cpu->code_memory;
+    const int code_size = cpu->code_memory_size;
+    int *regs = cpu->regs;
+    int *mem = cpu->data_memory;
+    int zero_flag = cpu->zero_flag;
+    int positive_flag = cpu->positive_flag;
+    int negative_flag = cpu->negative_flag;
+    int status = APEX_EMU_DONE;
+    int index = (cpu->pc - 4000) / 4;
+    long count = 0;
+
+    while (count < max_insns)
+    {
+        const APEX_Instruction *ins;
+        int next = index + 1;
+        int result;
+        unsigned int address;
+
+        if ((unsigned int)index >= (unsigned int)code_size)
+        {
+            status = APEX_EMU_FAULT;
+            break;
+        }
+        ins = &code[index];
+
+        switch (ins->opcode)
+        {
+            case OPCODE_ADD:
+                result = regs[ins->rs1] + regs[ins->rs2];
+                regs[ins->rd] = result;
+                SET_FLAGS(result);
+                break;
+
+            case OPCODE_SUB:
+                result = regs[ins->rs1] - regs[ins->rs2];
+                regs[ins->rd] = result;
+                SET_FLAGS(result);
+                break;
+
+            case OPCODE_MUL:
+                result = regs[ins->rs1] * regs[ins->rs2];
+                regs[ins->rd] = result;
+                SET_FLAGS(result);
+                break;
+
+            case OPCODE_DIV:
+                result = APEX_DIV(regs[ins->rs1], regs[ins->rs2]);
+                regs[ins->rd] = result;
+                SET_FLAGS(result);
+                break;
+
+            case OPCODE_AND:
+                result = regs[ins->rs1] & regs[ins->rs2];
+                regs[ins->rd] = result;
+                SET_FLAGS(result);
+                break;
+
+            case OPCODE_OR:
+                result = regs[ins->rs1] | regs[ins->rs2];
+                regs[ins->rd] = result;
+                SET_FLAGS(result);
+                break;
+
+            case OPCODE_XOR:
+                result = regs[ins->rs1] ^ regs[ins->rs2];
+                regs[ins->rd] = result;
+                SET_FLAGS(result);
+                break;
+
+            case OPCODE_ADDL:
+                result = regs[ins->rs1] + ins->imm;
+                regs[ins->rd] = result;
+                SET_FLAGS(result);
+                break;
+
+            case OPCODE_SUBL:
+                result = regs[ins->rs1] - ins->imm;
+                regs[ins->rd] = result;
+                SET_FLAGS(result);
+                break;
+
+            case OPCODE_MOVC:
+                regs[ins->rd] = ins->imm;
+                break;
+
+            case OPCODE_LOAD:
+            case OPCODE_LOADP:
+                address = (unsigned int)(regs[ins->rs1] + ins->imm);
+                if (address >= DATA_MEMORY_SIZE)
+                {
+                    status = APEX_EMU_FAULT;
+                    goto out;
+                }
+                if (ins->opcode == OPCODE_LOADP)
+                {
+                    regs[ins->rs1] += 4;
+                }
+                regs[ins->rd] = mem[address];
+                break;
+
+            case OPCODE_STORE:
+            case OPCODE_STOREP:
+                address = (unsigned int)(regs[ins->rs2] + ins->imm);
+                if (address >= DATA_MEMORY_SIZE)
+                {
+                    status = APEX_EMU_FAULT;
+                    goto out;
+                }
+                mem[address] = regs[ins->rs1];
+                if (ins->opcode == OPCODE_STOREP)
+                {
+                    regs[ins->rs2] += 4;
+                }
+                break;
+
+            case OPCODE_CMP:
+                result = regs[ins->rs1] - regs[ins->rs2];
+                SET_FLAGS(result);
+                break;
+
+            case OPCODE_CML:
+                result = regs[ins->rs1] - ins->imm;
+                SET_FLAGS(result);
+                break;
+
+            case OPCODE_BZ:
+                if (zero_flag)
+                {
+                    next = index + ins->imm / 4;
+                }
+                break;
+
+            case OPCODE_BNZ:
+                if (!zero_flag)
+                {
+                    next = index + ins->imm / 4;
+                }
+                break;
+
+            case OPCODE_BP:
+                if (positive_flag)
+                {
+                    next = index + ins->imm / 4;
+                }
+                break;
+
+            case OPCODE_BNP:
+                if (!positive_flag)
+                {
+                    next = index + ins->imm / 4;
+                }
+                break;
+
+            case OPCODE_BN:
+                if (negative_flag)
+                {
+                    next = index + ins->imm / 4;
+                }
+                break;
+
+            case OPCODE_BNN:
+                if (!negative_flag)
+                {
+                    next = index + ins->imm / 4;
+                }
+                break;
+
+            case OPCODE_JUMP:
+                next = (regs[ins->rs1] + ins->imm - 4000) / 4;
+                break;
+
+            case OPCODE_JALR:
+                result = regs[ins->rs1] + ins->imm;
+                regs[ins->rd] = 4000 + (index + 1) * 4;
+                next = (result - 4000) / 4;
+                break;
+
+            case OPCODE_HALT:
+                status = APEX_EMU_HALT;
+                goto out;
+
+            case OPCODE_NOP:
+            default:
+                break;
+        }
+
+        index = next;
+        count++;
+    }
+
+out:
+    cpu->pc = 4000 + index * 4;
+    cpu->zero_flag = zero_flag;
+    cpu->positive_flag = positive_flag;
+    cpu->negative_flag = negative_flag;
+    *executed = count;
+    return status;
+}
+
+/*
+ * Fast-forwards a freshly initialized CPU over its first 'num_insns'
+ * instructions with the functional emulator, then copies the resulting
+ * architectural registers into their physical registers so that the detailed
+ * pipeline starts fetching at the instruction that follows.
+ *
+ * Returns the emulator status, see APEX_EMU_*.
+ */
+int
+APEX_cpu_fast_forward(APEX_CPU *cpu, long num_insns)
+{
+    long executed;
+    int status;
+
+    status = APEX_emu_run(cpu, num_insns, &executed);
+    APEX_cpu_seed_registers(cpu);
+    cpu->insn_fast_forwarded = executed;
+    return status;
+}
+
+/*
+ * Executes program 'filename' from its start on the emulator and compares
+ * the architectural registers and data memory it ends with against 'cpu',
+ * which simulated the same program up to its HALT. The outcome and the
+ * first difference are traced at the summary level of 'cpu'.
+ *
+ * Returns APEX_CHECK_MATCH or APEX_CHECK_MISMATCH, or APEX_CHECK_SKIPPED
+ * when there is no reference: 'filename' is a checkpoint, which starts in
+ * the middle of the program, or the emulator does not reach HALT.
+ */
+int
+APEX_emu_check(APEX_CPU *cpu, const char *filename)
+{
+    APEX_CPU *ref;
+    long executed;
+    int status = APEX_CHECK_MATCH;
+
+    if (APEX_checkpoint_probe(filename))
+    {
+        TRACE(&cpu->trace, APEX_VERBOSITY_SUMMARY,
+              "APEX_CHECK: Skipped, a checkpoint has no reference run\n");
+        return APEX_CHECK_SKIPPED;
+    }
+
+    ref = APEX_cpu_init(filename, NULL);
+    if (!ref || APEX_emu_run(ref, __LONG_MAX__, &executed) != APEX_EMU_HALT)
+    {
+        TRACE(&cpu->trace, APEX_VERBOSITY_SUMMARY,
+              "APEX_CHECK: Skipped, the functional emulator did not halt\n");
+        if (ref)
+        {
+            APEX_cpu_stop(ref);
+        }
+        return APEX_CHECK_SKIPPED;
+    }
+
+    for (int i = 0; i < REG_FILE_SIZE && status == APEX_CHECK_MATCH; i++)
+    {
+        if (cpu->regs[i] != ref->regs[i])
+        {
+            TRACE(&cpu->trace, APEX_VERBOSITY_SUMMARY,
+                  "APEX_CHECK: Mismatch, R%d = %d, functional emulator %d\n", i,
+                  cpu->regs[i], ref->regs[i]);
+            status = APEX_CHECK_MISMATCH;
+        }
+    }
+    for (int i = 0; i < DATA_MEMORY_SIZE && status == APEX_CHECK_MATCH; i++)
+    {
+        if (cpu->data_memory[i] != ref->data_memory[i])
+        {
+            TRACE(&cpu->trace, APEX_VERBOSITY_SUMMARY,
+                  "APEX_CHECK: Mismatch, MEM[%d] = %d, functional emulator %d\n",
+                  i, cpu->data_memory[i], ref->data_memory[i]);
+            status = APEX_CHECK_MISMATCH;
+        }
+    }
+    if (status == APEX_CHECK_MATCH)
+    {
+        TRACE(&cpu->trace, APEX_VERBOSITY_SUMMARY,
+              "APEX_CHECK: Registers and memory match the functional emulator\n");
+    }
+
+    APEX_cpu_stop(ref);
+    return status;
+}
@@ -0,0 +1,29 @@
+/*
+ * apex_emu.h
+ * Contains the APEX functional (ISA level) emulator declarations
+ *
+ * The emulator executes code memory directly against the architectural
+ * register file and data memory of an APEX_CPU, without modelling rename,
+ * issue queue, ROB or LSQ. It is used to fast-forward over code before the
+ * detailed out-of-order simulation starts.
+ */
+#ifndef _APEX_EMU_H_
+#define _APEX_EMU_H_
+
+#include "apex_cpu.h"
+
+/* Reasons for the emulator to stop */
+#define APEX_EMU_DONE 0  /* Executed the requested number of instructions */
+#define APEX_EMU_HALT 1  /* Reached HALT, pc points at the HALT */
+#define APEX_EMU_FAULT 2 /* Invalid pc or data address */
+
+/* Outcomes of APEX_emu_check */
+#define APEX_CHECK_NONE -1     /* Not requested */
+#define APEX_CHECK_MATCH 0
+#define APEX_CHECK_MISMATCH 1
+#define APEX_CHECK_SKIPPED 2   /* No reference, see APEX_emu_check */
+
+int APEX_emu_run(APEX_CPU *cpu, long max_insns, long *executed);
+int APEX_cpu_fast_forward(APEX_CPU *cpu, long num_insns);
+int APEX_emu_check(APEX_CPU *cpu, const char *filename);
+#endif
@@ -0,0 +1,91 @@
+/*
+ * apex_kanata.c
+ * Contains the per-instruction pipeline event log in Kanata format
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_kanata.h"
+#include "apex_macros.h"
+
+/*
+ * Opens an event log in 'filename' starting at 'cycle'. The instruction
+ * with sequence number 'first_seq' is logged with id 0, later ones follow
+ * in fetch order.
+ *
+ * Returns 0 on success, -1 if the file or its buffer cannot be allocated.
+ */
+int
+kanata_open(APEX_Kanata *k, const char *filename, int cycle, int first_seq)
+{
+    memset(k, 0, sizeof(APEX_Kanata));
+
+    k->fp = fopen(filename, "w");
+    if (!k->fp)
+    {
+        return -1;
+    }
+
+    k->buffer = malloc(TRACE_BUFFER_SIZE);
+    if (!k->buffer)
+    {
+        kanata_close(k);
+        return -1;
+    }
+    setvbuf(k->fp, k->buffer, _IOFBF, TRACE_BUFFER_SIZE);
+
+    k->cycle = cycle;
+    k->first_seq = first_seq;
+    fprintf(k->fp, "Kanata\t0004\nC=\t%d\n", cycle);
+    return 0;
+}
+
+/* Moves the log forward to 'cycle', events are written in cycle order */
+static void
+kanata_advance(APEX_Kanata *k, int cycle)
+{
+    if (cycle > k->cycle)
+    {
+        fprintf(k->fp, "C\t%d\n", cycle - k->cycle);
+        k->cycle = cycle;
+    }
+}
+
+/* Starts instruction 'seq', fetched from 'pc', labeled with its assembly */
+void
+kanata_insn(APEX_Kanata *k, int cycle, int seq, int pc, const char *text)
+{
+    int id = seq - k->first_seq;
+
+    kanata_advance(k, cycle);
+    fprintf(k->fp, "I\t%d\t%d\t0\nL\t%d\t0\t%d: %s\n", id, seq, id, pc, text);
+}
+
+/* Instruction 'seq' enters 'stage', which ends the stage it was in */
+void
+kanata_stage(APEX_Kanata *k, int cycle, int seq, const char *stage)
+{
+    kanata_advance(k, cycle);
+    fprintf(k->fp, "S\t%d\t0\t%s\n", seq - k->first_seq, stage);
+}
+
+/* Instruction 'seq' leaves the pipeline, retired in order or flushed */
+void
+kanata_retire(APEX_Kanata *k, int cycle, int seq, int flushed)
+{
+    kanata_advance(k, cycle);
+    fprintf(k->fp, "R\t%d\t%ld\t%d\n", seq - k->first_seq,
+            flushed ? 0 : k->retired++, flushed ? 1 : 0);
+}
+
+void
+kanata_close(APEX_Kanata *k)
+{
+    if (k->fp)
+    {
+        fclose(k->fp);
+    }
+    free(k->buffer);
+    memset(k, 0, sizeof(APEX_Kanata));
+}
@@ -0,0 +1,34 @@
+/*
+ * apex_kanata.h
+ * Contains the per-instruction pipeline event log in Kanata format
+ *
+ * The log records when every instruction enters each pipeline stage and
+ * when it retires or is flushed, and can be opened in a Kanata viewer such
+ * as Konata. Instructions are identified by the sequence number the CPU
+ * gives them at fetch.
+ */
+#ifndef _APEX_KANATA_H_
+#define _APEX_KANATA_H_
+
+#include <stdio.h>
+
+typedef struct APEX_Kanata
+{
+    FILE *fp;        /* Log file, NULL when the log is off */
+    char *buffer;    /* Stream buffer of TRACE_BUFFER_SIZE bytes */
+    int cycle;       /* Cycle of the last event written */
+    int first_seq;   /* Sequence number logged as id 0 */
+    long retired;    /* Retire ids handed out so far */
+} APEX_Kanata;
+
+/* True when events are being logged. Instructions fetched before the log
+ * was opened have no id and are skipped. */
+#define KANATA_ON(k) ((k)->fp != NULL)
+#define KANATA_LOGGED(k, seq) (KANATA_ON(k) && (seq) >= (k)->first_seq)
+
+int kanata_open(APEX_Kanata *k, const char *filename, int cycle, int first_seq);
+void kanata_insn(APEX_Kanata *k, int cycle, int seq, int pc, const char *text);
+void kanata_stage(APEX_Kanata *k, int cycle, int seq, const char *stage);
+void kanata_retire(APEX_Kanata *k, int cycle, int seq, int flushed);
+void kanata_close(APEX_Kanata *k);
+#endif
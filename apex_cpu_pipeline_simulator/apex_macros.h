@@ -18,6 +18,148 @@
 /* Size of integer register file */
 #define REG_FILE_SIZE 32
 
+/* Default machine configuration, see APEX_Config */
+#define DEFAULT_RENAME_REGS 25
+#define DEFAULT_IQ_SIZE 24
+#define DEFAULT_BQ_SIZE 16
+#define DEFAULT_ROB_SIZE 32
+#define DEFAULT_LSQ_SIZE 16
+#define DEFAULT_BTB_SIZE 64
+#define DEFAULT_BTB_WAYS 4
+#define DEFAULT_WIDTH 1
+#define DEFAULT_MUL_LATENCY 1
+#define DEFAULT_BPRED BPRED_TOURNAMENT
+#define DEFAULT_BPRED_SIZE 1024
+#define DEFAULT_BPRED_HISTORY 8
+#define DEFAULT_RAS_SIZE 16
+#define DEFAULT_INDIRECT_SIZE 64
+#define DEFAULT_BRANCH_CHECKPOINTS 8
+#define DEFAULT_ICACHE_SIZE 0           /* Bytes, no I-cache */
+#define DEFAULT_ICACHE_WAYS 2
+#define DEFAULT_ICACHE_LINE 16
+#define DEFAULT_ICACHE_MISS_LATENCY 10
+#define DEFAULT_DCACHE_SIZE 1024        /* Bytes */
+#define DEFAULT_DCACHE_WAYS 4
+#define DEFAULT_DCACHE_LINE 16
+#define DEFAULT_DCACHE_HIT_LATENCY 1
+#define DEFAULT_DCACHE_MISS_LATENCY 10
+#define DEFAULT_DCACHE_POLICY CACHE_WRITE_BACK
+
+/* Upper bound of the global branch history length */
+#define MAX_BPRED_HISTORY 30
+
+/* Upper bound of every configurable size */
+#define MAX_QUEUE_SIZE 4096
+
+/* Upper bound of the front-end width */
+#define MAX_WIDTH 16
+
+/* Upper bound of a function unit latency */
+#define MAX_LATENCY 64
+
+/* Upper bound of a memory latency */
+#define MAX_MEMORY_LATENCY 1024
+
+/*
+ * Result of DIV, shared by the pipeline and the functional emulator.
+ * Dividing by zero gives 0 instead of trapping, and INT_MIN / -1 wraps
+ * to INT_MIN instead of overflowing.
+ */
+#define APEX_DIV(a, b) \
+    ((b) == 0 ? 0 : (b) == -1 ? (int)(0u - (unsigned)(a)) : (a) / (b))
+
+/* 64-bit words in a bitmap with one bit per entry of an n entry queue */
+#define MASK_WORDS(n) (((n) + 63) / 64)
+
+/* Function units the issue queue selects for, one grant per unit per cycle */
+#define FU_INT 0
+#define FU_MUL 1
+#define FU_ADDR 2
+#define NUM_ISSUE_FU 3
+#define FU_BRANCH 3     /* The BFU, fed by the branch queue */
+#define NUM_FUS 4
+
+/* Branch direction predictors, see apex_bpred.c */
+#define BPRED_BIMODAL 0     /* 2-bit counters indexed by pc */
+#define BPRED_GSHARE 1      /* 2-bit counters indexed by pc ^ global history */
+#define BPRED_TOURNAMENT 2  /* Bimodal and gshare with a per-pc chooser */
+#define NUM_BPRED 3
+
+/* Where fetch took the target of a JUMP or JALR from */
+#define TARGET_NONE 0       /* Nowhere, fetch went on to pc + 4 */
+#define TARGET_BTB 1
+#define TARGET_RAS 2        /* Return address stack */
+#define TARGET_INDIRECT 3   /* Indirect target predictor */
+#define NUM_TARGETS 4
+
+/* RAS entry not pushed by any JALR */
+#define RAS_NO_LINK 0xff
+
+/* Cache write policies, see apex_cache.c */
+#define CACHE_WRITE_BACK 0      /* Write-back, write-allocate */
+#define CACHE_WRITE_THROUGH 1   /* Write-through, no write-allocate */
+#define NUM_CACHE_POLICIES 2
+
+/*
+ * Stall reasons, counted once per cycle in which a stage is left holding
+ * work or gets nothing done, see APEX_CPU.stalls
+ */
+#define STALL_FETCH_REDIRECT 0      /* Fetch waits a cycle for a new pc */
+#define STALL_FETCH_DECODE_BUSY 1   /* Decode group not drained yet */
+#define STALL_FETCH_ICACHE_MISS 2   /* Fetch waits for an I-cache fill */
+#define STALL_DECODE_FREE_LIST 3    /* Too few free physical registers */
+#define STALL_DECODE_NO_CHECKPOINT 4 /* A branch finds no free rename checkpoint */
+#define STALL_DECODE_DISPATCH_BUSY 5
+#define STALL_DISPATCH_ROB_FULL 6
+#define STALL_DISPATCH_IQ_FULL 7
+#define STALL_DISPATCH_BQ_FULL 8
+#define STALL_DISPATCH_LSQ_FULL 9
+#define STALL_ISSUE_NOT_READY 10    /* IQ entries all wait for operands */
+#define STALL_ISSUE_FU_BUSY 11      /* Ready IQ entries, their units busy */
+#define STALL_BRANCH_NOT_READY 12   /* BQ entries all wait for operands */
+#define STALL_LSQ_NOT_READY 13      /* LSQ head cannot go to the MAU */
+#define STALL_MAU_BUSY 14           /* MAU access not done, mostly an L1D miss */
+#define STALL_COMMIT_NOT_COMPLETE 15 /* ROB head has not completed */
+#define STALL_COMMIT_EMPTY 16
+#define NUM_STALLS 17
+
+/*
+ * Top-down categories of commit slots, config.width per cycle, see
+ * APEX_CPU.cpi_slots
+ */
+#define CPI_RETIRING 0          /* An instruction retired */
+#define CPI_FRONTEND 1          /* ROB empty, nothing fetched to retire */
+#define CPI_BAD_SPECULATION 2   /* Lost to a mispredict flush and its refill */
+#define CPI_MEMORY 3            /* Head waits on a load or store */
+#define CPI_CORE 4              /* Head waits on any other unit */
+#define NUM_CPI 5
+
+/*
+ * Pipeline events of an instruction, recorded in the --kanata and --btrace
+ * logs
+ */
+#define EVENT_FETCH 0
+#define EVENT_RENAME 1
+#define EVENT_DISPATCH 2        /* Into the ROB and its IQ, BQ or LSQ entry */
+#define EVENT_ISSUE 3           /* Into a function unit */
+#define EVENT_ADDRESS 4         /* Load/store address computed, waits in the LSQ */
+#define EVENT_MEMORY 5          /* Into the MAU */
+#define EVENT_WRITEBACK 6       /* Result broadcast, waits to commit */
+#define EVENT_RETIRE 7
+#define EVENT_FLUSH 8           /* Squashed by a mispredicted branch */
+#define NUM_EVENTS 9
+
+/* Condition flags as carried in physical registers and branch operands */
+#define FLAG_ZERO 0x1
+#define FLAG_POSITIVE 0x2
+#define FLAG_NEGATIVE 0x4
+
+/* Checkpoint image format, bump whenever APEX_CPU changes layout */
+#define CHECKPOINT_VERSION 26
+
+/* Pre-assembled program image format, bump whenever APEX_Instruction changes */
+#define CODE_IMAGE_VERSION 2
+
 /* Numeric OPCODE identifiers for instructions */
 #define OPCODE_ADD 0x0
 #define OPCODE_SUB 0x1
@@ -47,9 +189,26 @@
 #define OPCODE_JALR 0x19
 
 
-/* Set this flag to 1 to enable debug messages */
+/* Set this flag to 1 to enable debug messages, 0 compiles all tracing out */
 #define ENABLE_DEBUG_MESSAGES 1
 
+/* Runtime verbosity levels, each level includes the ones below it */
+#define APEX_VERBOSITY_QUIET 0   /* No simulator output */
+#define APEX_VERBOSITY_SUMMARY 1 /* Final cycles/instructions line */
+#define APEX_VERBOSITY_CYCLE 2   /* Register file and flags every cycle */
+#define APEX_VERBOSITY_STAGE 3   /* Stage contents every cycle */
+
+/* Outcomes of APEX_cpu_run */
+#define APEX_RUN_HALTED 0   /* HALT committed */
+#define APEX_RUN_STOPPED 1  /* Cycle limit reached or user quit */
+#define APEX_RUN_DEADLOCK 2 /* Idle pipeline with nothing scheduled */
+
+/* Buffer size of the trace sink, output is written out in blocks this big */
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+/* Longest disassembly of one instruction, with the terminating NUL */
+#define INSN_TEXT_SIZE 48
+
 /* Set this flag to 1 to enable cycle single-step mode */
 #define ENABLE_SINGLE_STEP 1
 
@@ -0,0 +1,184 @@
+/*
+ * apex_options.c
+ * Contains the per-run simulator options shared by the command line and
+ * the batch runner
+ */
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "apex_emu.h"
+#include "apex_options.h"
+
+void
+options_init(APEX_Options *opts)
+{
+    memset(opts, 0, sizeof(APEX_Options));
+    opts->verbosity = APEX_VERBOSITY_STAGE;
+    opts->checkpoint_at = -1;
+    config_init(&opts->config);
+}
+
+/*
+ * Parses a single "--name[=value]" option into 'opts'.
+ *
+ * Returns 1 if the option was recognized, 0 if it is not a run option and -1
+ * if its value is invalid.
+ */
+int
+options_parse(APEX_Options *opts, const char *arg)
+{
+    long value;
+
+    if (strncmp(arg, "--verbosity=", 12) == 0)
+    {
+        opts->verbosity = trace_parse_level(arg + 12);
+        return opts->verbosity < 0 ? -1 : 1;
+    }
+
+    if (strncmp(arg, "--trace-file=", 13) == 0)
+    {
+        opts->trace_file = arg + 13;
+        return 1;
+    }
+
+    if (strncmp(arg, "--kanata=", 9) == 0)
+    {
+        opts->kanata_file = arg + 9;
+        return 1;
+    }
+
+    if (strncmp(arg, "--btrace=", 9) == 0)
+    {
+        opts->btrace_file = arg + 9;
+        return 1;
+    }
+
+    if (strcmp(arg, "--event-driven") == 0)
+    {
+        opts->event_driven = TRUE;
+        return 1;
+    }
+
+    if (strcmp(arg, "--functional") == 0)
+    {
+        opts->functional = TRUE;
+        return 1;
+    }
+
+    if (strcmp(arg, "--check") == 0)
+    {
+        opts->check = TRUE;
+        return 1;
+    }
+
+    if (strncmp(arg, "--fast-forward=", 15) == 0)
+    {
+        return config_parse_number(arg + 15, 0, LONG_MAX, &opts->fast_forward) == 0 ? 1 : -1;
+    }
+
+    if (strncmp(arg, "--max-cycles=", 13) == 0)
+    {
+        if (config_parse_number(arg + 13, 0, INT_MAX, &value) != 0)
+        {
+            return -1;
+        }
+        opts->max_cycles = (int)value;
+        return 1;
+    }
+
+    if (strncmp(arg, "--checkpoint-at=", 16) == 0)
+    {
+        if (config_parse_number(arg + 16, 0, INT_MAX, &value) != 0)
+        {
+            return -1;
+        }
+        opts->checkpoint_at = (int)value;
+        return 1;
+    }
+
+    if (strncmp(arg, "--checkpoint-file=", 18) == 0)
+    {
+        opts->checkpoint_file = arg + 18;
+        return 1;
+    }
+
+    if (strncmp(arg, "--config=", 9) == 0)
+    {
+        return config_load(&opts->config, arg + 9) == 0 ? 1 : -1;
+    }
+
+    /* Structure sizes, "--iq-size=64" and so on */
+    if (strncmp(arg, "--", 2) == 0)
+    {
+        return config_parse(&opts->config, arg + 2);
+    }
+    return 0;
+}
+
+/*
+ * Applies 'opts' to a freshly initialized or restored CPU: output, cycle
+ * limit, checkpoint and functional fast-forward. A checkpoint requested at
+ * the current cycle is taken after the fast-forward, and the event logs
+ * start with the first instruction simulated in detail.
+ *
+ * Fast-forward needs a CPU that has not started yet. A checkpoint taken
+ * later has instructions in flight, which the emulator cannot see, so it
+ * is refused for those.
+ *
+ * Returns 0 on success, -1 if the trace file or an event log cannot be
+ * opened, or the fast-forward was refused or faulted.
+ */
+int
+APEX_cpu_apply_options(APEX_CPU *cpu, const APEX_Options *opts)
+{
+    if (opts->max_cycles > 0)
+    {
+        cpu->simulate_counter = opts->max_cycles;
+        cpu->simulator_flag = 1;
+    }
+    cpu->event_driven = opts->event_driven;
+    cpu->checkpoint_cycle = opts->checkpoint_at;
+    cpu->checkpoint_file = opts->checkpoint_file ? opts->checkpoint_file
+                                                 : APEX_DEFAULT_CHECKPOINT;
+
+    if (APEX_cpu_set_trace(cpu, opts->trace_file, opts->verbosity) != 0)
+    {
+        return -1;
+    }
+
+    if (opts->fast_forward > 0 && (cpu->clock != 0 || cpu->ROB_queue.capacity != 0))
+    {
+        fprintf(stderr, "APEX_Error: --fast-forward needs a program that has not "
+                        "started, the checkpoint is at cycle %d\n", cpu->clock);
+        return -1;
+    }
+
+    if (opts->fast_forward > 0
+        && APEX_cpu_fast_forward(cpu, opts->fast_forward) == APEX_EMU_FAULT)
+    {
+        return -1;
+    }
+
+    if (opts->kanata_file && APEX_cpu_set_kanata(cpu, opts->kanata_file) != 0)
+    {
+        return -1;
+    }
+
+    if (opts->btrace_file && APEX_cpu_set_btrace(cpu, opts->btrace_file) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* Monotonic host time in seconds, used to report simulation speed */
+double
+host_seconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
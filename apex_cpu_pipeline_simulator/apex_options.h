@@ -0,0 +1,33 @@
+/*
+ * apex_options.h
+ * Contains the per-run simulator options shared by the command line and
+ * the batch runner
+ */
+#ifndef _APEX_OPTIONS_H_
+#define _APEX_OPTIONS_H_
+
+#include "apex_cpu.h"
+
+#define APEX_DEFAULT_CHECKPOINT "apex_sim.ckpt"
+
+typedef struct APEX_Options
+{
+    int verbosity;          /* APEX_VERBOSITY_* level */
+    const char *trace_file; /* Output file, NULL for stdout */
+    const char *kanata_file; /* Kanata pipeline event log, NULL for none */
+    const char *btrace_file; /* Binary pipeline event trace, NULL for none */
+    int event_driven;       /* Skip idle cycles */
+    int functional;         /* Run on the functional emulator only */
+    int check;              /* Compare the final state with the functional emulator */
+    long fast_forward;      /* Instructions to execute functionally first */
+    int max_cycles;         /* Stop after this many cycles, 0 for no limit */
+    int checkpoint_at;      /* Save a checkpoint at this cycle, -1 for none */
+    const char *checkpoint_file; /* Checkpoint path, APEX_DEFAULT_CHECKPOINT if NULL */
+    APEX_Config config;     /* Machine configuration, given to APEX_cpu_init */
+} APEX_Options;
+
+void options_init(APEX_Options *opts);
+int options_parse(APEX_Options *opts, const char *arg);
+int APEX_cpu_apply_options(APEX_CPU *cpu, const APEX_Options *opts);
+double host_seconds();
+#endif
@@ -0,0 +1,126 @@
+/*
+ * apex_trace.c
+ * Contains the buffered trace sink used for simulator output
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_trace.h"
+
+/*
+ * Opens a trace sink writing to 'filename', or to stdout when filename is
+ * NULL. The stream is fully buffered with a TRACE_BUFFER_SIZE buffer so that
+ * enabled output is written in large blocks instead of once per line.
+ *
+ * Returns 0 on success, -1 if the file or the buffer cannot be allocated.
+ */
+int
+trace_open(APEX_Trace *trace, const char *filename, int level)
+{
+    memset(trace, 0, sizeof(APEX_Trace));
+    trace->level = level;
+
+    if (filename)
+    {
+        trace->fp = fopen(filename, "w");
+        if (!trace->fp)
+        {
+            return -1;
+        }
+        trace->owns_fp = TRUE;
+    }
+    else
+    {
+        trace->fp = stdout;
+    }
+
+    /* Nothing will be written when quiet, keep the default stream buffer */
+    if (level == APEX_VERBOSITY_QUIET)
+    {
+        return 0;
+    }
+
+    trace->buffer = malloc(TRACE_BUFFER_SIZE);
+    if (!trace->buffer)
+    {
+        trace_close(trace);
+        return -1;
+    }
+    setvbuf(trace->fp, trace->buffer, _IOFBF, TRACE_BUFFER_SIZE);
+    return 0;
+}
+
+void
+trace_printf(APEX_Trace *trace, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vfprintf(trace->fp, fmt, args);
+    va_end(args);
+}
+
+void
+trace_flush(APEX_Trace *trace)
+{
+    if (trace->fp)
+    {
+        fflush(trace->fp);
+    }
+}
+
+/*
+ * Flushes and releases the sink. The stream buffer is detached before it is
+ * freed, stdout outlives the trace and must not keep pointing into it.
+ */
+void
+trace_close(APEX_Trace *trace)
+{
+    if (trace->fp)
+    {
+        fflush(trace->fp);
+        if (trace->owns_fp)
+        {
+            fclose(trace->fp);
+        }
+        else if (trace->buffer)
+        {
+            setvbuf(trace->fp, NULL, _IOLBF, BUFSIZ);
+        }
+    }
+    free(trace->buffer);
+    memset(trace, 0, sizeof(APEX_Trace));
+}
+
+/*
+ * Converts a verbosity name ("quiet", "summary", "cycle", "stage") or its
+ * numeric value into an APEX_VERBOSITY_* level.
+ *
+ * Returns -1 for an unknown name.
+ */
+int
+trace_parse_level(const char *name)
+{
+    if (strcmp(name, "quiet") == 0 || strcmp(name, "0") == 0)
+    {
+        return APEX_VERBOSITY_QUIET;
+    }
+
+    if (strcmp(name, "summary") == 0 || strcmp(name, "1") == 0)
+    {
+        return APEX_VERBOSITY_SUMMARY;
+    }
+
+    if (strcmp(name, "cycle") == 0 || strcmp(name, "2") == 0)
+    {
+        return APEX_VERBOSITY_CYCLE;
+    }
+
+    if (strcmp(name, "stage") == 0 || strcmp(name, "3") == 0)
+    {
+        return APEX_VERBOSITY_STAGE;
+    }
+    return -1;
+}
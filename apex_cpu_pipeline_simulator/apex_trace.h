@@ -0,0 +1,45 @@
+/*
+ * apex_trace.h
+ * Contains the buffered trace sink used for simulator output
+ *
+ * All per-cycle and per-stage output of a CPU goes through its own trace
+ * sink, so the hot path never formats strings unless the selected verbosity
+ * level asks for them.
+ */
+#ifndef _APEX_TRACE_H_
+#define _APEX_TRACE_H_
+
+#include <stdio.h>
+
+#include "apex_macros.h"
+
+typedef struct APEX_Trace
+{
+    FILE *fp;      /* Destination stream, stdout by default */
+    char *buffer;  /* Stream buffer of TRACE_BUFFER_SIZE bytes */
+    int level;     /* One of APEX_VERBOSITY_* */
+    int owns_fp;   /* fp was opened by trace_open and must be closed */
+} APEX_Trace;
+
+/* True when output at verbosity level 'lvl' is enabled for this trace.
+ * Compiles to nothing when ENABLE_DEBUG_MESSAGES is 0. */
+#define TRACE_ON(trace, lvl) \
+    (ENABLE_DEBUG_MESSAGES && (trace)->level >= (lvl))
+
+/* Formats a message into the trace only when level 'lvl' is enabled */
+#define TRACE(trace, lvl, ...)                  \
+    do                                          \
+    {                                           \
+        if (TRACE_ON(trace, lvl))               \
+        {                                       \
+            trace_printf(trace, __VA_ARGS__);   \
+        }                                       \
+    } while (0)
+
+int trace_open(APEX_Trace *trace, const char *filename, int level);
+void trace_printf(APEX_Trace *trace, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void trace_flush(APEX_Trace *trace);
+void trace_close(APEX_Trace *trace);
+int trace_parse_level(const char *name);
+#endif
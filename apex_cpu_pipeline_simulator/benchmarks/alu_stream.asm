@@ -0,0 +1,14 @@
+MOVC R1,#50000
+MOVC R10,#3
+MOVC R11,#5
+ADD R2,R10,R11
+SUB R3,R11,R10
+AND R4,R10,R11
+OR R5,R10,R11
+EXOR R6,R10,R11
+ADDL R7,R10,#9
+SUBL R8,R11,#2
+ADD R9,R10,R10
+SUBL R1,R1,#1
+BNZ #-36
+HALT
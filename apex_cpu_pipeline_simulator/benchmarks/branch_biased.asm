@@ -0,0 +1,15 @@
+MOVC R1,#40000
+MOVC R7,#7
+MOVC R8,#0
+AND R2,R1,R7
+BZ #8
+ADDL R8,R8,#1
+CML R2,#6
+BNP #8
+ADDL R8,R8,#2
+CML R2,#0
+BP #8
+ADDL R8,R8,#4
+SUBL R1,R1,#1
+BNZ #-40
+HALT
@@ -0,0 +1,18 @@
+MOVC R1,#40000
+MOVC R2,#1
+MOVC R9,#64
+MOVC R10,#5
+MOVC R11,#1023
+MOVC R8,#0
+MUL R2,R2,R10
+ADDL R2,R2,#1
+AND R2,R2,R11
+AND R3,R2,R9
+BZ #8
+ADDL R8,R8,#1
+CML R2,#511
+BP #8
+ADDL R8,R8,#2
+SUBL R1,R1,#1
+BNZ #-40
+HALT
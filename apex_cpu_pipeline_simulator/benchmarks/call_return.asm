@@ -0,0 +1,18 @@
+MOVC R1,#20000
+MOVC R5,#0
+MOVC R12,#4064
+MOVC R13,#4048
+MOVC R16,#4036
+JALR R14,R13,#0
+JALR R15,R12,#0
+JUMP R16,#0
+ADDL R5,R5,#100
+SUBL R1,R1,#1
+BNZ #-20
+HALT
+ADDL R5,R5,#1
+JALR R15,R12,#0
+ADDL R5,R5,#2
+JUMP R14,#0
+ADDL R5,R5,#3
+JUMP R15,#0
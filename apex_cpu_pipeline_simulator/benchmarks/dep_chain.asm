@@ -0,0 +1,13 @@
+MOVC R1,#50000
+MOVC R2,#0
+ADDL R2,R2,#7
+SUBL R2,R2,#3
+ADDL R2,R2,#5
+SUBL R2,R2,#8
+ADDL R2,R2,#7
+SUBL R2,R2,#3
+ADDL R2,R2,#5
+SUBL R2,R2,#8
+SUBL R1,R1,#1
+BNZ #-36
+HALT
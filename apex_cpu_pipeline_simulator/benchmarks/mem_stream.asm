@@ -0,0 +1,14 @@
+MOVC R1,#500
+MOVC R2,#0
+MOVC R3,#64
+LOAD R4,R2,#0
+ADDL R4,R4,#1
+STORE R4,R2,#0
+LOAD R5,R2,#1024
+STORE R5,R2,#2048
+ADDL R2,R2,#1
+SUBL R3,R3,#1
+BNZ #-28
+SUBL R1,R1,#1
+BNZ #-44
+HALT
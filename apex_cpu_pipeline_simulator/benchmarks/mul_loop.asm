@@ -0,0 +1,12 @@
+MOVC R1,#50000
+MOVC R10,#3
+MOVC R11,#7
+MUL R2,R10,R11
+MUL R3,R11,R11
+MUL R4,R10,R10
+MUL R5,R2,R10
+MUL R6,R3,R4
+MUL R7,R5,R11
+SUBL R1,R1,#1
+BNZ #-28
+HALT
@@ -0,0 +1,13 @@
+MOVC R1,#400
+MOVC R6,#0
+MOVC R2,#0
+MOVC R3,#0
+MOVC R4,#200
+STOREP R4,R2,#0
+LOADP R5,R3,#0
+ADD R6,R6,R5
+SUBL R4,R4,#1
+BNZ #-16
+SUBL R1,R1,#1
+BNZ #-36
+HALT
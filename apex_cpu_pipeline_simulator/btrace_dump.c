@@ -0,0 +1,67 @@
+/*
+ * btrace_dump.c
+ * Converts a binary pipeline event trace written with --btrace into text,
+ * one tab separated event per line
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "apex_btrace.h"
+#include "apex_macros.h"
+
+static const char *const unit_names[NUM_FUS] = {
+    "int", "mul", "addr", "branch",
+};
+
+/* Physical tag as "P<n>", "-" for none */
+static const char *
+tag_str(int tag, char *buf, size_t size)
+{
+    if (tag < 0)
+    {
+        return "-";
+    }
+    snprintf(buf, size, "P%d", tag);
+    return buf;
+}
+
+int
+main(int argc, char const *argv[])
+{
+    APEX_BTrace_Reader *reader;
+    APEX_BTrace_Record rec;
+    char pd[16], ps1[16], ps2[16];
+    int ret;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "APEX_Help: Usage %s <btrace_file>\n", argv[0]);
+        exit(1);
+    }
+
+    reader = btrace_reader_open(argv[1]);
+    if (!reader)
+    {
+        fprintf(stderr, "APEX_Error: %s is not a binary trace of version %d\n",
+                argv[1], BTRACE_VERSION);
+        exit(1);
+    }
+
+    printf("cycle\tevent\tseq\tpc\tunit\tpd\tps1\tps2\n");
+    while ((ret = btrace_read(reader, &rec)) > 0)
+    {
+        printf("%ld\t%s\t%d\t%d\t%s\t%s\t%s\t%s\n", rec.cycle,
+               btrace_event_name(rec.kind), rec.seq, rec.pc,
+               (rec.unit >= 0 && rec.unit < NUM_FUS) ? unit_names[rec.unit] : "-",
+               tag_str(rec.pd, pd, sizeof(pd)), tag_str(rec.ps1, ps1, sizeof(ps1)),
+               tag_str(rec.ps2, ps2, sizeof(ps2)));
+    }
+    btrace_reader_close(reader);
+
+    if (ret < 0)
+    {
+        fprintf(stderr, "APEX_Error: %s is truncated\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
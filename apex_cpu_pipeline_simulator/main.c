@@ -5,43 +5,356 @@
  * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
  * State University of New York at Binghamton
  */
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "apex_batch.h"
 #include "apex_cpu.h"
+#include "apex_emu.h"
+#include "apex_options.h"
+
+/* Runs the whole program on the functional emulator and reports its speed */
+static void
+run_functional(APEX_CPU *cpu)
+{
+    double start = host_seconds();
+    double elapsed;
+    long executed;
+    int status;
+
+    status = APEX_emu_run(cpu, __LONG_MAX__, &executed);
+    elapsed = host_seconds() - start;
+
+    if (TRACE_ON(&cpu->trace, APEX_VERBOSITY_CYCLE))
+    {
+        print_reg_file(cpu);
+    }
+    TRACE(&cpu->trace, APEX_VERBOSITY_SUMMARY,
+          "APEX_EMU: Emulation %s, pc = %d instructions = %ld "
+          "(%.3f s, %.1f MIPS)\n",
+          status == APEX_EMU_FAULT ? "Faulted" : "Complete", cpu->pc,
+          executed, elapsed, elapsed > 0 ? executed / elapsed / 1e6 : 0.0);
+}
+
+/*
+ * Simulates every job of a list file, or every point of a sweep file when
+ * 'sweep' is set, concurrently and prints a summary table, or CSV to
+ * 'csv_file' when one is given. Returns 1 if the batch could not run or a
+ * job failed its --check.
+ */
+static int
+run_batch(const char *list_file, int sweep, const char *csv_file,
+          const APEX_Options *defaults, int num_threads)
+{
+    APEX_Job *jobs;
+    double start = host_seconds();
+    FILE *csv = NULL;
+    int num_jobs;
+    int ret = 0;
+
+    if (sweep)
+    {
+        num_jobs = APEX_sweep_load(list_file, defaults, &jobs);
+    }
+    else
+    {
+        num_jobs = APEX_batch_load(list_file, defaults, &jobs);
+    }
+    if (num_jobs < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to read %s %s\n",
+                sweep ? "sweep file" : "batch list", list_file);
+        return 1;
+    }
+
+    if (csv_file)
+    {
+        csv = strcmp(csv_file, "-") == 0 ? stdout : fopen(csv_file, "w");
+        if (!csv)
+        {
+            fprintf(stderr, "APEX_Error: Unable to write %s\n", csv_file);
+            APEX_batch_free(jobs, num_jobs);
+            return 1;
+        }
+    }
+
+    APEX_batch_run(jobs, num_jobs, num_threads);
+    if (csv)
+    {
+        APEX_batch_csv(csv, jobs, num_jobs);
+        if (csv != stdout)
+        {
+            fclose(csv);
+        }
+    }
+    else
+    {
+        APEX_batch_report(stdout, jobs, num_jobs);
+    }
+    fprintf(csv == stdout ? stderr : stdout,
+            "APEX_BATCH: %d jobs on %d threads, %.3f s\n", num_jobs,
+            num_threads, host_seconds() - start);
+
+    /* A job that disagrees with the functional emulator fails the batch */
+    for (int i = 0; i < num_jobs; i++)
+    {
+        if (jobs[i].check == APEX_CHECK_MISMATCH)
+        {
+            ret = 1;
+        }
+    }
+    APEX_batch_free(jobs, num_jobs);
+    return ret;
+}
+
+/* Parses a text program once and writes it out as a pre-assembled image */
+static int
+assemble(const char *input_file, const char *image_file)
+{
+    APEX_Instruction *code_memory;
+    int size;
+
+    code_memory = create_code_memory(input_file, &size);
+    if (!code_memory)
+    {
+        fprintf(stderr, "APEX_Error: Unable to parse %s\n", input_file);
+        return 1;
+    }
+
+    if (write_code_image(image_file, code_memory, size) != 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", image_file);
+        free(code_memory);
+        return 1;
+    }
+    fprintf(stderr, "APEX_ASM: Wrote %d instructions to %s\n", size, image_file);
+    free(code_memory);
+    return 0;
+}
+
+static void
+print_usage(const char *prog)
+{
+    fprintf(stderr,
+            "APEX_Help: Usage %s <input_file|checkpoint> [simulate <cycles>] [options]\n"
+            "           %s --batch=<list_file> [--jobs=<n>] [options]\n"
+            "           %s --sweep=<sweep_file> [--jobs=<n>] [--csv=<file>] [options]\n"
+            "           %s <input_file> --assemble=<image_file>\n"
+            "  --verbosity=<quiet|summary|cycle|stage>  output level (default stage)\n"
+            "  --trace-file=<path>                      write output to a file\n"
+            "  --kanata=<path>                          log pipeline events of every\n"
+            "                                           instruction in Kanata format\n"
+            "  --btrace=<path>                          log pipeline events to a compact\n"
+            "                                           binary trace, see apex_btrace_dump\n"
+            "  --event-driven                           skip idle cycles\n"
+            "  --fast-forward=<n>                       execute the first n instructions\n"
+            "                                           functionally before simulating\n"
+            "  --functional                             run the whole program functionally\n"
+            "  --check                                  compare registers and memory at HALT\n"
+            "                                           with the functional emulator\n"
+            "  --max-cycles=<n>                         same as simulate <n>\n"
+            "  --checkpoint-at=<cycle>                  save the CPU state at <cycle>\n"
+            "  --checkpoint-file=<path>                 checkpoint path (default %s)\n"
+            "  --batch=<list_file>                      simulate one program per line of\n"
+            "                                           <list_file>, options may follow\n"
+            "                                           the program on each line\n"
+            "  --sweep=<sweep_file>                     simulate every program of <sweep_file>\n"
+            "                                           at every point of its parameter ranges\n"
+            "  --jobs=<n>                               batch worker threads (default: all cores)\n"
+            "  --csv=<file>                             write batch/sweep results as CSV,\n"
+            "                                           \"-\" for stdout\n"
+            "  --assemble=<image_file>                  write <input_file> as a binary program\n"
+            "                                           image that loads without parsing\n"
+            "  --iq-size=<n> --bq-size=<n> --rob-size=<n> --lsq-size=<n>\n"
+            "  --prf-size=<n> --btb-size=<n>            structure sizes, prf-size counts the\n"
+            "                                           rename registers (default %d/%d/%d/%d/%d/%d)\n"
+            "  --btb-ways=<n>                           BTB associativity (default %d)\n"
+            "  --width=<n>                              instructions fetched, decoded,\n"
+            "                                           dispatched and committed per cycle\n"
+            "                                           (default %d)\n"
+            "  --mul-latency=<n>                        multiplier pipeline stages, one MUL\n"
+            "                                           enters per cycle (default %d)\n"
+            "  --bpred=<kind>                           branch direction predictor: bimodal,\n"
+            "                                           gshare or tournament (default %s)\n"
+            "  --bpred-size=<n> --bpred-history=<n>     entries of each predictor table and\n"
+            "                                           global history bits (default %d/%d)\n"
+            "  --ras-size=<n> --indirect-size=<n>       return address stack and indirect\n"
+            "                                           target predictor entries (default %d/%d)\n"
+            "  --branch-checkpoints=<n>                 rename checkpoints, branches in flight\n"
+            "                                           past decode (default %d)\n"
+            "  --icache-size=<bytes> --icache-ways=<n>  instruction cache, 0 bytes for none\n"
+            "                                           (default %d/%d)\n"
+            "  --icache-line=<bytes>                    I-cache line size, fetch groups stay\n"
+            "                                           within a line (default %d)\n"
+            "  --icache-miss-latency=<n>                cycles fetch waits for a fill\n"
+            "                                           (default %d)\n"
+            "  --dcache-size=<bytes> --dcache-ways=<n>  L1 data cache, 0 bytes for none\n"
+            "                                           (default %d/%d)\n"
+            "  --dcache-line=<bytes>                    L1D line size (default %d)\n"
+            "  --dcache-hit-latency=<n>                 MAU cycles of an L1D hit and cycles\n"
+            "  --dcache-miss-latency=<n>                a miss adds (default %d/%d)\n"
+            "  --dcache-policy=<policy>                 writeback or writethrough (default %s)\n"
+            "  --config=<file>                          read sizes from <file>, one\n"
+            "                                           \"iq-size=<n>\" setting per line\n",
+            prog, prog, prog, prog, APEX_DEFAULT_CHECKPOINT, DEFAULT_IQ_SIZE,
+            DEFAULT_BQ_SIZE, DEFAULT_ROB_SIZE, DEFAULT_LSQ_SIZE,
+            DEFAULT_RENAME_REGS, DEFAULT_BTB_SIZE, DEFAULT_BTB_WAYS, DEFAULT_WIDTH,
+            DEFAULT_MUL_LATENCY, bpred_name(DEFAULT_BPRED), DEFAULT_BPRED_SIZE,
+            DEFAULT_BPRED_HISTORY, DEFAULT_RAS_SIZE, DEFAULT_INDIRECT_SIZE,
+            DEFAULT_BRANCH_CHECKPOINTS, DEFAULT_ICACHE_SIZE, DEFAULT_ICACHE_WAYS,
+            DEFAULT_ICACHE_LINE, DEFAULT_ICACHE_MISS_LATENCY, DEFAULT_DCACHE_SIZE, DEFAULT_DCACHE_WAYS,
+            DEFAULT_DCACHE_LINE, DEFAULT_DCACHE_HIT_LATENCY, DEFAULT_DCACHE_MISS_LATENCY,
+            cache_policy_name(DEFAULT_DCACHE_POLICY));
+}
 
 int
 main(int argc, char const *argv[])
 {
     APEX_CPU *cpu;
+    APEX_Options opts;
+    const char *positional[3];
+    const char *batch_file = NULL;
+    const char *csv_file = NULL;
+    int sweep = FALSE;
+    const char *image_file = NULL;
+    int num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int num_positional = 0;
+    int i;
 
     fprintf(stderr, "APEX CPU Pipeline Simulator v%0.1lf\n", VERSION);
 
-    if (argc != 2 && argc != 4)
+    options_init(&opts);
+    for (i = 1; i < argc; ++i)
+    {
+        if (strncmp(argv[i], "--batch=", 8) == 0 || strncmp(argv[i], "--sweep=", 8) == 0)
+        {
+            batch_file = argv[i] + 8;
+            sweep = argv[i][2] == 's';
+
+            /* Batch jobs are silent unless --verbosity asks otherwise */
+            opts.verbosity = APEX_VERBOSITY_QUIET;
+        }
+    }
+
+    for (i = 1; i < argc; ++i)
+    {
+        int ret = options_parse(&opts, argv[i]);
+
+        if (ret < 0)
+        {
+            print_usage(argv[0]);
+            exit(1);
+        }
+        else if (ret > 0 || strncmp(argv[i], "--batch=", 8) == 0
+                 || strncmp(argv[i], "--sweep=", 8) == 0)
+        {
+            continue;
+        }
+        else if (strncmp(argv[i], "--csv=", 6) == 0)
+        {
+            csv_file = argv[i] + 6;
+        }
+        else if (strncmp(argv[i], "--jobs=", 7) == 0)
+        {
+            long jobs;
+
+            if (config_parse_number(argv[i] + 7, 1, INT_MAX, &jobs) != 0)
+            {
+                print_usage(argv[0]);
+                exit(1);
+            }
+            num_threads = (int)jobs;
+        }
+        else if (strncmp(argv[i], "--assemble=", 11) == 0)
+        {
+            image_file = argv[i] + 11;
+        }
+        else if (argv[i][0] == '-' || num_positional == 3)
+        {
+            print_usage(argv[0]);
+            exit(1);
+        }
+        else
+        {
+            positional[num_positional++] = argv[i];
+        }
+    }
+
+    if (batch_file)
     {
-        fprintf(stderr, "APEX_Help: Usage %s <input_file>\n", argv[0]);
+        /* Each job writes its own trace and checkpoint, see APEX_batch_load.
+         * Event logs are only kept when a list line asks for one */
+        opts.trace_file = NULL;
+        opts.kanata_file = NULL;
+        opts.btrace_file = NULL;
+        opts.checkpoint_file = NULL;
+        return run_batch(batch_file, sweep, csv_file, &opts,
+                         num_threads > 0 ? num_threads : 1);
+    }
+
+    if (num_positional != 1 && num_positional != 3)
+    {
+        print_usage(argv[0]);
         exit(1);
     }
-    cpu = APEX_cpu_init(argv[1]);
-    if(argc == 4) {
-        const char *number = argv[3];
-        cpu->simulate_counter = atoi(number);
-         if (cpu->simulate_counter == 0 || number[0] != '0') {
+
+    if (image_file)
+    {
+        return assemble(positional[0], image_file);
+    }
+
+    if (num_positional == 3)
+    {
+        const char *number = positional[2];
+        long cycles;
+
+        if (config_parse_number(number, 0, INT_MAX, &cycles) != 0)
+        {
             printf("Error Occurred : Please enter a digit\n");
+            exit(1);
         }
-        cpu->simulator_flag = 1;
+        opts.max_cycles = (int)cycles;
     }
 
+    cpu = APEX_cpu_init(positional[0], &opts.config);
     if (!cpu)
     {
         fprintf(stderr, "APEX_Error: Unable to initialize CPU\n");
         exit(1);
     }
 
+    if (opts.functional)
+    {
+        opts.fast_forward = 0;
+        if (APEX_cpu_apply_options(cpu, &opts) != 0)
+        {
+            fprintf(stderr, "APEX_Error: Unable to open trace file %s\n", opts.trace_file);
+            exit(1);
+        }
+        run_functional(cpu);
+        APEX_cpu_stop(cpu);
+        return 0;
+    }
+
+    if (APEX_cpu_apply_options(cpu, &opts) != 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to set up the CPU, check the trace "
+                        "file, event logs and fast-forward options\n");
+        exit(1);
+    }
+
     //fprintf(stderr, "Instructions in IQ: %d\n", cpu->iq_size);
     //fprintf(stderr, "Instructions in BQ: %d\n", cpu->bq_size);
 
-    APEX_cpu_run(cpu);
+    if (APEX_cpu_run(cpu) == APEX_RUN_HALTED && opts.check
+        && APEX_emu_check(cpu, positional[0]) == APEX_CHECK_MISMATCH)
+    {
+        APEX_cpu_stop(cpu);
+        return 1;
+    }
     APEX_cpu_stop(cpu);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,5 @@
+MOVC R1,#100
+LOAD R2,R1,#0
+LOAD R3,R1,#64
+ADD R4,R2,R3
+HALT
@@ -0,0 +1,8 @@
+MOVC R1,#100
+MOVC R2,#0
+DIV R3,R1,R2
+MOVC R4,#7
+DIV R5,R1,R4
+ADD R6,R3,R5
+STORE R6,R1,#0
+HALT
@@ -0,0 +1,8 @@
+MOVC R1,#1
+MOVC R2,#2
+MOVC R3,#3
+MOVC R4,#4
+ADD R5,R1,R2
+ADD R6,R3,R4
+ADD R7,R5,R6
+HALT
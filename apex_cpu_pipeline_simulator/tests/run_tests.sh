@@ -0,0 +1,252 @@
+#!/bin/sh
+#
+# Regression checks of the cycle-level model, run with "make test" from the
+# simulator directory. Every check prints PASS or FAIL, the script exits with
+# status 1 if any failed.
+
+SIM=./apex_sim
+failed=0
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# Cycles of a run to HALT
+cycles()
+{
+    $SIM "$@" --max-cycles=10000000 --verbosity=summary \
+        | sed -n 's/.*cycles = \([0-9]*\).*/\1/p'
+}
+
+# Idle cycles an --event-driven run jumps over
+skipped()
+{
+    $SIM "$@" --max-cycles=10000000 --event-driven --verbosity=cycle \
+        | sed -n 's/.*Skipped \([0-9]*\) idle cycles.*/\1/p' \
+        | awk '{ s += $1 } END { print s + 0 }'
+}
+
+# "cycles = <n> instructions = <n>" of a run to HALT
+totals()
+{
+    $SIM "$@" --max-cycles=10000000 --verbosity=summary \
+        | sed -n 's/.*Simulation Complete, \(cycles = .*\)/\1/p'
+}
+
+# Share of the commit slots in CPI stack category <name>, e.g. "core"
+cpi_share()
+{
+    name=$1
+    shift
+    $SIM "$@" --max-cycles=10000000 --verbosity=summary \
+        | sed -n "s/^APEX_CPI:.* $name=\([0-9.]*\).*/\1/p"
+}
+
+check()
+{
+    name=$1
+    shift
+    if "$@"; then
+        echo "PASS $name"
+    else
+        echo "FAIL $name"
+        failed=1
+    fi
+}
+
+# Stepped and --event-driven runs of <program> [options] take the same
+# cycles, and the event-driven one skips at least <min> of them
+event_driven_exact()
+{
+    min=$1
+    shift
+    stepped=$(cycles "$@")
+    event=$(cycles "$@" --event-driven)
+    skip=$(skipped "$@")
+    echo "     $*: $stepped stepped, $event event-driven, $skip skipped"
+    [ -n "$stepped" ] && [ "$stepped" = "$event" ] && [ "$skip" -ge "$min" ]
+}
+
+check "event-driven skips an L1D miss" \
+    event_driven_exact 900 tests/dcache_miss.asm --dcache-miss-latency=500
+check "event-driven skips I-cache misses" \
+    event_driven_exact 900 tests/icache_miss.asm --icache-size=64 --icache-miss-latency=500
+
+# Mispredict refills of <program> [options] are bad speculation, not core.
+# The kernels run at width 1, where none of their dependencies holds up
+# the ROB head.
+refill_is_bad_speculation()
+{
+    core=$(cpi_share core "$@")
+    bad=$(cpi_share bad_speculation "$@")
+    echo "     $*: core $core, bad_speculation $bad"
+    awk -v core="$core" -v bad="$bad" 'BEGIN { exit !(core < 0.01 && bad > 0.01) }'
+}
+
+check "mispredict refill charged to bad speculation" \
+    refill_is_bad_speculation benchmarks/branch_random.asm
+check "... with biased branches" \
+    refill_is_bad_speculation benchmarks/branch_biased.asm
+
+# A checkpoint of <program> [options] saved at <cycle> and resumed ends with
+# the cycles and instructions of an uninterrupted run
+checkpoint_resumes()
+{
+    at=$1
+    shift
+    whole=$(totals "$@")
+    $SIM "$@" --checkpoint-at="$at" --checkpoint-file="$tmp/resume.ckpt" \
+        --max-cycles="$at" --verbosity=quiet >/dev/null
+    resumed=$(totals "$tmp/resume.ckpt")
+    echo "     $*: $whole, resumed at $at: $resumed"
+    [ -n "$whole" ] && [ "$whole" = "$resumed" ]
+}
+
+check "checkpoint resumes exactly" \
+    checkpoint_resumes 12345 benchmarks/call_return.asm
+check "... with the caches warm" \
+    checkpoint_resumes 5000 benchmarks/mem_stream.asm --icache-size=256
+check "... after a fast-forward" \
+    checkpoint_resumes 2000 benchmarks/call_return.asm --fast-forward=1000
+
+# <program> assembled with --assemble runs from the image to the same
+# cycles and instructions as from the text, and the image is refused once
+# its CODE_IMAGE_VERSION is changed
+image_runs_like_text()
+{
+    $SIM "$1" --assemble="$tmp/prog.img" >/dev/null 2>&1 || return 1
+    text=$(totals "$1")
+    image=$(totals "$tmp/prog.img")
+    echo "     $1: $text from the text, $image from the image"
+    [ -n "$text" ] && [ "$text" = "$image" ] || return 1
+
+    # The version is the 32-bit word after the 8-byte magic
+    printf '\377' | dd of="$tmp/prog.img" bs=1 seek=8 conv=notrunc 2>/dev/null
+    $SIM "$tmp/prog.img" --verbosity=quiet 2>&1 | grep -q "program image is corrupt"
+}
+
+check "assembled image runs like the text" \
+    image_runs_like_text benchmarks/call_return.asm
+
+# --fast-forward is refused on a checkpoint of <program> taken at <cycle>,
+# whose in-flight instructions the emulator cannot see
+refuses_mid_run_fast_forward()
+{
+    $SIM "$2" --checkpoint-at="$1" --checkpoint-file="$tmp/ff.ckpt" \
+        --max-cycles="$1" --verbosity=quiet >/dev/null
+    ! $SIM "$tmp/ff.ckpt" --fast-forward=1000 --verbosity=quiet >/dev/null 2>&1
+}
+
+check "fast-forward refused on a mid-run checkpoint" \
+    refuses_mid_run_fast_forward 12345 benchmarks/call_return.asm
+
+# <program> [options] ends with the registers and memory of the functional
+# emulator
+matches_emulator()
+{
+    $SIM "$@" --check --max-cycles=10000000 --verbosity=summary 2>&1 \
+        | grep -q "^APEX_CHECK: Registers and memory match"
+}
+
+check "divide by zero agrees with the emulator" \
+    matches_emulator tests/div_zero.asm
+check "... after a fast-forward over it" \
+    matches_emulator tests/div_zero.asm --fast-forward=4
+
+# A --kanata log of the first <cycles> of <program> [options] starts with the
+# Kanata header and retires, type 0, as many instructions as the run reports
+kanata_log_retires()
+{
+    limit=$1
+    shift
+    retired=$($SIM "$@" --kanata="$tmp/run.kanata" --max-cycles="$limit" \
+        --verbosity=summary | sed -n 's/.*instructions = \([0-9]*\).*/\1/p')
+    header=$(head -1 "$tmp/run.kanata")
+    logged=$(grep -c "^R	[0-9]*	[0-9]*	0$" "$tmp/run.kanata")
+    flushed=$(grep -c "^R	[0-9]*	[0-9]*	1$" "$tmp/run.kanata")
+    echo "     $*: $retired retired, $logged logged, $flushed flushed"
+    [ "$header" = "Kanata	0004" ] && [ -n "$retired" ] && [ "$retired" = "$logged" ] \
+        && [ "$flushed" -gt 0 ]
+}
+
+check "kanata log retires every instruction" \
+    kanata_log_retires 3000 benchmarks/branch_random.asm --width=2
+
+# A --btrace of the first <cycles> of <program> [options], read back with
+# apex_btrace_dump, has the fetches, retires and flushes of the Kanata log
+# of the same run, in cycle order and with consecutive fetch numbers. The
+# run is long enough to fill several writer buffers.
+btrace_round_trips()
+{
+    limit=$1
+    shift
+    $SIM "$@" --btrace="$tmp/run.btr" --kanata="$tmp/run.kanata" \
+        --max-cycles="$limit" --verbosity=quiet >/dev/null
+    ./apex_btrace_dump "$tmp/run.btr" > "$tmp/run.txt" || return 1
+    dumped=$(awk 'NR > 1 { n[$2]++ } END { print n["fetch"] + 0, n["retire"] + 0, n["flush"] + 0 }' \
+        "$tmp/run.txt")
+    logged=$(awk '$1 == "I" { i++ } $1 == "R" { r[$4]++ } END { print i + 0, r[0] + 0, r[1] + 0 }' \
+        "$tmp/run.kanata")
+    echo "     $*: fetch/retire/flush $dumped dumped, $logged in the Kanata log"
+    [ "$dumped" = "$logged" ] && awk '
+        NR == 1 { next }
+        $1 < cycle { exit 1 }
+        $2 == "fetch" { if ($3 != fetched) exit 1; fetched++ }
+        { cycle = $1 }' "$tmp/run.txt"
+}
+
+check "binary trace round-trips through apex_btrace_dump" \
+    btrace_round_trips 200000 benchmarks/branch_random.asm --width=2
+
+# Every setting in <settings> is refused, so the run exits with an error
+rejects()
+{
+    for setting in "$@"; do
+        if $SIM tests/dcache_miss.asm "$setting" --max-cycles=10 >/dev/null 2>&1; then
+            echo "     $setting was accepted"
+            return 1
+        fi
+    done
+}
+
+check "non-numeric configuration values are refused" \
+    rejects --icache-size=abc --icache-size=64k --icache-size= --iq-size=99999999999
+check "non-numeric run options are refused" \
+    rejects --max-cycles=abc --max-cycles=1e6 --max-cycles=-5 --fast-forward=10x \
+    --checkpoint-at= --checkpoint-at=99999999999 --jobs=abc --jobs=0
+
+# Every sweep line in <lines> is refused, so the sweep exits with an error
+rejects_sweep()
+{
+    for values in "$@"; do
+        printf 'program tests/div_zero.asm\n%s\n' "$values" > "$tmp/bad.sweep"
+        if $SIM --sweep="$tmp/bad.sweep" --jobs=1 >/dev/null 2>&1; then
+            echo "     \"$values\" was accepted"
+            return 1
+        fi
+    done
+}
+
+check "malformed sweep values are refused" \
+    rejects_sweep "iq-size 16x" "iq-size 8:4" "iq-size 8:16:0" "iq-size 8:16:" "iq-size"
+
+# A sweep of two programs over 2 x 3 points writes a CSV with a header and
+# one row per job, each with the header's column count once the quoted
+# fields are set aside. Options holding a comma and a quote come back
+# quoted, with the quote doubled.
+sweep_writes_csv()
+{
+    printf '%s\n' "program tests/div_zero.asm" \
+        "program tests/dcache_miss.asm --trace-file=$tmp/a\"b,c.trace" \
+        "iq-size 8 16" "rob-size 16:48:16" > "$tmp/good.sweep"
+    $SIM --sweep="$tmp/good.sweep" --jobs=2 --csv="$tmp/sweep.csv" >/dev/null 2>&1 || return 1
+    rows=$(($(wc -l < "$tmp/sweep.csv") - 1))
+    quoted=$(grep -c '^"tests/dcache_miss.asm","--trace-file=.*a""b,c.trace' "$tmp/sweep.csv")
+    echo "     $rows rows, $quoted with a quoted comma and quote"
+    [ "$rows" -eq 12 ] && [ "$quoted" -eq 6 ] && awk -F, '
+        { gsub(/"[^"]*"/, "") }
+        NR == 1 { columns = NF }
+        NF != columns { exit 1 }' "$tmp/sweep.csv"
+}
+
+check "sweep CSV has a quoted row per job" sweep_writes_csv
+
+exit $failed